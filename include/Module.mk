@@ -9,7 +9,7 @@
 
 INCLUDE_DIR	:= include
 
-INCLUDE_TARGETS	:= i2c/smbus.h
+INCLUDE_TARGETS	:= i2c/smbus.h i2c/rip.h i2c/stats.h i2c/lock.h
 
 #
 # Commands
@@ -0,0 +1,30 @@
+/*
+    lock.h - Advisory locks arbitrating I2C busses between processes
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+*/
+
+#ifndef LIB_I2C_LOCK_H
+#define LIB_I2C_LOCK_H
+
+/*
+ * Jobs take a bus with a priority from 0 (default) to
+ * I2C_BUS_PRIORITY_MAX on its open i2c-dev file and hold it until they
+ * unlock it or close the file. A job of higher priority waiting for
+ * the bus goes before the ones of lower priority, and the owner can
+ * ask whether one waits and give the bus up.
+ */
+
+#define I2C_BUS_PRIORITY_MAX	7
+
+/* Without wait, fails with -EWOULDBLOCK when the bus is taken or wanted
+   by a higher priority job */
+extern int i2c_bus_lock(int file, int priority, int wait);
+extern void i2c_bus_unlock(int file);
+/* Whether a job of higher priority waits for the bus */
+extern int i2c_bus_contended(int file, int priority);
+
+#endif /* LIB_I2C_LOCK_H */
@@ -0,0 +1,372 @@
+/*
+    rip.h - i2crip script engine
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_I2C_RIP_H
+#define LIB_I2C_RIP_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/types.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define I2C_RIP_API_VERSION	0x100
+
+/* Bytes of one transfer, register address included */
+#define I2C_RIP_XFER_MAX	64
+#define I2C_RIP_BLOCK_MAX	0xFFFF
+
+/* The order is part of compiled scripts, new commands go at the end */
+enum i2c_rip_op {
+	I2C_RIP_INVALID = -1,
+	I2C_RIP_SET_BUS = 0,
+	I2C_RIP_SET_ID,
+	I2C_RIP_DELAY,
+	I2C_RIP_SUPRESS_ERRORS,
+	I2C_RIP_LOG_TO_FILE,
+	I2C_RIP_LOG_TO_TERM,
+	I2C_RIP_8_WRITE_BYTE,
+	I2C_RIP_16_WRITE_BYTE,
+	I2C_RIP_8_WRITE_WORD,
+	I2C_RIP_16_WRITE_WORD,
+	I2C_RIP_8_READ_BYTE,
+	I2C_RIP_16_READ_BYTE,
+	I2C_RIP_8_READ_WORD,
+	I2C_RIP_16_READ_WORD,
+	I2C_RIP_8_VERIFY_BYTE,
+	I2C_RIP_16_VERIFY_BYTE,
+	I2C_RIP_8_VERIFY_WORD,
+	I2C_RIP_16_VERIFY_WORD,
+	I2C_RIP_SET_BURST,
+	I2C_RIP_8_WRITE_BLOCK,
+	I2C_RIP_16_WRITE_BLOCK,
+	I2C_RIP_SYNC,
+	I2C_RIP_8_POLL,
+	I2C_RIP_16_POLL,
+	I2C_RIP_POLL_INTERVAL,
+	I2C_RIP_8_READ_BLOCK,
+	I2C_RIP_16_READ_BLOCK,
+	I2C_RIP_8_VERIFY_BLOCK,
+	I2C_RIP_16_VERIFY_BLOCK,
+	I2C_RIP_8_WRITE_FILE,
+	I2C_RIP_16_WRITE_FILE,
+	I2C_RIP_8_VERIFY_FILE,
+	I2C_RIP_16_VERIFY_FILE,
+	I2C_RIP_VOLATILE,
+	I2C_RIP_LOOP,
+	I2C_RIP_END_LOOP,
+	I2C_RIP_NUM_CMDS
+};
+
+/* Register and data of byte and word commands, by register size */
+struct i2c_rip_byte8 {
+	__u8 addr;
+	__u8 data;
+};
+
+struct i2c_rip_word8 {
+	__u8 addr;
+	__u16 data;
+};
+
+struct i2c_rip_byte16 {
+	__u16 addr;
+	__u8 data;
+};
+
+struct i2c_rip_word16 {
+	__u16 addr;
+	__u16 data;
+};
+
+/* Data bytes live in the payload arena, block reads have none (offset -1) */
+struct i2c_rip_block {
+	__u16 addr;
+	__u16 length;
+	int offset;
+};
+
+/* Binary file streamed to consecutive registers, the path is in the payload
+   arena; a chunk of 0 uses the transfer buffer or SET-BURST size */
+struct i2c_rip_file {
+	__u16 addr;
+	__u16 chunk;
+	int path;
+};
+
+/* Read until (value & mask) == expected or the timeout */
+struct i2c_rip_poll {
+	__u16 addr;
+	__u8 mask;
+	__u8 expected;
+	int timeout_ms;
+};
+
+/* Poll interval, doubled after every read up to the max */
+struct i2c_rip_interval {
+	int initial_us;
+	int max_us;
+};
+
+/* Inclusive register range */
+struct i2c_rip_range {
+	int first;
+	int last;
+};
+
+/* Commands up to END-LOOP run count times, one period apart */
+struct i2c_rip_loop {
+	int period_us;
+	int count;
+};
+
+union i2c_rip_data {
+	struct i2c_rip_byte8 byte8;
+	struct i2c_rip_word8 word8;
+	struct i2c_rip_byte16 byte16;
+	struct i2c_rip_word16 word16;
+	struct i2c_rip_block block;
+	struct i2c_rip_poll poll;
+	struct i2c_rip_interval interval;
+	struct i2c_rip_file file;
+	struct i2c_rip_range range;
+	struct i2c_rip_loop loop;
+	int single;
+};
+
+/* One parsed line, compiled scripts are arrays of these */
+struct i2c_rip_cmd {
+	enum i2c_rip_op op;
+	union i2c_rip_data data;
+	__u8 valid;
+};
+
+/* Growing byte arena holding block data and file paths
+   With a size of 0 the data is not owned, e.g. it points into a mapped image */
+struct i2c_rip_arena {
+	__u8 *data;
+	int length;
+	int size;
+};
+
+/* Returns the offset of the data */
+extern int i2c_rip_arena_append(struct i2c_rip_arena *arena, const void *data,
+				int size);
+extern void i2c_rip_arena_free(struct i2c_rip_arena *arena);
+/* Parses one line without its newline, block data and file paths go to
+   payload; empty lines give a command that is not valid. On failure the
+   reason is in error, unless the line is only empty */
+extern int i2c_rip_parse_line(const char *line, int size,
+			      struct i2c_rip_cmd *cmd,
+			      struct i2c_rip_arena *payload,
+			      char *error, int error_size);
+extern const char *i2c_rip_op_name(int op);
+extern int i2c_rip_op_is_read(enum i2c_rip_op op);
+extern int i2c_rip_op_is_block(enum i2c_rip_op op);
+extern int i2c_rip_op_is_file(enum i2c_rip_op op);
+extern int i2c_rip_op_has_payload(enum i2c_rip_op op);
+/* Commands a parallel run waits for every bus at */
+extern int i2c_rip_op_is_barrier(enum i2c_rip_op op);
+/* Registers a WB/WW or WBLK command writes, 0 for any other command */
+extern int i2c_rip_write_range(const struct i2c_rip_cmd *cmd, int *reg,
+			       int *reg_size, int *length);
+
+/* SET-BURST value of a device that never had one */
+#define I2C_RIP_BURST_DEFAULT	-1
+
+/* Max data bytes of one transfer at a SET-BURST value */
+extern int i2c_rip_burst_limit(int burst, int reg_size);
+
+/* Log destinations */
+#define I2C_RIP_LOG_FILE	0x01
+#define I2C_RIP_LOG_STDOUT	0x02
+#define I2C_RIP_LOG_STDERR	0x04
+
+/* Longest formatted transfer, see i2c_rip_format_xfer() */
+#define I2C_RIP_LOG_FORMAT_MAX	1024
+
+enum i2c_rip_xfer_action {
+	I2C_RIP_XFER_WRITE = 0,
+	I2C_RIP_XFER_READ,
+	I2C_RIP_XFER_VERIFY,
+	I2C_RIP_XFER_UNCHANGED,
+};
+
+/* Raw bytes of a logged transfer, line is 0 without line numbers */
+struct i2c_rip_xfer {
+	int line;
+	__u8 action;
+	__u8 reg_size;
+	__u8 size;
+	__u8 reg[2];
+	__u8 data[I2C_RIP_XFER_MAX];
+	__u8 expected[I2C_RIP_XFER_MAX];
+};
+
+/* Returns the length of the text, out holds I2C_RIP_LOG_FORMAT_MAX */
+extern int i2c_rip_format_xfer(char *out, const struct i2c_rip_xfer *xfer);
+
+/* Data of a completed RB/RW/RBLK transfer, a block has one per chunk */
+struct i2c_rip_read {
+	int index;
+	int line;
+	enum i2c_rip_op op;
+	int bus;
+	int addr;
+	int reg;
+	int size;
+	const __u8 *data;
+};
+
+enum i2c_rip_event_type {
+	I2C_RIP_EVENT_RDWR,	/* an I2C_RDWR call, bytes not in an XFER */
+	I2C_RIP_EVENT_XFER,	/* a transfer, its share of an I2C_RDWR call */
+	I2C_RIP_EVENT_CMD,	/* any other command but files */
+	I2C_RIP_EVENT_SLEEP,	/* DELAY, POLL and LOOP waits */
+	I2C_RIP_EVENT_OPEN,	/* opening a bus */
+	I2C_RIP_EVENT_FUNCS,	/* checking what the adapter can do */
+	I2C_RIP_EVENT_LOCK,	/* waiting for a bus other jobs held */
+	I2C_RIP_EVENT_ELIDED,	/* a write the shadow left out */
+	I2C_RIP_EVENT_YIELD,	/* a bus given to a higher priority job */
+};
+
+struct i2c_rip_event {
+	enum i2c_rip_event_type type;
+	enum i2c_rip_op op;
+	int bus;
+	int addr;
+	__u64 ns;
+	int bytes;
+};
+
+/*
+ * Where the output of a run goes, any callback may be NULL. Log text
+ * comes with the index of the command it belongs to and its
+ * destinations, without log the library writes it to the log file,
+ * stdout and stderr itself. Without log_xfer, transfers are formatted
+ * and go to log. Events are only timed when event is set.
+ */
+struct i2c_rip_ops {
+	void (*log)(void *user, int index, unsigned int dest, const char *text,
+		    int length);
+	void (*log_xfer)(void *user, int index, unsigned int dest,
+			 const struct i2c_rip_xfer *xfer);
+	void (*read)(void *user, const struct i2c_rip_read *read);
+	void (*event)(void *user, const struct i2c_rip_event *event);
+};
+
+/*
+ * Way to the busses, the default is i2c-dev through libi2c, arbitrated
+ * with the other tools (see i2c/lock.h). Functions return -errno on
+ * failure, open a file and rdwr the number of messages sent. check and
+ * set_slave may be NULL; lock, unlock and contended are NULL when
+ * nothing else uses the busses.
+ */
+struct i2c_rip_transport {
+	int (*open)(void *user, int bus);
+	int (*check)(void *user, int file);
+	int (*set_slave)(void *user, int file, int addr);
+	int (*rdwr)(void *user, int file, struct i2c_rdwr_ioctl_data *rdwr);
+	void (*close)(void *user, int file);
+	int (*lock)(void *user, int file, int priority, int wait);
+	void (*unlock)(void *user, int file);
+	int (*contended)(void *user, int file, int priority);
+};
+
+/* Context flags */
+#define I2C_RIP_BATCH		0x01	/* transfers share I2C_RDWR calls */
+#define I2C_RIP_DEBUG		0x02	/* log lines start with their line */
+#define I2C_RIP_QUIET		0x04	/* no log output at all */
+#define I2C_RIP_SHADOW		0x08	/* leave out writes of known values */
+#define I2C_RIP_RECONCILE	0x10	/* read registers back first, shadow */
+
+#define I2C_RIP_NO_BUS		-1
+/* Stream of every command, see i2c_rip_ctx_set_streams() */
+#define I2C_RIP_ALL_STREAMS	-2
+
+/*
+ * A context holds a script, the busses it opened with their shadow
+ * registers, and the settings the script changes; contexts share
+ * nothing. A run is one pass over commands of the script on the calling
+ * thread. Runs of the same context may go on at once on different
+ * threads as long as each uses its own busses, one stream each.
+ */
+struct i2c_rip_ctx;
+struct i2c_rip_run;
+
+extern struct i2c_rip_ctx *i2c_rip_ctx_new(void);
+extern void i2c_rip_ctx_free(struct i2c_rip_ctx *ctx);
+extern void i2c_rip_ctx_set_ops(struct i2c_rip_ctx *ctx,
+				const struct i2c_rip_ops *ops, void *user);
+/* Busses already open are closed, NULL goes back to i2c-dev */
+extern void i2c_rip_ctx_set_transport(struct i2c_rip_ctx *ctx,
+				      const struct i2c_rip_transport *transport,
+				      void *user);
+extern void i2c_rip_ctx_set_flags(struct i2c_rip_ctx *ctx, unsigned int flags);
+/* Bus priority from 0 to I2C_BUS_PRIORITY_MAX */
+extern void i2c_rip_ctx_set_priority(struct i2c_rip_ctx *ctx, int priority);
+/* Parses script text into the context */
+extern int i2c_rip_ctx_load(struct i2c_rip_ctx *ctx, const char *text,
+			    size_t size);
+/* Hands the script i2c_rip_ctx_load() parsed to the caller, who frees
+   cmds and lines with free() and payload with i2c_rip_arena_free();
+   returns the number of commands and leaves the context empty */
+extern int i2c_rip_ctx_take_script(struct i2c_rip_ctx *ctx,
+				   struct i2c_rip_cmd **cmds, int **lines,
+				   struct i2c_rip_arena *payload);
+/* Runs a script the caller keeps, e.g. a compiled one; lines may be NULL */
+extern void i2c_rip_ctx_set_script(struct i2c_rip_ctx *ctx,
+				   const struct i2c_rip_cmd *cmds,
+				   const int *lines, int ncmds,
+				   const __u8 *payload);
+extern int i2c_rip_ctx_ncmds(const struct i2c_rip_ctx *ctx);
+/* Bus stream of each command, runs of one stream skip the others */
+extern void i2c_rip_ctx_set_streams(struct i2c_rip_ctx *ctx,
+				    const int *streams);
+/* Puts back the settings scripts change, open busses stay */
+extern void i2c_rip_ctx_reset(struct i2c_rip_ctx *ctx);
+/* Log file opened by LOG-FILE, NULL until then */
+extern FILE *i2c_rip_ctx_log_file(const struct i2c_rip_ctx *ctx);
+/* Destinations of log text at the current settings, 0 for none */
+extern unsigned int i2c_rip_ctx_log_dest(const struct i2c_rip_ctx *ctx,
+					 int error);
+/* Opens and takes a bus ahead of the command at index */
+extern int i2c_rip_ctx_lock_bus(struct i2c_rip_ctx *ctx, int bus, int index);
+/* Runs every command, then releases the busses */
+extern int i2c_rip_ctx_run(struct i2c_rip_ctx *ctx);
+/* Gives up every bus and forgets their shadow registers */
+extern void i2c_rip_ctx_release(struct i2c_rip_ctx *ctx);
+extern void i2c_rip_ctx_close(struct i2c_rip_ctx *ctx);
+
+extern struct i2c_rip_run *i2c_rip_run_new(struct i2c_rip_ctx *ctx);
+/* On the thread that ran it, a loop left running sets back its timer slack */
+extern void i2c_rip_run_free(struct i2c_rip_run *run);
+/* Payload the following commands refer to, the script's by default */
+extern void i2c_rip_run_set_payload(struct i2c_rip_run *run,
+				    const __u8 *payload);
+/* With hold set, batched transfers may still be queued after a call */
+extern void i2c_rip_run_set_hold(struct i2c_rip_run *run, int hold);
+/* Runs commands [first, last) of one stream, fails with -EIO when it
+   stopped on an error */
+extern int i2c_rip_run_cmds(struct i2c_rip_run *run, int first, int last,
+			    int stream);
+extern int i2c_rip_run_flush(struct i2c_rip_run *run);
+extern int i2c_rip_run_pending(const struct i2c_rip_run *run);
+
+#endif /* LIB_I2C_RIP_H */
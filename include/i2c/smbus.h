@@ -14,14 +14,25 @@
 #ifndef LIB_I2C_SMBUS_H
 #define LIB_I2C_SMBUS_H
 
-#define I2C_API_VERSION		0x100
+/* 0x101 added batches, SMBus 3 blocks, handles, PEC and transfer counters,
+   0x102 the bus locks of i2c/lock.h */
+#define I2C_API_VERSION		0x102
 
+#include <stddef.h>
 #include <linux/types.h>
 #include <linux/i2c.h>
 
+/* SMBus 3.0 raised the block size limit from 32 to 255 bytes */
+#ifndef I2C_SMBUS3_BLOCK_MAX
+#define I2C_SMBUS3_BLOCK_MAX	255
+#endif
+
 extern __s32 i2c_smbus_access(int file, char read_write, __u8 command,
 			      int size, union i2c_smbus_data *data);
 
+/* Returns the number of transferred messages */
+extern __s32 i2c_rdwr_access(int file, struct i2c_msg *msgs, int nmsgs);
+
 extern __s32 i2c_smbus_write_quick(int file, __u8 value);
 extern __s32 i2c_smbus_read_byte(int file);
 extern __s32 i2c_smbus_write_byte(int file, __u8 value);
@@ -49,4 +60,63 @@ extern __s32 i2c_smbus_write_i2c_block_data(int file, __u8 command, __u8 length,
 extern __s32 i2c_smbus_block_process_call(int file, __u8 command, __u8 length,
 					  __u8 *values);
 
+/* Packet error checking (CRC-8) in software, start with crc 0 */
+extern __u8 i2c_smbus_pec(__u8 crc, const __u8 *data, size_t len);
+
+/* SMBus 3 blocks of up to 255 bytes, sent with I2C_RDWR to addr */
+/* Returns the number of read bytes */
+extern __s32 i2c_smbus3_read_block_data(int file, __u16 addr, __u8 command,
+					__u8 *values);
+extern __s32 i2c_smbus3_write_block_data(int file, __u16 addr, __u8 command,
+					 __u8 length, const __u8 *values);
+/* Returns the number of read bytes */
+extern __s32 i2c_smbus3_block_process_call(int file, __u16 addr, __u8 command,
+					   __u8 length, __u8 *values);
+
+/* An open bus that remembers its functionality and slave address */
+struct i2c_handle;
+
+#define I2C_HANDLE_FORCE	0x0001	/* use I2C_SLAVE_FORCE */
+#define I2C_HANDLE_STATS	0x0002	/* i2c_stats_attach(), see stats.h */
+
+extern struct i2c_handle *i2c_handle_open(int i2cbus, int flags);
+extern void i2c_handle_close(struct i2c_handle *handle);
+extern int i2c_handle_fd(const struct i2c_handle *handle);
+extern unsigned long i2c_handle_funcs(const struct i2c_handle *handle);
+extern __s32 i2c_handle_set_slave(struct i2c_handle *handle, __u16 addr);
+/* Returns the number of read bytes */
+extern __s32 i2c_handle_read(struct i2c_handle *handle, __u16 addr,
+			     __u8 command, __u8 length, __u8 *values);
+extern __s32 i2c_handle_write(struct i2c_handle *handle, __u16 addr,
+			      __u8 command, __u8 length, const __u8 *values);
+
+/* Batched transactions, sent with as few I2C_RDWR ioctls as possible */
+struct i2c_batch;
+
+extern struct i2c_batch *i2c_batch_new(void);
+extern void i2c_batch_free(struct i2c_batch *batch);
+extern void i2c_batch_reset(struct i2c_batch *batch);
+extern void i2c_batch_set_pec(struct i2c_batch *batch, int pec);
+
+/* Return the index of the queued operation */
+extern int i2c_batch_read_byte_data(struct i2c_batch *batch, __u16 addr,
+				    __u8 command);
+extern int i2c_batch_write_byte_data(struct i2c_batch *batch, __u16 addr,
+				     __u8 command, __u8 value);
+extern int i2c_batch_read_word_data(struct i2c_batch *batch, __u16 addr,
+				    __u8 command);
+extern int i2c_batch_write_word_data(struct i2c_batch *batch, __u16 addr,
+				     __u8 command, __u16 value);
+/* values is filled in by i2c_batch_submit() */
+extern int i2c_batch_read_i2c_block_data(struct i2c_batch *batch, __u16 addr,
+					 __u8 command, __u8 length,
+					 __u8 *values);
+extern int i2c_batch_write_i2c_block_data(struct i2c_batch *batch, __u16 addr,
+					  __u8 command, __u8 length,
+					  const __u8 *values);
+
+extern __s32 i2c_batch_submit(int file, struct i2c_batch *batch);
+/* Returns what the matching i2c_smbus_* function would have returned */
+extern __s32 i2c_batch_result(const struct i2c_batch *batch, int op);
+
 #endif /* LIB_I2C_SMBUS_H */
@@ -0,0 +1,60 @@
+/*
+    stats.h - Transfer counters of libi2c in shared memory
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+*/
+
+#ifndef LIB_I2C_STATS_H
+#define LIB_I2C_STATS_H
+
+#include <linux/types.h>
+
+/*
+ * Files attached with i2c_stats_attach() count every transfer libi2c
+ * makes on them in a page shared by all processes using the same bus,
+ * I2C_STATS_DIR/i2c-stats-<bus>. Counters only grow and are updated
+ * with relaxed atomic adds, so readers take differences over time.
+ */
+
+#define I2C_STATS_DIR		"/dev/shm"
+#define I2C_STATS_MAGIC		0x53433249	/* "I2CS" */
+#define I2C_STATS_VERSION	1
+#define I2C_STATS_SLOTS		32	/* processes per bus */
+#define I2C_STATS_ADDRS		128	/* 7-bit addresses */
+#define I2C_STATS_ERRNOS	128	/* the last one counts all above */
+
+struct i2c_stats_counters {
+	__u64 ops;		/* SMBus transactions or I2C messages */
+	__u64 bytes;		/* data bytes, without address bytes */
+	__u64 errors;
+	__u64 busy_ns;		/* time spent in the ioctl */
+};
+
+struct i2c_stats_slot {
+	__s32 pid;		/* 0 while free */
+	__u32 reserved;
+	char comm[16];
+	struct i2c_stats_counters total;
+	__u64 errnos[I2C_STATS_ERRNOS];
+};
+
+/* An I2C_RDWR call is shared equally by the addresses of its messages */
+struct i2c_stats_page {
+	__u32 magic;		/* set last, once the page is ready */
+	__u32 version;
+	__u32 size;		/* of this structure */
+	__s32 bus;
+	__u64 reserved[2];
+	struct i2c_stats_counters addr[I2C_STATS_ADDRS];
+	struct i2c_stats_slot slot[I2C_STATS_SLOTS];
+};
+
+extern int i2c_stats_attach(int file, int i2cbus);
+extern void i2c_stats_detach(int file);
+/* For the per-address counters of transactions through I2C_SMBUS */
+extern void i2c_stats_set_slave(int file, __u16 addr);
+
+#endif /* LIB_I2C_STATS_H */
@@ -18,7 +18,7 @@ LIB_CFLAGS	+= -Wstrict-prototypes -Wshadow -Wpointer-arith -Wcast-qual \
 # interface is changed in a backward incompatible way.  The interface is
 # defined by the public header files - in this case they are only smbus.h.
 LIB_MAINVER	:= 0
-LIB_MINORVER	:= 1.1
+LIB_MINORVER	:= 3.0
 LIB_VER		:= $(LIB_MAINVER).$(LIB_MINORVER)
 
 # The shared and static library names
@@ -27,27 +27,40 @@ LIB_SHSONAME	:= $(LIB_SHBASENAME).$(LIB_MAINVER)
 LIB_SHLIBNAME	:= $(LIB_SHBASENAME).$(LIB_VER)
 LIB_STLIBNAME	:= libi2c.a
 
+# The i2crip script engine, versioned on its own by the same rules; its
+# interface is defined by rip.h
+RIP_MAINVER	:= 0
+RIP_MINORVER	:= 1.0
+RIP_VER		:= $(RIP_MAINVER).$(RIP_MINORVER)
+
+RIP_SHBASENAME	:= librip.so
+RIP_SHSONAME	:= $(RIP_SHBASENAME).$(RIP_MAINVER)
+RIP_SHLIBNAME	:= $(RIP_SHBASENAME).$(RIP_VER)
+RIP_STLIBNAME	:= librip.a
+
 LIB_TARGETS	:=
 ifeq ($(BUILD_DYNAMIC_LIB),1)
-LIB_LINKS	:= $(LIB_SHSONAME) $(LIB_SHBASENAME)
-LIB_TARGETS	+= $(LIB_SHLIBNAME)
+LIB_LINKS	:= $(LIB_SHSONAME) $(LIB_SHBASENAME) $(RIP_SHSONAME) $(RIP_SHBASENAME)
+LIB_TARGETS	+= $(LIB_SHLIBNAME) $(RIP_SHLIBNAME)
 endif
 ifeq ($(BUILD_STATIC_LIB),1)
-LIB_TARGETS	+= $(LIB_STLIBNAME)
+LIB_TARGETS	+= $(LIB_STLIBNAME) $(RIP_STLIBNAME)
 endif
 
 # Library file to link against (static or dynamic)
 ifeq ($(USE_STATIC_LIB),1)
 LIB_DEPS	:= $(LIB_DIR)/$(LIB_STLIBNAME)
+RIP_DEPS	:= $(LIB_DIR)/$(RIP_STLIBNAME)
 else
 LIB_DEPS	:= $(LIB_DIR)/$(LIB_SHBASENAME)
+RIP_DEPS	:= $(LIB_DIR)/$(RIP_SHBASENAME)
 endif
 
 #
 # Libraries
 #
 
-$(LIB_DIR)/$(LIB_SHLIBNAME): $(LIB_DIR)/smbus.o
+$(LIB_DIR)/$(LIB_SHLIBNAME): $(LIB_DIR)/smbus.o $(LIB_DIR)/stats.o $(LIB_DIR)/lock.o
 	$(CC) -shared $(LDFLAGS) -Wl,--version-script=$(LIB_DIR)/libi2c.map -Wl,-soname,$(LIB_SHSONAME) -o $@ $^ -lc
 
 $(LIB_DIR)/$(LIB_SHSONAME): $(LIB_DIR)/$(LIB_SHLIBNAME)
@@ -58,20 +71,57 @@ $(LIB_DIR)/$(LIB_SHBASENAME): $(LIB_DIR)/$(LIB_SHLIBNAME)
 	$(RM) $@
 	$(LN) $(LIB_SHLIBNAME) $@
 
-$(LIB_DIR)/$(LIB_STLIBNAME): $(LIB_DIR)/smbus.ao
+$(LIB_DIR)/$(LIB_STLIBNAME): $(LIB_DIR)/smbus.ao $(LIB_DIR)/stats.ao $(LIB_DIR)/lock.ao
+	$(RM) $@
+	$(AR) rcvs $@ $^
+
+$(LIB_DIR)/$(RIP_SHLIBNAME): $(LIB_DIR)/rip.o $(LIB_DIR)/$(LIB_SHBASENAME)
+	$(CC) -shared $(LDFLAGS) -Wl,--version-script=$(LIB_DIR)/librip.map -Wl,-soname,$(RIP_SHSONAME) -o $@ $(LIB_DIR)/rip.o -L$(LIB_DIR) -li2c -lc
+
+$(LIB_DIR)/$(RIP_SHSONAME): $(LIB_DIR)/$(RIP_SHLIBNAME)
+	$(RM) $@
+	$(LN) $(RIP_SHLIBNAME) $@
+
+$(LIB_DIR)/$(RIP_SHBASENAME): $(LIB_DIR)/$(RIP_SHLIBNAME)
+	$(RM) $@
+	$(LN) $(RIP_SHLIBNAME) $@
+
+$(LIB_DIR)/$(RIP_STLIBNAME): $(LIB_DIR)/rip.ao
 	$(RM) $@
 	$(AR) rcvs $@ $^
 
+# PEC microbenchmark, not part of all or install
+$(LIB_DIR)/pecbench: $(LIB_DIR)/pecbench.c $(LIB_DIR)/$(LIB_STLIBNAME) $(INCLUDE_DIR)/i2c/smbus.h
+	$(CC) $(CFLAGS) $(LIB_CFLAGS) $(LDFLAGS) -o $@ $< $(LIB_DIR)/$(LIB_STLIBNAME)
+
 #
 # Objects
 # Each object must be built twice, once for the shared library and
 # once again for the static library.
 #
 
-$(LIB_DIR)/smbus.o: $(LIB_DIR)/smbus.c $(INCLUDE_DIR)/i2c/smbus.h
+$(LIB_DIR)/smbus.o: $(LIB_DIR)/smbus.c $(LIB_DIR)/stats.h $(INCLUDE_DIR)/i2c/smbus.h $(INCLUDE_DIR)/i2c/stats.h
+	$(CC) $(SOCFLAGS) $(LIB_CFLAGS) -c $< -o $@
+
+$(LIB_DIR)/smbus.ao: $(LIB_DIR)/smbus.c $(LIB_DIR)/stats.h $(INCLUDE_DIR)/i2c/smbus.h $(INCLUDE_DIR)/i2c/stats.h
+	$(CC) $(CFLAGS) $(LIB_CFLAGS) -c $< -o $@
+
+$(LIB_DIR)/stats.o: $(LIB_DIR)/stats.c $(LIB_DIR)/stats.h $(INCLUDE_DIR)/i2c/stats.h
+	$(CC) $(SOCFLAGS) $(LIB_CFLAGS) -c $< -o $@
+
+$(LIB_DIR)/stats.ao: $(LIB_DIR)/stats.c $(LIB_DIR)/stats.h $(INCLUDE_DIR)/i2c/stats.h
+	$(CC) $(CFLAGS) $(LIB_CFLAGS) -c $< -o $@
+
+$(LIB_DIR)/lock.o: $(LIB_DIR)/lock.c $(INCLUDE_DIR)/i2c/lock.h
+	$(CC) $(SOCFLAGS) $(LIB_CFLAGS) -c $< -o $@
+
+$(LIB_DIR)/lock.ao: $(LIB_DIR)/lock.c $(INCLUDE_DIR)/i2c/lock.h
+	$(CC) $(CFLAGS) $(LIB_CFLAGS) -c $< -o $@
+
+$(LIB_DIR)/rip.o: $(LIB_DIR)/rip.c $(INCLUDE_DIR)/i2c/rip.h $(INCLUDE_DIR)/i2c/lock.h $(INCLUDE_DIR)/i2c/smbus.h $(INCLUDE_DIR)/i2c/stats.h
 	$(CC) $(SOCFLAGS) $(LIB_CFLAGS) -c $< -o $@
 
-$(LIB_DIR)/smbus.ao: $(LIB_DIR)/smbus.c $(INCLUDE_DIR)/i2c/smbus.h
+$(LIB_DIR)/rip.ao: $(LIB_DIR)/rip.c $(INCLUDE_DIR)/i2c/rip.h $(INCLUDE_DIR)/i2c/lock.h $(INCLUDE_DIR)/i2c/smbus.h $(INCLUDE_DIR)/i2c/stats.h
 	$(CC) $(CFLAGS) $(LIB_CFLAGS) -c $< -o $@
 
 #
@@ -84,7 +134,7 @@ strip-lib: $(addprefix $(LIB_DIR)/,$(LIB_TARGETS))
 	$(STRIP) $(addprefix $(LIB_DIR)/,$(LIB_TARGETS))
 
 clean-lib:
-	$(RM) $(addprefix $(LIB_DIR)/,*.o *.ao $(LIB_TARGETS) $(LIB_LINKS))
+	$(RM) $(addprefix $(LIB_DIR)/,*.o *.ao $(LIB_TARGETS) $(LIB_LINKS) pecbench)
 
 install-lib: $(addprefix $(LIB_DIR)/,$(LIB_TARGETS))
 	$(INSTALL_DIR) $(DESTDIR)$(libdir) $(DESTDIR)$(man3dir)
@@ -92,9 +142,13 @@ ifeq ($(BUILD_DYNAMIC_LIB),1)
 	$(INSTALL_PROGRAM) $(LIB_DIR)/$(LIB_SHLIBNAME) $(DESTDIR)$(libdir)
 	$(LN) $(LIB_SHLIBNAME) $(DESTDIR)$(libdir)/$(LIB_SHSONAME)
 	$(LN) $(LIB_SHSONAME) $(DESTDIR)$(libdir)/$(LIB_SHBASENAME)
+	$(INSTALL_PROGRAM) $(LIB_DIR)/$(RIP_SHLIBNAME) $(DESTDIR)$(libdir)
+	$(LN) $(RIP_SHLIBNAME) $(DESTDIR)$(libdir)/$(RIP_SHSONAME)
+	$(LN) $(RIP_SHSONAME) $(DESTDIR)$(libdir)/$(RIP_SHBASENAME)
 endif
 ifeq ($(BUILD_STATIC_LIB),1)
 	$(INSTALL_DATA) $(LIB_DIR)/$(LIB_STLIBNAME) $(DESTDIR)$(libdir)
+	$(INSTALL_DATA) $(LIB_DIR)/$(RIP_STLIBNAME) $(DESTDIR)$(libdir)
 endif
 	$(INSTALL_DATA) $(LIB_DIR)/libi2c.3 $(DESTDIR)$(man3dir)
 
@@ -0,0 +1,117 @@
+/*
+    lock.c - Advisory locks arbitrating I2C busses between processes
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * The owner of a bus holds a flock() on its i2c-dev file, so jobs of
+ * i2crip, i2cget, i2cset and friends do not interleave. A job waiting
+ * for the bus with a priority above 0 also holds a read lock on byte
+ * <priority> of the same file (fcntl byte range locks are independent
+ * of flock). Jobs only queue for the bus when no higher priority job
+ * waits, and the owner can ask whether one does and give the bus up.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <i2c/lock.h>
+
+static int i2c_bus_wait_higher(int file, int priority)
+{
+	struct flock fl;
+
+	if (priority >= I2C_BUS_PRIORITY_MAX)
+		return 0;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = priority + 1;
+	fl.l_len = I2C_BUS_PRIORITY_MAX - priority;
+	if (fcntl(file, F_SETLKW, &fl) < 0)
+		return -errno;
+	fl.l_type = F_UNLCK;
+	fcntl(file, F_SETLK, &fl);
+	return 0;
+}
+
+static int i2c_bus_announce(int file, int priority, int on)
+{
+	struct flock fl;
+
+	if (priority <= 0)
+		return 0;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = on ? F_RDLCK : F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = priority;
+	fl.l_len = 1;
+	if (fcntl(file, on ? F_SETLKW : F_SETLK, &fl) < 0)
+		return -errno;
+	return 0;
+}
+
+/* Takes the bus for a job, after any job of higher priority waiting for it */
+int i2c_bus_lock(int file, int priority, int wait)
+{
+	int ret;
+
+	if (priority < 0)
+		priority = 0;
+	if (priority > I2C_BUS_PRIORITY_MAX)
+		priority = I2C_BUS_PRIORITY_MAX;
+
+	if (!wait) {
+		if (i2c_bus_contended(file, priority))
+			return -EWOULDBLOCK;
+		if (flock(file, LOCK_EX | LOCK_NB) < 0)
+			return -errno;
+		return 0;
+	}
+
+	/* A job already queued when a higher one came along lets it go first */
+	for (;;) {
+		ret = i2c_bus_wait_higher(file, priority);
+		if (ret < 0)
+			return ret;
+		ret = i2c_bus_announce(file, priority, 1);
+		if (ret < 0)
+			return ret;
+		if (flock(file, LOCK_EX) < 0)
+			ret = -errno;
+		i2c_bus_announce(file, priority, 0);
+		if (ret < 0 || !i2c_bus_contended(file, priority))
+			return ret;
+		flock(file, LOCK_UN);
+	}
+}
+
+void i2c_bus_unlock(int file)
+{
+	flock(file, LOCK_UN);
+}
+
+int i2c_bus_contended(int file, int priority)
+{
+	struct flock fl;
+
+	if (priority >= I2C_BUS_PRIORITY_MAX)
+		return 0;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = priority + 1;
+	fl.l_len = I2C_BUS_PRIORITY_MAX - priority;
+	if (fcntl(file, F_GETLK, &fl) < 0)
+		return 0;
+	return fl.l_type != F_UNLCK;
+}
@@ -0,0 +1,101 @@
+/*
+    pecbench.c - Throughput of the libi2c software PEC
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * Checks i2c_smbus_pec() against a bit-at-a-time CRC-8, then times it on
+ * the sizes SMBus traffic comes in. Not installed, build with
+ * "make lib/pecbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <i2c/smbus.h>
+
+#define BUF_SIZE	65536
+
+/* Keeps the compiler from dropping the timed calls */
+static volatile __u8 sink;
+
+static __u8 pec_bitwise(__u8 crc, const __u8 *data, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench(__u8 (*pec)(__u8, const __u8 *, size_t),
+		    const __u8 *buf, size_t len)
+{
+	double start, elapsed;
+	long calls, i;
+
+	/* Double the run until it lasts long enough to time */
+	for (calls = 1024; ; calls *= 2) {
+		start = now();
+		for (i = 0; i < calls; i++)
+			sink = pec(sink, buf, len);
+		elapsed = now() - start;
+		if (elapsed > 0.2)
+			return elapsed / calls;
+	}
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 3, 5, 34, 258, 4096, BUF_SIZE };
+	__u8 *buf;
+	double ns, ref;
+	size_t len, i;
+
+	buf = malloc(BUF_SIZE);
+	if (!buf)
+		return 1;
+	srand(1);
+	for (i = 0; i < BUF_SIZE; i++)
+		buf[i] = rand();
+
+	for (len = 0; len <= 300; len++) {
+		if (i2c_smbus_pec(0x5a, buf + len, len) !=
+		    pec_bitwise(0x5a, buf + len, len)) {
+			fprintf(stderr, "Error: PEC mismatch at length %zu\n",
+				len);
+			return 1;
+		}
+	}
+
+#ifdef __PCLMUL__
+	printf("i2c_smbus_pec: table, carry-less multiply from 16 bytes\n");
+#else
+	printf("i2c_smbus_pec: table\n");
+#endif
+	printf("%8s %12s %12s %12s\n", "bytes", "ns/call", "MB/s", "vs bitwise");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		ns = bench(i2c_smbus_pec, buf, sizes[i]) * 1e9;
+		ref = bench(pec_bitwise, buf, sizes[i]) * 1e9;
+		printf("%8zu %12.1f %12.1f %11.1fx\n", sizes[i], ns,
+		       sizes[i] * 1e3 / ns, ref / ns);
+	}
+
+	free(buf);
+	return 0;
+}
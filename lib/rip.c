@@ -0,0 +1,3172 @@
+/*
+    rip.c - i2crip script engine
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * The i2crip script language without the command line around it: the
+ * line parser, and the executor i2crip runs scripts with. A context
+ * holds everything a script changes, so a process may run any number
+ * of them. Transfers of one bus may be batched into I2C_RDWR calls
+ * (I2C_RIP_BATCH); completed transfers are logged in script order, and
+ * a batch that fails is sent again one command per call to find the
+ * failed line. With I2C_RIP_SHADOW the last values written to or read
+ * from each register are kept, and writes that would not change them
+ * are left out.
+ */
+
+#define _DEFAULT_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <i2c/smbus.h>
+#include <i2c/stats.h>
+#include <i2c/lock.h>
+#include <i2c/rip.h>
+
+#define RIP_NUM_OPS		36
+#define RIP_ARG_MAX		20
+
+#define RIP_MAX_BUSSES		64
+#define RIP_MAX_SLAVES		0x80
+#define RIP_NO_SLAVE		0xFF
+#define RIP_REG_MAX		2
+#define RIP_REG_SPACE		0x10000
+
+#define RIP_POLL_US		100
+#define RIP_POLL_MAX_US		10000
+
+#define RIP_BATCH_MAX		I2C_RDRW_IOCTL_MAX_MSGS
+
+/* How often a script looks for higher priority jobs waiting for its busses */
+#define RIP_ARBITER_CHECK_NS	1000000ULL
+
+#define RIP_LOG_FILE_NAME	"i2cRip.log"
+
+/* Log-linear histogram of late loop iterations, as the i2crip statistics */
+#define RIP_HIST_SUB_BITS	6
+#define RIP_HIST_MAX_SHIFT	42
+#define RIP_HIST_SUB_COUNT	(1 << RIP_HIST_SUB_BITS)
+#define RIP_HIST_HALF_COUNT	(1 << (RIP_HIST_SUB_BITS - 1))
+#define RIP_HIST_BUCKETS	(RIP_HIST_SUB_COUNT + \
+				 RIP_HIST_MAX_SHIFT * RIP_HIST_HALF_COUNT)
+
+#define RIP_BIT_TEST(map, reg)	((map)[(reg) >> 3] & (1 << ((reg) & 7)))
+#define RIP_BIT_SET(map, reg)	((map)[(reg) >> 3] |= (1 << ((reg) & 7)))
+#define RIP_BIT_CLEAR(map, reg)	((map)[(reg) >> 3] &= ~(1 << ((reg) & 7)))
+
+struct rip_op_info {
+	enum i2c_rip_op op;
+	int nargs;
+	char name[RIP_ARG_MAX];
+};
+
+static const struct rip_op_info rip_op_table[RIP_NUM_OPS] = {
+	{ I2C_RIP_SET_BUS, 1, "SET-BUS" },
+	{ I2C_RIP_SET_ID, 1, "SET-ID" },
+	{ I2C_RIP_DELAY, 1, "DELAY" },
+	{ I2C_RIP_SUPRESS_ERRORS, 1, "SUPRESS-ERRORS" },
+	{ I2C_RIP_LOG_TO_FILE, 1, "LOG-FILE" },
+	{ I2C_RIP_LOG_TO_TERM, 1, "LOG-TERM" },
+	{ I2C_RIP_8_WRITE_BYTE, 2, "WB-8" },
+	{ I2C_RIP_16_WRITE_BYTE, 2, "WB-16" },
+	{ I2C_RIP_8_WRITE_WORD, 2, "WW-8" },
+	{ I2C_RIP_16_WRITE_WORD, 2, "WW-16" },
+	{ I2C_RIP_8_READ_BYTE, 1, "RB-8" },
+	{ I2C_RIP_16_READ_BYTE, 1, "RB-16" },
+	{ I2C_RIP_8_READ_WORD, 1, "RW-8" },
+	{ I2C_RIP_16_READ_WORD, 1, "RW-16" },
+	{ I2C_RIP_8_VERIFY_BYTE, 2, "VB-8" },
+	{ I2C_RIP_16_VERIFY_BYTE, 2, "VB-16" },
+	{ I2C_RIP_8_VERIFY_WORD, 2, "VW-8" },
+	{ I2C_RIP_16_VERIFY_WORD, 2, "VW-16" },
+	{ I2C_RIP_SET_BURST, 1, "SET-BURST" },
+	{ I2C_RIP_SYNC, 0, "SYNC" },
+	{ I2C_RIP_8_POLL, 4, "POLL-8" },
+	{ I2C_RIP_16_POLL, 4, "POLL-16" },
+	{ I2C_RIP_POLL_INTERVAL, 2, "POLL-INTERVAL" },
+	{ I2C_RIP_8_WRITE_BLOCK, 2, "WBLK-8" },
+	{ I2C_RIP_16_WRITE_BLOCK, 2, "WBLK-16" },
+	{ I2C_RIP_8_READ_BLOCK, 2, "RBLK-8" },
+	{ I2C_RIP_16_READ_BLOCK, 2, "RBLK-16" },
+	{ I2C_RIP_8_VERIFY_BLOCK, 2, "VBLK-8" },
+	{ I2C_RIP_16_VERIFY_BLOCK, 2, "VBLK-16" },
+	{ I2C_RIP_8_WRITE_FILE, 2, "WRITE-FILE-8" },
+	{ I2C_RIP_16_WRITE_FILE, 2, "WRITE-FILE-16" },
+	{ I2C_RIP_8_VERIFY_FILE, 2, "VERIFY-FILE-8" },
+	{ I2C_RIP_16_VERIFY_FILE, 2, "VERIFY-FILE-16" },
+	{ I2C_RIP_VOLATILE, 2, "VOLATILE" },
+	{ I2C_RIP_LOOP, 2, "LOOP" },
+	{ I2C_RIP_END_LOOP, 0, "END-LOOP" },
+};
+
+struct rip_bus {
+	int file;
+	int connected;
+	int locked;
+	__u8 addr;		/* RIP_NO_SLAVE until SET-ID */
+};
+
+/* One write, read or verify queued in a batch, nmsgs is 0 for an elided write */
+struct rip_pending {
+	int index;
+	int bus;
+	__u8 addr;
+	enum i2c_rip_op op;
+	int first_msg;
+	int nmsgs;
+	int reg_size;
+	int size;
+	__u8 no_log;
+	__u8 wr[I2C_RIP_XFER_MAX];
+	__u8 rd[I2C_RIP_XFER_MAX];
+	__u8 expected[I2C_RIP_XFER_MAX];
+};
+
+/*
+ * Last known register values of one device, with bit maps of the
+ * registers whose value is known and of the volatile ones (never
+ * cached). Segment is the first command after the last read back
+ * (I2C_RIP_RECONCILE), plus one.
+ */
+struct rip_shadow {
+	__u8 values[RIP_REG_SPACE];
+	__u8 known[RIP_REG_SPACE / 8];
+	__u8 vol[RIP_REG_SPACE / 8];
+	int segment;
+};
+
+/* Consecutive transfers on one bus sent with a single I2C_RDWR call */
+struct rip_batch {
+	int file;
+	int nmsgs;
+	int npending;
+	struct i2c_msg msgs[RIP_BATCH_MAX];
+	struct rip_pending pending[RIP_BATCH_MAX];
+};
+
+struct rip_hist {
+	__u64 count;
+	__u64 max;
+	__u64 buckets[RIP_HIST_BUCKETS];
+};
+
+struct i2c_rip_ctx {
+	const struct i2c_rip_cmd *cmds;
+	const int *lines;
+	int ncmds;
+	const __u8 *payload;
+	const int *streams;
+
+	/* Script parsed by i2c_rip_ctx_load() */
+	struct i2c_rip_cmd *own_cmds;
+	int *own_lines;
+	int own_size;
+	struct i2c_rip_arena arena;
+
+	struct i2c_rip_ops ops;
+	void *user;
+	struct i2c_rip_transport transport;
+	void *transport_user;
+	unsigned int flags;
+	int priority;
+
+	struct rip_bus bus[RIP_MAX_BUSSES];
+	struct rip_shadow *shadow[RIP_MAX_BUSSES][RIP_MAX_SLAVES];
+	int burst[RIP_MAX_BUSSES][RIP_MAX_SLAVES];
+
+	/* Settings the script changes */
+	int poll_us;
+	int poll_max_us;
+	int supress;
+	int log_to_term;
+	int log_to_file;
+	FILE *log_file;
+
+	__u32 crc_table[256];
+};
+
+/*
+ * One command stream, a whole script or one bus of it. Segment is the
+ * first command after the last DELAY, POLL or barrier; index is the
+ * command log output belongs to. Loop first is the first command of the
+ * running LOOP body, -1 outside of one.
+ */
+struct i2c_rip_run {
+	struct i2c_rip_ctx *ctx;
+	int bus;
+	int stream;
+	int segment;
+	int index;
+	const __u8 *payload;
+	int hold;
+	__u64 arbiter_next;
+
+	int loop_first;
+	int loop_iteration;
+	__u64 loop_start_ns;
+	__u64 loop_missed;
+	int loop_slack;
+	unsigned long loop_old_slack;
+	struct rip_hist loop_late;
+
+	struct rip_batch batch;
+};
+
+/* Parser */
+
+/* Returns the offset of the data, or -ENOMEM */
+int i2c_rip_arena_append(struct i2c_rip_arena *arena, const void *data,
+			 int size)
+{
+	int new_size, offset;
+	__u8 *bytes;
+
+	if (arena->length + size > arena->size) {
+		new_size = arena->size > 0 ? arena->size : 256;
+		while (new_size < arena->length + size)
+			new_size *= 2;
+		/* Data that is not owned is copied on the first append */
+		bytes = realloc(arena->size > 0 ? arena->data : NULL, new_size);
+		if (!bytes)
+			return -ENOMEM;
+		if (arena->size == 0 && arena->length > 0)
+			memcpy(bytes, arena->data, arena->length);
+		arena->data = bytes;
+		arena->size = new_size;
+	}
+
+	offset = arena->length;
+	memcpy(&arena->data[offset], data, size);
+	arena->length += size;
+	return offset;
+}
+
+void i2c_rip_arena_free(struct i2c_rip_arena *arena)
+{
+	if (arena->size > 0)
+		free(arena->data);
+	arena->data = NULL;
+	arena->length = 0;
+	arena->size = 0;
+}
+
+const char *i2c_rip_op_name(int op)
+{
+	int i;
+
+	for (i = 0; i < RIP_NUM_OPS; i++)
+		if ((int)rip_op_table[i].op == op)
+			return rip_op_table[i].name;
+	return NULL;
+}
+
+static int rip_op_is_write(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_8_WRITE_BYTE || op == I2C_RIP_8_WRITE_WORD ||
+	       op == I2C_RIP_16_WRITE_BYTE || op == I2C_RIP_16_WRITE_WORD ||
+	       op == I2C_RIP_8_WRITE_BLOCK || op == I2C_RIP_16_WRITE_BLOCK ||
+	       op == I2C_RIP_8_WRITE_FILE || op == I2C_RIP_16_WRITE_FILE;
+}
+
+int i2c_rip_op_is_read(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_8_READ_BYTE || op == I2C_RIP_8_READ_WORD ||
+	       op == I2C_RIP_16_READ_BYTE || op == I2C_RIP_16_READ_WORD ||
+	       op == I2C_RIP_8_READ_BLOCK || op == I2C_RIP_16_READ_BLOCK;
+}
+
+static int rip_op_is_verify(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_8_VERIFY_BYTE || op == I2C_RIP_8_VERIFY_WORD ||
+	       op == I2C_RIP_16_VERIFY_BYTE || op == I2C_RIP_16_VERIFY_WORD ||
+	       op == I2C_RIP_8_VERIFY_BLOCK || op == I2C_RIP_16_VERIFY_BLOCK;
+}
+
+static int rip_op_is_transfer(enum i2c_rip_op op)
+{
+	return rip_op_is_write(op) || i2c_rip_op_is_read(op) ||
+	       rip_op_is_verify(op);
+}
+
+/* Barriers split a parallel run into phases (i2crip -p) */
+int i2c_rip_op_is_barrier(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_SYNC || op == I2C_RIP_SUPRESS_ERRORS ||
+	       op == I2C_RIP_LOG_TO_FILE || op == I2C_RIP_LOG_TO_TERM ||
+	       op == I2C_RIP_POLL_INTERVAL;
+}
+
+/* A device may change state across these, I2C_RIP_RECONCILE reads it
+   back again after them */
+static int rip_op_ends_segment(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_DELAY || op == I2C_RIP_8_POLL ||
+	       op == I2C_RIP_16_POLL || op == I2C_RIP_LOOP ||
+	       op == I2C_RIP_END_LOOP || i2c_rip_op_is_barrier(op);
+}
+
+/* Block data is in the payload arena, but for reads */
+int i2c_rip_op_is_block(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_8_WRITE_BLOCK || op == I2C_RIP_16_WRITE_BLOCK ||
+	       op == I2C_RIP_8_READ_BLOCK || op == I2C_RIP_16_READ_BLOCK ||
+	       op == I2C_RIP_8_VERIFY_BLOCK || op == I2C_RIP_16_VERIFY_BLOCK;
+}
+
+/* The path is in the payload arena */
+int i2c_rip_op_is_file(enum i2c_rip_op op)
+{
+	return op == I2C_RIP_8_WRITE_FILE || op == I2C_RIP_16_WRITE_FILE ||
+	       op == I2C_RIP_8_VERIFY_FILE || op == I2C_RIP_16_VERIFY_FILE;
+}
+
+int i2c_rip_op_has_payload(enum i2c_rip_op op)
+{
+	return i2c_rip_op_is_block(op) && op != I2C_RIP_8_READ_BLOCK &&
+	       op != I2C_RIP_16_READ_BLOCK;
+}
+
+int i2c_rip_write_range(const struct i2c_rip_cmd *cmd, int *reg,
+			int *reg_size, int *length)
+{
+	switch (cmd->op) {
+	case I2C_RIP_8_WRITE_BYTE:
+		*reg = cmd->data.byte8.addr;
+		*reg_size = 1;
+		*length = 1;
+		return 1;
+	case I2C_RIP_8_WRITE_WORD:
+		*reg = cmd->data.word8.addr;
+		*reg_size = 1;
+		*length = 2;
+		return 1;
+	case I2C_RIP_16_WRITE_BYTE:
+		*reg = cmd->data.byte16.addr;
+		*reg_size = 2;
+		*length = 1;
+		return 1;
+	case I2C_RIP_16_WRITE_WORD:
+		*reg = cmd->data.word16.addr;
+		*reg_size = 2;
+		*length = 2;
+		return 1;
+	case I2C_RIP_8_WRITE_BLOCK:
+	case I2C_RIP_16_WRITE_BLOCK:
+		*reg = cmd->data.block.addr;
+		*reg_size = cmd->op == I2C_RIP_8_WRITE_BLOCK ? 1 : 2;
+		*length = cmd->data.block.length;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void rip_parse_error(char *error, int error_size, const char *fmt, ...)
+{
+	va_list args;
+
+	if (error_size <= 0)
+		return;
+	va_start(args, fmt);
+	vsnprintf(error, error_size, fmt, args);
+	va_end(args);
+}
+
+static int rip_hex_digit(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+static int rip_is_space(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+/*
+ * Parses the hex data of WBLK/VBLK into the payload arena. Bytes are
+ * pairs of hex digits, split over any number of words, each word may
+ * start with 0x: "0x0102 0304" is 4 bytes.
+ */
+static int rip_parse_payload(const char *text, int size,
+			     struct i2c_rip_block *block,
+			     struct i2c_rip_arena *payload,
+			     char *error, int error_size)
+{
+	int length = 0, i = 0, high, low, offset;
+	__u8 *bytes;
+
+	bytes = malloc(size / 2 + 1);
+	if (!bytes) {
+		rip_parse_error(error, error_size,
+				"Error: Memory allocation failed");
+		return -ENOMEM;
+	}
+
+	while (i < size) {
+		if (rip_is_space(text[i])) {
+			i++;
+			continue;
+		}
+		if (text[i] == '/' && i + 1 < size && text[i + 1] == '/')
+			break;
+		if (text[i] == '0' && i + 1 < size && text[i + 1] == 'x')
+			i += 2;
+
+		high = i < size ? rip_hex_digit(text[i]) : -1;
+		low = i + 1 < size ? rip_hex_digit(text[i + 1]) : -1;
+		if (high < 0 || low < 0)
+			goto invalid;
+		bytes[length++] = (__u8)((high << 4) | low);
+		i += 2;
+
+		/* Words end at white space, anything else must be a byte */
+		while (i < size && rip_hex_digit(text[i]) >= 0) {
+			high = rip_hex_digit(text[i]);
+			low = i + 1 < size ? rip_hex_digit(text[i + 1]) : -1;
+			if (low < 0) {
+				rip_parse_error(error, error_size,
+						"Error: Invalid payload, odd number of hex digits: %.*s",
+						size, text);
+				free(bytes);
+				return -EINVAL;
+			}
+			bytes[length++] = (__u8)((high << 4) | low);
+			i += 2;
+		}
+		if (i < size && !rip_is_space(text[i]) && text[i] != '/')
+			goto invalid;
+	}
+
+	if (length == 0 || length > I2C_RIP_BLOCK_MAX) {
+		rip_parse_error(error, error_size,
+				"Error: Invalid payload length %d", length);
+		free(bytes);
+		return -EINVAL;
+	}
+
+	offset = i2c_rip_arena_append(payload, bytes, length);
+	free(bytes);
+	if (offset < 0) {
+		rip_parse_error(error, error_size,
+				"Error: Memory allocation failed");
+		return -ENOMEM;
+	}
+	block->offset = offset;
+	block->length = (__u16)length;
+	return 0;
+
+invalid:
+	rip_parse_error(error, error_size,
+			"Error: Invalid payload, hex bytes expected: %.*s",
+			size, text);
+	free(bytes);
+	return -EINVAL;
+}
+
+/* Stores numeric argument n of a command */
+static int rip_parse_arg(struct i2c_rip_cmd *cmd, int n, long num,
+			 const char *arg, char *error, int error_size)
+{
+	union i2c_rip_data *data = &cmd->data;
+
+	switch (n) {
+	case 0:
+		switch (cmd->op) {
+		case I2C_RIP_SET_BUS:
+		case I2C_RIP_SET_ID:
+		case I2C_RIP_DELAY:
+		case I2C_RIP_SUPRESS_ERRORS:
+		case I2C_RIP_LOG_TO_FILE:
+		case I2C_RIP_LOG_TO_TERM:
+		case I2C_RIP_SET_BURST:
+			data->single = (int)num;
+			return 0;
+		case I2C_RIP_8_WRITE_BYTE:
+		case I2C_RIP_8_READ_BYTE:
+		case I2C_RIP_8_VERIFY_BYTE:
+			data->byte8.addr = (__u8)num;
+			return 0;
+		case I2C_RIP_8_WRITE_WORD:
+		case I2C_RIP_8_READ_WORD:
+		case I2C_RIP_8_VERIFY_WORD:
+			data->word8.addr = (__u8)num;
+			return 0;
+		case I2C_RIP_16_WRITE_BYTE:
+		case I2C_RIP_16_READ_BYTE:
+		case I2C_RIP_16_VERIFY_BYTE:
+			data->byte16.addr = (__u16)num;
+			return 0;
+		case I2C_RIP_16_WRITE_WORD:
+		case I2C_RIP_16_READ_WORD:
+		case I2C_RIP_16_VERIFY_WORD:
+			data->word16.addr = (__u16)num;
+			return 0;
+		case I2C_RIP_8_POLL:
+			data->poll.addr = (__u8)num;
+			return 0;
+		case I2C_RIP_16_POLL:
+			data->poll.addr = (__u16)num;
+			return 0;
+		case I2C_RIP_POLL_INTERVAL:
+			data->interval.initial_us = (int)num;
+			return 0;
+		case I2C_RIP_VOLATILE:
+			data->range.first = (int)num;
+			return 0;
+		case I2C_RIP_LOOP:
+			data->loop.period_us = (int)num;
+			return 0;
+		case I2C_RIP_8_WRITE_BLOCK:
+		case I2C_RIP_8_READ_BLOCK:
+		case I2C_RIP_8_VERIFY_BLOCK:
+			data->block.addr = (__u8)num;
+			return 0;
+		case I2C_RIP_16_WRITE_BLOCK:
+		case I2C_RIP_16_READ_BLOCK:
+		case I2C_RIP_16_VERIFY_BLOCK:
+			data->block.addr = (__u16)num;
+			return 0;
+		case I2C_RIP_8_WRITE_FILE:
+		case I2C_RIP_8_VERIFY_FILE:
+			data->file.addr = (__u8)num;
+			return 0;
+		case I2C_RIP_16_WRITE_FILE:
+		case I2C_RIP_16_VERIFY_FILE:
+			data->file.addr = (__u16)num;
+			return 0;
+		default:
+			break;
+		}
+		break;
+
+	case 1:
+		switch (cmd->op) {
+		case I2C_RIP_8_WRITE_BYTE:
+		case I2C_RIP_8_READ_BYTE:
+		case I2C_RIP_8_VERIFY_BYTE:
+			data->byte8.data = (__u8)num;
+			return 0;
+		case I2C_RIP_8_WRITE_WORD:
+		case I2C_RIP_8_READ_WORD:
+		case I2C_RIP_8_VERIFY_WORD:
+			data->word8.data = (__u16)num;
+			return 0;
+		case I2C_RIP_16_WRITE_BYTE:
+		case I2C_RIP_16_READ_BYTE:
+		case I2C_RIP_16_VERIFY_BYTE:
+			data->byte16.data = (__u8)num;
+			return 0;
+		case I2C_RIP_16_WRITE_WORD:
+		case I2C_RIP_16_READ_WORD:
+		case I2C_RIP_16_VERIFY_WORD:
+			data->word16.data = (__u16)num;
+			return 0;
+		case I2C_RIP_8_POLL:
+		case I2C_RIP_16_POLL:
+			data->poll.mask = (__u8)num;
+			return 0;
+		case I2C_RIP_POLL_INTERVAL:
+			data->interval.max_us = (int)num;
+			return 0;
+		case I2C_RIP_VOLATILE:
+			data->range.last = (int)num;
+			return 0;
+		case I2C_RIP_LOOP:
+			data->loop.count = (int)num;
+			return 0;
+		case I2C_RIP_8_READ_BLOCK:
+		case I2C_RIP_16_READ_BLOCK:
+			if (num <= 0 || num > I2C_RIP_BLOCK_MAX) {
+				rip_parse_error(error, error_size,
+						"Error: Invalid block length %s",
+						arg);
+				return -EINVAL;
+			}
+			data->block.length = (__u16)num;
+			data->block.offset = -1;
+			return 0;
+		default:
+			break;
+		}
+		break;
+
+	/* File chunk size, poll expected value and timeout */
+	case 2:
+		if (i2c_rip_op_is_file(cmd->op)) {
+			if (num <= 0 || num >= I2C_RIP_XFER_MAX - 1) {
+				rip_parse_error(error, error_size,
+						"Error: Invalid chunk size %s",
+						arg);
+				return -EINVAL;
+			}
+			data->file.chunk = (__u16)num;
+			return 0;
+		}
+		if (cmd->op == I2C_RIP_8_POLL || cmd->op == I2C_RIP_16_POLL) {
+			data->poll.expected = (__u8)num;
+			return 0;
+		}
+		break;
+
+	case 3:
+		if (cmd->op == I2C_RIP_8_POLL || cmd->op == I2C_RIP_16_POLL) {
+			data->poll.timeout_ms = (int)num;
+			return 0;
+		}
+		break;
+	}
+
+	rip_parse_error(error, error_size, "Error: Invalid arguemts %s", arg);
+	return -EINVAL;
+}
+
+int i2c_rip_parse_line(const char *line, int size, struct i2c_rip_cmd *cmd,
+		       struct i2c_rip_arena *payload,
+		       char *error, int error_size)
+{
+	int start = 0, argn = 0, nargs = 0, eol = 0;
+	int i, j, ret, offset;
+	char arg[RIP_ARG_MAX];
+	char nul = '\0';
+	char *end;
+	long num;
+	char ch;
+
+	cmd->op = I2C_RIP_INVALID;
+	cmd->valid = 0;
+	rip_parse_error(error, error_size, "%s", "");
+	for (i = 0; i <= size && !eol; i++) {
+		/* The end of the line acts as the terminator */
+		ch = i < size ? line[i] : '\0';
+		/* Anything after // is a comment */
+		if (ch == '/' && i + 1 < size && line[i + 1] == '/')
+			ch = '\0';
+		if (ch != '\0' && !rip_is_space(ch))
+			continue;
+		if (ch == '\0')
+			eol = 1;
+		/* Empty white space */
+		if (start == i) {
+			start++;
+			continue;
+		}
+
+		/* Paths may be longer than any other argument */
+		if (argn == 1 && i2c_rip_op_is_file(cmd->op)) {
+			offset = i2c_rip_arena_append(payload, &line[start],
+						      i - start);
+			if (offset < 0 ||
+			    i2c_rip_arena_append(payload, &nul, 1) < 0) {
+				rip_parse_error(error, error_size,
+						"Error: Memory allocation failed");
+				return -ENOMEM;
+			}
+			cmd->data.file.path = offset;
+			cmd->data.file.chunk = 0;
+			start = i + 1;
+			argn++;
+			continue;
+		}
+
+		/* WBLK/VBLK data takes up the rest of the line */
+		if (argn == 1 && i2c_rip_op_has_payload(cmd->op)) {
+			ret = rip_parse_payload(&line[start], size - start,
+						&cmd->data.block, payload,
+						error, error_size);
+			if (ret < 0)
+				return ret;
+			argn++;
+			break;
+		}
+
+		if (i - start >= RIP_ARG_MAX) {
+			rip_parse_error(error, error_size,
+					"Error: Argument too long");
+			return -EINVAL;
+		}
+		memcpy(arg, &line[start], i - start);
+		arg[i - start] = '\0';
+		start = i + 1;
+
+		if (cmd->op == I2C_RIP_INVALID) {
+			for (j = 0; j < RIP_NUM_OPS; j++) {
+				if (strcmp(rip_op_table[j].name, arg) == 0) {
+					cmd->op = rip_op_table[j].op;
+					nargs = rip_op_table[j].nargs;
+					break;
+				}
+			}
+			if (cmd->op == I2C_RIP_INVALID) {
+				rip_parse_error(error, error_size,
+						"Error: Invalid Cmd: %s", arg);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (strlen(arg) > 2 && arg[0] == '0' && arg[1] == 'x')
+			num = strtol(&arg[2], &end, 16);
+		else
+			num = strtol(arg, &end, 10);
+		if (*end != '\0') {
+			rip_parse_error(error, error_size,
+					"Error: Invalid Arg: %s", arg);
+			return -EINVAL;
+		}
+		ret = rip_parse_arg(cmd, argn++, num, arg, error, error_size);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* File commands take an optional chunk size */
+	if (argn != nargs &&
+	    !(i2c_rip_op_is_file(cmd->op) && argn == nargs + 1)) {
+		rip_parse_error(error, error_size,
+				"Error: Invalid number of arguments got %d: needed %d",
+				argn, nargs);
+		return -EINVAL;
+	}
+
+	/* Empty lines parse, but give no command */
+	if (cmd->op != I2C_RIP_INVALID)
+		cmd->valid = 1;
+	return 0;
+}
+
+/* Log output */
+
+static int rip_format_dec(char *out, int value)
+{
+	char digits[12];
+	int n = 0, len = 0;
+
+	if (value < 0) {
+		out[len++] = '-';
+		value = -value;
+	}
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	while (n > 0)
+		out[len++] = digits[--n];
+	return len;
+}
+
+/* "0xNN," per byte */
+static int rip_format_hex(char *out, const __u8 *data, int size)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *p = out;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		p[0] = '0';
+		p[1] = 'x';
+		p[2] = hex[data[i] >> 4];
+		p[3] = hex[data[i] & 0x0F];
+		p[4] = ',';
+		p += 5;
+	}
+	return p - out;
+}
+
+int i2c_rip_format_xfer(char *out, const struct i2c_rip_xfer *xfer)
+{
+	static const char *const actions[] = {
+		"Writing", "Reading", "Verifying", "Unchanged"
+	};
+	char *p = out;
+	int len;
+
+	if (xfer->line > 0) {
+		memcpy(p, "Line ", 5);
+		p += 5;
+		p += rip_format_dec(p, xfer->line);
+		*p++ = ':';
+	}
+	len = strlen(actions[xfer->action]);
+	memcpy(p, actions[xfer->action], len);
+	p += len;
+	*p++ = ' ';
+	p += rip_format_dec(p, xfer->size);
+	memcpy(p, " Byte(s).\n\tREG:", 15);
+	p += 15;
+	p += rip_format_hex(p, xfer->reg, xfer->reg_size);
+	memcpy(p, "\tData:", 6);
+	p += 6;
+	p += rip_format_hex(p, xfer->data, xfer->size);
+	*p++ = '\n';
+
+	if (xfer->action == I2C_RIP_XFER_VERIFY) {
+		if (memcmp(xfer->data, xfer->expected, xfer->size) != 0) {
+			memcpy(p, "Verifying FAILED\n\tExpected Data:", 32);
+			p += 32;
+			p += rip_format_hex(p, xfer->expected, xfer->size);
+			*p++ = '\n';
+		} else {
+			memcpy(p, "Verifying PASSED\n", 17);
+			p += 17;
+		}
+	}
+	return p - out;
+}
+
+FILE *i2c_rip_ctx_log_file(const struct i2c_rip_ctx *ctx)
+{
+	return ctx->log_file;
+}
+
+unsigned int i2c_rip_ctx_log_dest(const struct i2c_rip_ctx *ctx, int error)
+{
+	unsigned int dest = 0;
+
+	if (ctx->flags & I2C_RIP_QUIET)
+		return 0;
+	if (ctx->log_to_file && ctx->log_file)
+		dest |= I2C_RIP_LOG_FILE;
+	if (error)
+		return dest | I2C_RIP_LOG_STDERR;
+	if (ctx->log_to_term)
+		dest |= I2C_RIP_LOG_STDOUT;
+	return dest;
+}
+
+static void rip_write(struct i2c_rip_ctx *ctx, int index, unsigned int dest,
+		      const char *text, int length)
+{
+	if (ctx->ops.log) {
+		ctx->ops.log(ctx->user, index, dest, text, length);
+		return;
+	}
+	if ((dest & I2C_RIP_LOG_FILE) && ctx->log_file)
+		fwrite(text, 1, length, ctx->log_file);
+	if (dest & I2C_RIP_LOG_STDOUT)
+		fwrite(text, 1, length, stdout);
+	if (dest & I2C_RIP_LOG_STDERR)
+		fwrite(text, 1, length, stderr);
+}
+
+static void rip_vlog(struct i2c_rip_ctx *ctx, int index, int error,
+		     const char *fmt, va_list args)
+{
+	char buf[I2C_RIP_LOG_FORMAT_MAX];
+	unsigned int dest;
+	char *text = buf;
+	va_list copy;
+	int length;
+
+	dest = i2c_rip_ctx_log_dest(ctx, error);
+	if (!dest)
+		return;
+
+	va_copy(copy, args);
+	length = vsnprintf(buf, sizeof(buf), fmt, copy);
+	va_end(copy);
+	if (length <= 0)
+		return;
+	if (length >= (int)sizeof(buf)) {
+		text = malloc(length + 1);
+		if (!text)
+			return;
+		vsnprintf(text, length + 1, fmt, args);
+	}
+	rip_write(ctx, index, dest, text, length);
+	if (text != buf)
+		free(text);
+}
+
+static void rip_log(struct i2c_rip_ctx *ctx, int index, int error,
+		    const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	rip_vlog(ctx, index, error, fmt, args);
+	va_end(args);
+}
+
+/* Errors of the command a run is at */
+static void rip_err(struct i2c_rip_run *run, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	rip_vlog(run->ctx, run->index, 1, fmt, args);
+	va_end(args);
+}
+
+static void rip_msg(struct i2c_rip_run *run, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	rip_vlog(run->ctx, run->index, 0, fmt, args);
+	va_end(args);
+}
+
+/* "Line N:" prefix of a command, empty without I2C_RIP_DEBUG */
+static void rip_line_str(const struct i2c_rip_ctx *ctx, int index, char *str,
+			 int size)
+{
+	str[0] = '\0';
+	if ((ctx->flags & I2C_RIP_DEBUG) && ctx->lines && index >= 0 &&
+	    index < ctx->ncmds)
+		snprintf(str, size, "Line %d:", ctx->lines[index]);
+}
+
+/* Register and data bytes of a transfer, and the result of a verify */
+static void rip_log_xfer(struct i2c_rip_run *run, int index, int action,
+			 const __u8 *reg, int reg_size, const __u8 *data,
+			 int size, const __u8 *expected)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	char text[I2C_RIP_LOG_FORMAT_MAX];
+	struct i2c_rip_xfer xfer;
+	unsigned int dest;
+
+	dest = i2c_rip_ctx_log_dest(ctx, 0);
+	if (!dest)
+		return;
+
+	xfer.line = 0;
+	if ((ctx->flags & I2C_RIP_DEBUG) && ctx->lines && index >= 0 &&
+	    index < ctx->ncmds)
+		xfer.line = ctx->lines[index];
+	xfer.action = action;
+	xfer.reg_size = reg_size;
+	xfer.size = size;
+	memcpy(xfer.reg, reg, reg_size);
+	memcpy(xfer.data, data, size);
+	if (expected)
+		memcpy(xfer.expected, expected, size);
+
+	if (ctx->ops.log_xfer) {
+		ctx->ops.log_xfer(ctx->user, index, dest, &xfer);
+		return;
+	}
+	rip_write(ctx, index, dest, text, i2c_rip_format_xfer(text, &xfer));
+}
+
+/* Which command failed on the bus */
+static void rip_log_failure(struct i2c_rip_run *run, const char *line,
+			    enum i2c_rip_op op, int bus, int addr)
+{
+	const char *action = "Write";
+
+	if (i2c_rip_op_is_read(op))
+		action = "Read";
+	else if (rip_op_is_verify(op))
+		action = "Verify";
+	rip_err(run, "%sError: Failed to %s. Bus: %d, Address: 0x%x\n", line,
+		action, bus, addr);
+}
+
+/* Events */
+
+static __u64 rip_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (__u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int rip_timed(const struct i2c_rip_ctx *ctx)
+{
+	return ctx->ops.event != NULL;
+}
+
+static void rip_event(struct i2c_rip_ctx *ctx, enum i2c_rip_event_type type,
+		      enum i2c_rip_op op, int bus, int addr, __u64 ns,
+		      int bytes)
+{
+	struct i2c_rip_event event;
+
+	if (!ctx->ops.event)
+		return;
+	event.type = type;
+	event.op = op;
+	event.bus = bus;
+	event.addr = addr;
+	event.ns = ns;
+	event.bytes = bytes;
+	ctx->ops.event(ctx->user, &event);
+}
+
+static int rip_hist_index(__u64 ns)
+{
+	int shift;
+
+	if (ns < RIP_HIST_SUB_COUNT)
+		return (int)ns;
+	shift = (63 - __builtin_clzll(ns)) - (RIP_HIST_SUB_BITS - 1);
+	if (shift > RIP_HIST_MAX_SHIFT)
+		return RIP_HIST_BUCKETS - 1;
+	return RIP_HIST_SUB_COUNT + (shift - 1) * RIP_HIST_HALF_COUNT +
+	       (int)((ns >> shift) - RIP_HIST_HALF_COUNT);
+}
+
+/* Highest value that lands in a bucket */
+static __u64 rip_hist_value(int index)
+{
+	int shift;
+	__u64 sub;
+
+	if (index < RIP_HIST_SUB_COUNT)
+		return index;
+	index -= RIP_HIST_SUB_COUNT;
+	shift = index / RIP_HIST_HALF_COUNT + 1;
+	sub = index % RIP_HIST_HALF_COUNT + RIP_HIST_HALF_COUNT;
+	return ((sub + 1) << shift) - 1;
+}
+
+static void rip_hist_record(struct rip_hist *hist, __u64 ns)
+{
+	if (ns > hist->max)
+		hist->max = ns;
+	hist->count++;
+	hist->buckets[rip_hist_index(ns)]++;
+}
+
+static __u64 rip_hist_percentile(const struct rip_hist *hist, double percent)
+{
+	__u64 target, seen = 0, value;
+	int i;
+
+	if (hist->count == 0)
+		return 0;
+	target = (__u64)(percent / 100.0 * hist->count + 0.999999);
+	if (target < 1)
+		target = 1;
+	for (i = 0; i < RIP_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			value = rip_hist_value(i);
+			return value > hist->max ? hist->max : value;
+		}
+	}
+	return hist->max;
+}
+
+/* i2c-dev transport */
+
+static int rip_dev_open(void *user, int bus)
+{
+	char filename[20];
+	int file;
+
+	(void)user;
+	snprintf(filename, sizeof(filename), "/dev/i2c/%d", bus);
+	file = open(filename, O_RDWR | O_CLOEXEC);
+	if (file < 0 && (errno == ENOENT || errno == ENOTDIR)) {
+		snprintf(filename, sizeof(filename), "/dev/i2c-%d", bus);
+		file = open(filename, O_RDWR | O_CLOEXEC);
+	}
+	if (file < 0)
+		return -errno;
+	/* Counted for i2ctop when asked to, like the i2c tools */
+	if (getenv("I2C_STATS"))
+		i2c_stats_attach(file, bus);
+	return file;
+}
+
+static int rip_dev_check(void *user, int file)
+{
+	unsigned long funcs;
+
+	(void)user;
+	if (ioctl(file, I2C_FUNCS, &funcs) < 0)
+		return -errno;
+	if (!(funcs & I2C_FUNC_I2C))
+		return -EOPNOTSUPP;
+	return 0;
+}
+
+/* Forced, so registers can be reached even when a driver is bound */
+static int rip_dev_set_slave(void *user, int file, int addr)
+{
+	(void)user;
+	if (ioctl(file, I2C_SLAVE_FORCE, addr) < 0)
+		return -errno;
+	i2c_stats_set_slave(file, addr);
+	return 0;
+}
+
+static int rip_dev_rdwr(void *user, int file, struct i2c_rdwr_ioctl_data *rdwr)
+{
+	(void)user;
+	return i2c_rdwr_access(file, rdwr->msgs, rdwr->nmsgs);
+}
+
+static void rip_dev_close(void *user, int file)
+{
+	(void)user;
+	i2c_stats_detach(file);
+	close(file);
+}
+
+static int rip_dev_lock(void *user, int file, int priority, int wait)
+{
+	(void)user;
+	return i2c_bus_lock(file, priority, wait);
+}
+
+static void rip_dev_unlock(void *user, int file)
+{
+	(void)user;
+	i2c_bus_unlock(file);
+}
+
+static int rip_dev_contended(void *user, int file, int priority)
+{
+	(void)user;
+	return i2c_bus_contended(file, priority);
+}
+
+static const struct i2c_rip_transport rip_dev_transport = {
+	.open		= rip_dev_open,
+	.check		= rip_dev_check,
+	.set_slave	= rip_dev_set_slave,
+	.rdwr		= rip_dev_rdwr,
+	.close		= rip_dev_close,
+	.lock		= rip_dev_lock,
+	.unlock		= rip_dev_unlock,
+	.contended	= rip_dev_contended,
+};
+
+static int rip_rdwr(struct i2c_rip_ctx *ctx, int file, struct i2c_msg *msgs,
+		    int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = nmsgs;
+	return ctx->transport.rdwr(ctx->transport_user, file, &rdwr);
+}
+
+static int rip_arbitrated(const struct i2c_rip_ctx *ctx)
+{
+	return ctx->transport.lock != NULL;
+}
+
+/* Shadow registers */
+
+/* Created on first use */
+static struct rip_shadow *rip_shadow_device(struct i2c_rip_ctx *ctx, int bus,
+					    int addr)
+{
+	if (bus < 0 || bus >= RIP_MAX_BUSSES || addr < 0 ||
+	    addr >= RIP_MAX_SLAVES)
+		return NULL;
+	if (!ctx->shadow[bus][addr])
+		ctx->shadow[bus][addr] = calloc(1, sizeof(struct rip_shadow));
+	return ctx->shadow[bus][addr];
+}
+
+static int rip_reg_value(const __u8 *reg, int reg_size)
+{
+	return reg_size == 1 ? reg[0] : (reg[0] << 8) | reg[1];
+}
+
+static void rip_reg_bytes(__u8 *reg, int value, int reg_size)
+{
+	if (reg_size == 1) {
+		reg[0] = (__u8)value;
+	} else {
+		reg[0] = (__u8)((value >> 8) & 0xFF);
+		reg[1] = (__u8)(value & 0xFF);
+	}
+}
+
+/* Values written to or read from consecutive registers */
+static void rip_shadow_store(struct i2c_rip_ctx *ctx, int bus, int addr,
+			     const __u8 *reg, int reg_size, const __u8 *data,
+			     int size)
+{
+	struct rip_shadow *shadow;
+	int first = rip_reg_value(reg, reg_size);
+	int i, r;
+
+	if (!(ctx->flags & I2C_RIP_SHADOW))
+		return;
+	shadow = rip_shadow_device(ctx, bus, addr);
+	if (!shadow)
+		return;
+	for (i = 0; i < size; i++) {
+		r = (first + i) & (RIP_REG_SPACE - 1);
+		if (!RIP_BIT_TEST(shadow->vol, r)) {
+			shadow->values[r] = data[i];
+			RIP_BIT_SET(shadow->known, r);
+		}
+	}
+}
+
+/* Registers a write may or may not have reached */
+static void rip_shadow_forget(struct i2c_rip_ctx *ctx, int bus, int addr,
+			      const __u8 *reg, int reg_size, int size)
+{
+	struct rip_shadow *shadow;
+	int first = rip_reg_value(reg, reg_size);
+	int i;
+
+	if (!(ctx->flags & I2C_RIP_SHADOW))
+		return;
+	shadow = rip_shadow_device(ctx, bus, addr);
+	if (!shadow)
+		return;
+	for (i = 0; i < size; i++)
+		RIP_BIT_CLEAR(shadow->known, (first + i) & (RIP_REG_SPACE - 1));
+}
+
+/* Every device of a bus, another job may have used it */
+static void rip_shadow_forget_bus(struct i2c_rip_ctx *ctx, int bus)
+{
+	struct rip_shadow *shadow;
+	int addr;
+
+	for (addr = 0; addr < RIP_MAX_SLAVES; addr++) {
+		shadow = ctx->shadow[bus][addr];
+		if (shadow) {
+			memset(shadow->known, 0, sizeof(shadow->known));
+			shadow->segment = 0;
+		}
+	}
+}
+
+int i2c_rip_burst_limit(int burst, int reg_size)
+{
+	int limit = I2C_RIP_XFER_MAX - 1 - reg_size;
+
+	if (burst != I2C_RIP_BURST_DEFAULT && burst < limit)
+		limit = burst;
+	return limit < 1 ? 1 : limit;
+}
+
+/* Max data bytes in one transfer to a device */
+static int rip_burst_limit(const struct i2c_rip_ctx *ctx, int bus, int addr,
+			   int reg_size)
+{
+	int burst = I2C_RIP_BURST_DEFAULT;
+
+	if (addr < RIP_MAX_SLAVES)
+		burst = ctx->burst[bus][addr];
+	return i2c_rip_burst_limit(burst, reg_size);
+}
+
+/* Batches */
+
+/* A transfer fits in one message */
+static int rip_check_transfer(struct i2c_rip_run *run, int addr, int reg_size,
+			      int size)
+{
+	if (addr < 0 || addr > 0x7f) {
+		rip_err(run, "Error: Transfer Failed, Register size invalid: %d\n",
+			addr);
+		return 0;
+	}
+	if (size + reg_size >= I2C_RIP_XFER_MAX) {
+		rip_err(run, "Error: Transfer Failed, Size invalid: %d\n",
+			size + reg_size);
+		return 0;
+	}
+	if (reg_size <= 0) {
+		rip_err(run, "Error: Transfer Failed, dRegSize invalid: %d\n",
+			reg_size);
+		return 0;
+	}
+	if (size <= 0) {
+		rip_err(run, "Error: Transfer Failed, dataSize invalid: %d\n",
+			size);
+		return 0;
+	}
+	return 1;
+}
+
+static int rip_batch_msgs(enum i2c_rip_op op)
+{
+	return rip_op_is_write(op) ? 1 : 2;
+}
+
+static int rip_batch_full(const struct rip_batch *batch, enum i2c_rip_op op)
+{
+	return batch->nmsgs + rip_batch_msgs(op) > RIP_BATCH_MAX ||
+	       batch->npending >= RIP_BATCH_MAX;
+}
+
+/*
+ * Queues a transfer: writes are one message (register and data), reads
+ * and verifies are a register write followed by a read.
+ */
+static int rip_batch_add(struct i2c_rip_run *run, int index, int bus,
+			 int file, int addr, enum i2c_rip_op op,
+			 const __u8 *reg, int reg_size, const __u8 *data,
+			 int size)
+{
+	struct rip_batch *batch = &run->batch;
+	struct rip_pending *pending;
+	struct i2c_msg *msgs;
+
+	if (!rip_check_transfer(run, addr, reg_size, size))
+		return 0;
+	if (rip_batch_full(batch, op)) {
+		rip_err(run, "Error: Batch full\n");
+		return 0;
+	}
+	if (batch->npending == 0)
+		batch->file = file;
+
+	pending = &batch->pending[batch->npending++];
+	msgs = &batch->msgs[batch->nmsgs];
+	pending->index = index;
+	pending->no_log = 0;
+	pending->bus = bus;
+	pending->addr = addr;
+	pending->op = op;
+	pending->first_msg = batch->nmsgs;
+	pending->nmsgs = rip_batch_msgs(op);
+	pending->reg_size = reg_size;
+	pending->size = size;
+
+	memcpy(pending->wr, reg, reg_size);
+	msgs[0].addr = addr;
+	msgs[0].flags = 0;
+	msgs[0].buf = pending->wr;
+	msgs[0].len = reg_size;
+
+	if (rip_op_is_write(op)) {
+		memcpy(&pending->wr[reg_size], data, size);
+		msgs[0].len = reg_size + size;
+		/* Later writes are checked against it before it went out */
+		rip_shadow_store(run->ctx, bus, addr, reg, reg_size, data,
+				 size);
+	} else {
+		if (rip_op_is_verify(op))
+			memcpy(pending->expected, data, size);
+		/* The read lands over the command data */
+		memcpy(pending->rd, data, size);
+		msgs[1].addr = addr;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].buf = pending->rd;
+		msgs[1].len = size;
+	}
+
+	batch->nmsgs += pending->nmsgs;
+	return 1;
+}
+
+/* Logs a queued transfer once all its messages went out, fails when a
+   verify did not match */
+static int rip_batch_complete(struct i2c_rip_run *run, int i)
+{
+	struct rip_pending *pending = &run->batch.pending[i];
+	struct i2c_rip_ctx *ctx = run->ctx;
+	struct i2c_rip_read read;
+	const __u8 *data = &pending->wr[pending->reg_size];
+
+	run->index = pending->index;
+
+	/* Elided write, nothing went out */
+	if (pending->nmsgs == 0) {
+		if (!pending->no_log)
+			rip_log_xfer(run, pending->index,
+				     I2C_RIP_XFER_UNCHANGED, pending->wr,
+				     pending->reg_size, data, pending->size,
+				     NULL);
+		return 1;
+	}
+
+	/* Stored again in completion order, a read queued before a write
+	   must not win */
+	rip_shadow_store(ctx, pending->bus, pending->addr, pending->wr,
+			 pending->reg_size,
+			 rip_op_is_write(pending->op) ? data : pending->rd,
+			 pending->size);
+
+	if (rip_op_is_write(pending->op)) {
+		if (!pending->no_log)
+			rip_log_xfer(run, pending->index, I2C_RIP_XFER_WRITE,
+				     pending->wr, pending->reg_size, data,
+				     pending->size, NULL);
+		return 1;
+	}
+
+	if (i2c_rip_op_is_read(pending->op)) {
+		if (ctx->ops.read) {
+			read.index = pending->index;
+			read.line = ctx->lines ? ctx->lines[pending->index] : 0;
+			read.op = pending->op;
+			read.bus = pending->bus;
+			read.addr = pending->addr;
+			read.reg = rip_reg_value(pending->wr,
+						 pending->reg_size);
+			read.size = pending->size;
+			read.data = pending->rd;
+			ctx->ops.read(ctx->user, &read);
+		}
+		rip_log_xfer(run, pending->index, I2C_RIP_XFER_READ,
+			     pending->wr, pending->reg_size, pending->rd,
+			     pending->size, NULL);
+		return 1;
+	}
+
+	rip_log_xfer(run, pending->index, I2C_RIP_XFER_VERIFY, pending->wr,
+		     pending->reg_size, pending->rd, pending->size,
+		     pending->expected);
+	return memcmp(pending->rd, pending->expected, pending->size) == 0;
+}
+
+/* Drops the shadow values of a queued write that did not complete */
+static void rip_batch_forget(struct i2c_rip_run *run, int i)
+{
+	struct rip_pending *pending = &run->batch.pending[i];
+
+	if (rip_op_is_write(pending->op))
+		rip_shadow_forget(run->ctx, pending->bus, pending->addr,
+				  pending->wr, pending->reg_size,
+				  pending->size);
+}
+
+/* The line of a queued transfer that did not make it onto the bus */
+static void rip_batch_failed(struct i2c_rip_run *run, int i)
+{
+	struct rip_pending *pending = &run->batch.pending[i];
+	char line[16];
+
+	run->index = pending->index;
+	rip_line_str(run->ctx, pending->index, line, sizeof(line));
+	rip_log_failure(run, line, pending->op, pending->bus, pending->addr);
+	rip_batch_forget(run, i);
+}
+
+/* One I2C_RDWR call of a batch, its time is shared evenly by the
+   transfers that completed in it */
+static void rip_batch_events(struct i2c_rip_run *run, int next, int done,
+			     __u64 ns)
+{
+	const struct rip_batch *batch = &run->batch;
+	const struct rip_pending *pending;
+	int completed = 0, last, i, m, bytes;
+
+	rip_event(run->ctx, I2C_RIP_EVENT_RDWR, I2C_RIP_INVALID, run->bus, -1,
+		  ns, 0);
+
+	for (last = next; last < batch->npending; last++) {
+		pending = &batch->pending[last];
+		if (pending->first_msg + pending->nmsgs > done)
+			break;
+		if (pending->nmsgs > 0)
+			completed++;
+	}
+
+	for (i = next; i < last; i++) {
+		pending = &batch->pending[i];
+		if (pending->nmsgs == 0)
+			continue;
+		/* Message bytes plus the address byte of each message */
+		bytes = 0;
+		for (m = pending->first_msg;
+		     m < pending->first_msg + pending->nmsgs; m++)
+			bytes += batch->msgs[m].len + 1;
+		rip_event(run->ctx, I2C_RIP_EVENT_XFER, pending->op,
+			  pending->bus, pending->addr, ns / completed, bytes);
+	}
+}
+
+/* A call that failed without a count, reported against all of its lines */
+static void rip_batch_lost(struct i2c_rip_run *run, int next, int err)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	struct rip_batch *batch = &run->batch;
+	int first = batch->pending[next].index;
+	int last = batch->pending[batch->npending - 1].index;
+	char line[32];
+
+	line[0] = '\0';
+	if ((ctx->flags & I2C_RIP_DEBUG) && ctx->lines) {
+		if (first == last)
+			rip_line_str(ctx, first, line, sizeof(line));
+		else
+			snprintf(line, sizeof(line), "Lines %d-%d:",
+				 ctx->lines[first], ctx->lines[last]);
+	}
+	run->index = first;
+	rip_err(run, "%sError: Sending messages failed: %s\n", line,
+		strerror(-err));
+}
+
+/*
+ * Sends every queued message with as few I2C_RDWR calls as possible.
+ * On a partial transfer the count points at the failed transfer, with
+ * errors supressed the rest of the batch is sent on. A call that fails
+ * without a count may have reached the device with any of its
+ * transfers, so nothing of it is sent again: the error covers the lines
+ * of the whole call.
+ */
+static int rip_batch_flush(struct i2c_rip_run *run)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	struct rip_batch *batch = &run->batch;
+	int failed = 0, next = 0;
+	int index = run->index;
+	int first, nmsgs, sent, done;
+	__u64 start = 0;
+
+	while (next < batch->npending) {
+		first = batch->pending[next].first_msg;
+
+		/* Only elided writes left, nothing to send */
+		if (first == batch->nmsgs) {
+			for (; next < batch->npending; next++)
+				rip_batch_complete(run, next);
+			break;
+		}
+
+		nmsgs = batch->nmsgs - first;
+		if (rip_timed(ctx))
+			start = rip_now();
+		sent = rip_rdwr(ctx, batch->file, &batch->msgs[first], nmsgs);
+		if (rip_timed(ctx))
+			rip_batch_events(run, next,
+					 first + (sent < 0 ? 0 : sent),
+					 rip_now() - start);
+
+		if (sent < 0) {
+			rip_batch_lost(run, next, sent);
+			failed = 1;
+			break;
+		}
+
+		done = first + sent;
+		while (next < batch->npending &&
+		       batch->pending[next].first_msg +
+		       batch->pending[next].nmsgs <= done) {
+			if (!rip_batch_complete(run, next))
+				failed = 1;
+			next++;
+		}
+
+		if (sent < nmsgs && next < batch->npending) {
+			rip_err(run, "Error: only %d/%d messages were sent\n",
+				sent, nmsgs);
+			rip_batch_failed(run, next++);
+			failed = 1;
+			if (!ctx->supress)
+				break;
+		}
+	}
+
+	/* Transfers left behind by a stop on error never went out */
+	for (; next < batch->npending; next++)
+		rip_batch_forget(run, next);
+
+	batch->npending = 0;
+	batch->nmsgs = 0;
+	run->index = index;
+	return !failed;
+}
+
+/*
+ * Leaves out a write when every register it covers holds its data
+ * already. With transfers queued it takes a place in the batch, so it
+ * is logged in script order.
+ */
+static int rip_shadow_elide(struct i2c_rip_run *run, int index,
+			    enum i2c_rip_op op, int bus, int addr,
+			    const __u8 *reg, int reg_size, const __u8 *data,
+			    int size, int quiet)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	struct rip_batch *batch = &run->batch;
+	struct rip_pending *pending;
+	struct rip_shadow *shadow;
+	int first = rip_reg_value(reg, reg_size);
+	int i, r;
+
+	if (!(ctx->flags & I2C_RIP_SHADOW))
+		return 0;
+	shadow = rip_shadow_device(ctx, bus, addr);
+	if (!shadow)
+		return 0;
+	for (i = 0; i < size; i++) {
+		r = (first + i) & (RIP_REG_SPACE - 1);
+		if (!RIP_BIT_TEST(shadow->known, r) ||
+		    shadow->values[r] != data[i])
+			return 0;
+	}
+
+	if (batch->npending >= RIP_BATCH_MAX && !rip_batch_flush(run))
+		return 0;
+	rip_event(ctx, I2C_RIP_EVENT_ELIDED, op, bus, addr, 0, 0);
+
+	if (batch->npending == 0) {
+		if (!quiet)
+			rip_log_xfer(run, index, I2C_RIP_XFER_UNCHANGED, reg,
+				     reg_size, data, size, NULL);
+		return 1;
+	}
+
+	pending = &batch->pending[batch->npending++];
+	pending->index = index;
+	pending->bus = bus;
+	pending->addr = addr;
+	pending->op = op;
+	pending->first_msg = batch->nmsgs;
+	pending->nmsgs = 0;
+	pending->reg_size = reg_size;
+	pending->size = size;
+	pending->no_log = quiet;
+	memcpy(pending->wr, reg, reg_size);
+	memcpy(&pending->wr[reg_size], data, size);
+	return 1;
+}
+
+/* Polling */
+
+/* One byte outside of any batch */
+static int rip_poll_read(struct i2c_rip_run *run, int file, int addr,
+			 const __u8 *reg, int reg_size, __u8 *value)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	__u8 wr[RIP_REG_MAX];
+	struct i2c_msg msgs[2];
+	__u64 start = 0;
+	int sent;
+
+	memcpy(wr, reg, reg_size);
+	msgs[0].addr = addr;
+	msgs[0].flags = 0;
+	msgs[0].len = reg_size;
+	msgs[0].buf = wr;
+	msgs[1].addr = addr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = 1;
+	msgs[1].buf = value;
+
+	if (rip_timed(ctx))
+		start = rip_now();
+	sent = rip_rdwr(ctx, file, msgs, 2);
+	if (rip_timed(ctx))
+		rip_event(ctx, I2C_RIP_EVENT_RDWR, I2C_RIP_INVALID, run->bus,
+			  addr, rip_now() - start, reg_size + 3);
+	return sent == 2;
+}
+
+/*
+ * Reads a register until (value & mask) == expected or the timeout. The
+ * wait between reads starts at the poll interval and doubles up to its
+ * max, a read that fails counts as not ready yet.
+ */
+static int rip_poll(struct i2c_rip_run *run, const char *line, int file,
+		    int addr, const struct i2c_rip_poll *poll, int reg_size)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	__u64 interval_ns = (__u64)ctx->poll_us * 1000;
+	const __u64 max_interval_ns = (__u64)ctx->poll_max_us * 1000;
+	const __u64 timeout_ns = (__u64)poll->timeout_ms * 1000000;
+	const __u64 start = rip_now();
+	__u64 elapsed, wait_ns, sleep_start;
+	int read_ok = 0, nreads = 0;
+	struct timespec wait;
+	__u8 reg[RIP_REG_MAX];
+	__u8 value = 0;
+
+	rip_reg_bytes(reg, poll->addr, reg_size);
+
+	for (;;) {
+		read_ok = rip_poll_read(run, file, addr, reg, reg_size, &value);
+		nreads++;
+
+		elapsed = rip_now() - start;
+		if (read_ok && (value & poll->mask) == poll->expected) {
+			rip_msg(run, "%sPoll 0x%02x ready after %llu us, %d read(s), Data:0x%02x\n",
+				line, poll->addr,
+				(unsigned long long)(elapsed / 1000), nreads,
+				value);
+			return 1;
+		}
+		if (elapsed >= timeout_ns)
+			break;
+
+		wait_ns = interval_ns;
+		if (wait_ns > timeout_ns - elapsed)
+			wait_ns = timeout_ns - elapsed;
+		wait.tv_sec = (time_t)(wait_ns / 1000000000);
+		wait.tv_nsec = (long)(wait_ns % 1000000000);
+		sleep_start = rip_timed(ctx) ? rip_now() : 0;
+		nanosleep(&wait, NULL);
+		if (rip_timed(ctx))
+			rip_event(ctx, I2C_RIP_EVENT_SLEEP, I2C_RIP_INVALID,
+				  run->bus, addr, rip_now() - sleep_start, 0);
+
+		interval_ns *= 2;
+		if (interval_ns > max_interval_ns)
+			interval_ns = max_interval_ns;
+	}
+
+	if (read_ok)
+		rip_err(run, "%sError: Poll 0x%02x timed out after %dms, %d read(s), Data:0x%02x Mask:0x%02x Expected:0x%02x\n",
+			line, poll->addr, poll->timeout_ms, nreads, value,
+			poll->mask, poll->expected);
+	else
+		rip_err(run, "%sError: Poll 0x%02x timed out after %dms, %d read(s), last read failed\n",
+			line, poll->addr, poll->timeout_ms, nreads);
+	return 0;
+}
+
+/* Busses */
+
+/* Opens a bus and checks it can do I2C_RDWR */
+static int rip_bus_open(struct i2c_rip_ctx *ctx, int index, int bus,
+			const char *line)
+{
+	__u64 start = 0, opened = 0;
+	int file, ret;
+
+	if (rip_timed(ctx))
+		start = rip_now();
+	file = ctx->transport.open(ctx->transport_user, bus);
+	if (file < 0) {
+		rip_log(ctx, index, 1, "%sError: Unable to open bus %d: %s\n",
+			line, bus, strerror(-file));
+		return 0;
+	}
+	if (rip_timed(ctx))
+		opened = rip_now();
+	if (ctx->transport.check) {
+		ret = ctx->transport.check(ctx->transport_user, file);
+		if (ret < 0) {
+			rip_log(ctx, index, 1,
+				"%sError: Unable to find RDWD Function %d: %s\n",
+				line, bus, strerror(-ret));
+			ctx->transport.close(ctx->transport_user, file);
+			return 0;
+		}
+	}
+	if (rip_timed(ctx)) {
+		rip_event(ctx, I2C_RIP_EVENT_OPEN, I2C_RIP_SET_BUS, bus, -1,
+			  opened - start, 0);
+		rip_event(ctx, I2C_RIP_EVENT_FUNCS, I2C_RIP_SET_BUS, bus, -1,
+			  rip_now() - opened, 0);
+	}
+	ctx->bus[bus].file = file;
+	ctx->bus[bus].connected = 1;
+	return 1;
+}
+
+/* Takes a bus from other jobs */
+static int rip_arbiter_lock(struct i2c_rip_ctx *ctx, int bus, int wait)
+{
+	__u64 start = 0;
+	int ret;
+
+	if (rip_timed(ctx))
+		start = rip_now();
+	ret = ctx->transport.lock(ctx->transport_user, ctx->bus[bus].file,
+				  ctx->priority, wait);
+	if (ret < 0)
+		return ret;
+	ctx->bus[bus].locked = 1;
+	if (rip_timed(ctx))
+		rip_event(ctx, I2C_RIP_EVENT_LOCK, I2C_RIP_SET_BUS, bus, -1,
+			  rip_now() - start, 0);
+	return 0;
+}
+
+static void rip_arbiter_unlock(struct i2c_rip_ctx *ctx, int bus)
+{
+	if (ctx->bus[bus].locked) {
+		ctx->transport.unlock(ctx->transport_user, ctx->bus[bus].file);
+		ctx->bus[bus].locked = 0;
+	}
+}
+
+/*
+ * Takes a bus selected by SET-BUS, it stays taken until the context is
+ * released. A script holding other busses must not wait for this one
+ * while holding them, the job it waits for could be waiting for one of
+ * them: when the bus is taken, all are given up and taken back in bus
+ * order.
+ */
+static int rip_arbiter_acquire(struct i2c_rip_run *run, int bus,
+			       const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	__u8 retake[RIP_MAX_BUSSES];
+	int held = 0, ret, b;
+
+	if (ctx->bus[bus].locked)
+		return 1;
+
+	/* Runs of one stream have every bus taken before they start */
+	if (run->stream == I2C_RIP_ALL_STREAMS) {
+		for (b = 0; b < RIP_MAX_BUSSES; b++) {
+			retake[b] = ctx->bus[b].locked;
+			held |= retake[b];
+		}
+	}
+
+	if (!held) {
+		ret = rip_arbiter_lock(ctx, bus, 1);
+	} else {
+		ret = rip_arbiter_lock(ctx, bus, 0);
+		if (ret == -EWOULDBLOCK) {
+			rip_msg(run, "%sBus %d is busy, giving up the other busses until it is free\n",
+				line, bus);
+			retake[bus] = 1;
+			for (b = 0; b < RIP_MAX_BUSSES; b++) {
+				if (retake[b] && b != bus) {
+					rip_arbiter_unlock(ctx, b);
+					rip_shadow_forget_bus(ctx, b);
+				}
+			}
+			ret = 0;
+			for (b = 0; b < RIP_MAX_BUSSES && ret == 0; b++)
+				if (retake[b])
+					ret = rip_arbiter_lock(ctx, b, 1);
+		}
+	}
+
+	if (ret < 0) {
+		rip_err(run, "%sError: Unable to lock bus %d: %s\n", line, bus,
+			strerror(-ret));
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Gives busses up to higher priority jobs waiting for them, between
+ * commands. The active bus is taken back right away, others at their
+ * next SET-BUS.
+ */
+static int rip_arbiter_yield(struct i2c_rip_run *run, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	__u64 now = rip_now();
+	int bus, ret;
+
+	if (now < run->arbiter_next)
+		return 1;
+	run->arbiter_next = now + RIP_ARBITER_CHECK_NS;
+
+	for (bus = 0; bus < RIP_MAX_BUSSES; bus++) {
+		/* Runs of one stream only look after their own bus */
+		if ((run->stream != I2C_RIP_ALL_STREAMS && bus != run->bus) ||
+		    !ctx->bus[bus].locked ||
+		    !ctx->transport.contended(ctx->transport_user,
+					      ctx->bus[bus].file,
+					      ctx->priority))
+			continue;
+
+		rip_arbiter_unlock(ctx, bus);
+		rip_shadow_forget_bus(ctx, bus);
+		rip_event(ctx, I2C_RIP_EVENT_YIELD, I2C_RIP_INVALID, bus, -1,
+			  0, 0);
+		if (bus != run->bus) {
+			rip_msg(run, "%sGave bus %d to a higher priority job\n",
+				line, bus);
+			continue;
+		}
+
+		ret = rip_arbiter_lock(ctx, bus, 1);
+		if (ret < 0) {
+			rip_err(run, "%sError: Unable to lock bus %d: %s\n",
+				line, bus, strerror(-ret));
+			return 0;
+		}
+		rip_msg(run, "%sGave bus %d to a higher priority job for %.3f ms\n",
+			line, bus, (rip_now() - now) / 1000000.0);
+	}
+	return 1;
+}
+
+/* Register ranges and files */
+
+/* CRC-32 (IEEE 802.3) of files read back from a device */
+static __u32 rip_crc32(const struct i2c_rip_ctx *ctx, const __u8 *data,
+		       size_t size)
+{
+	__u32 crc = ~0U;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		crc = ctx->crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+/*
+ * Reads consecutive registers in chunks, with I2C_RIP_BATCH up to a
+ * batch worth of chunks go in one I2C_RDWR call. Returns 0 or the error
+ * of the call that failed.
+ */
+static int rip_read_registers(struct i2c_rip_run *run, int file, int addr,
+			      int first, int reg_size, int chunk,
+			      enum i2c_rip_op op, __u8 *out, size_t size)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	const int max_chunks = (ctx->flags & I2C_RIP_BATCH) ?
+			       RIP_BATCH_MAX / 2 : 1;
+	__u8 regs[RIP_BATCH_MAX / 2][RIP_REG_MAX];
+	struct i2c_msg msgs[RIP_BATCH_MAX];
+	int nchunks, length, sent, c;
+	size_t offset = 0;
+	__u64 start = 0, ns;
+	struct i2c_msg *msg;
+
+	while (offset < size) {
+		for (nchunks = 0; nchunks < max_chunks && offset < size;
+		     nchunks++) {
+			length = size - offset > (size_t)chunk ? chunk :
+				 (int)(size - offset);
+			msg = &msgs[nchunks * 2];
+			rip_reg_bytes(regs[nchunks], first + (int)offset,
+				      reg_size);
+			msg[0].addr = addr;
+			msg[0].flags = 0;
+			msg[0].len = reg_size;
+			msg[0].buf = regs[nchunks];
+			msg[1].addr = addr;
+			msg[1].flags = I2C_M_RD;
+			msg[1].len = length;
+			msg[1].buf = &out[offset];
+			offset += length;
+		}
+
+		if (rip_timed(ctx))
+			start = rip_now();
+		sent = rip_rdwr(ctx, file, msgs, nchunks * 2);
+		if (rip_timed(ctx)) {
+			ns = rip_now() - start;
+			rip_event(ctx, I2C_RIP_EVENT_RDWR, I2C_RIP_INVALID,
+				  run->bus, addr, ns, 0);
+			for (c = 0; c < nchunks; c++)
+				rip_event(ctx, I2C_RIP_EVENT_XFER, op,
+					  run->bus, addr, ns / nchunks,
+					  reg_size + msgs[c * 2 + 1].len + 2);
+		}
+		if (sent != nchunks * 2)
+			return sent < 0 ? sent : -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Reads the current values of every register the current segment
+ * writes on the active device into its shadow, once per segment
+ * (I2C_RIP_RECONCILE). Writes the device already holds are then left
+ * out like known values.
+ */
+static int rip_reconcile(struct i2c_rip_run *run, int index, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	const int bus = run->bus;
+	const struct rip_bus *conn = &ctx->bus[bus];
+	const int addr = conn->addr;
+	__u8 wanted[RIP_REG_MAX][RIP_REG_SPACE / 8];
+	const struct i2c_rip_cmd *cmd;
+	struct rip_shadow *shadow;
+	int scan_bus = bus, scan_addr = addr;
+	int nregs = 0, nranges = 0;
+	int i, r, k, first, chunk, ret;
+	int reg, reg_size, length;
+
+	if (!(ctx->flags & I2C_RIP_RECONCILE))
+		return 1;
+	shadow = rip_shadow_device(ctx, bus, addr);
+	if (!shadow || shadow->segment == run->segment + 1)
+		return 1;
+	shadow->segment = run->segment + 1;
+
+	/* Queued transfers land before the device is read */
+	if (run->batch.npending > 0 && !rip_batch_flush(run))
+		return 0;
+
+	memset(wanted, 0, sizeof(wanted));
+	for (i = index; i < ctx->ncmds; i++) {
+		cmd = &ctx->cmds[i];
+		if (run->stream != I2C_RIP_ALL_STREAMS &&
+		    ctx->streams[i] != run->stream)
+			continue;
+		if (rip_op_ends_segment(cmd->op))
+			break;
+		if (cmd->op == I2C_RIP_SET_BUS) {
+			scan_bus = cmd->data.single;
+			scan_addr = RIP_NO_SLAVE;
+		} else if (cmd->op == I2C_RIP_SET_ID) {
+			scan_addr = cmd->data.single;
+		} else if (scan_bus == bus && scan_addr == addr &&
+			   i2c_rip_write_range(cmd, &reg, &reg_size, &length)) {
+			for (r = reg; r < reg + length && r < RIP_REG_SPACE;
+			     r++)
+				RIP_BIT_SET(wanted[reg_size - 1], r);
+		}
+	}
+
+	/* Volatile registers are never read, writes to them always go out */
+	for (reg_size = 1; reg_size <= RIP_REG_MAX; reg_size++) {
+		chunk = rip_burst_limit(ctx, bus, addr, reg_size);
+		r = 0;
+		while (r < RIP_REG_SPACE) {
+			if (!RIP_BIT_TEST(wanted[reg_size - 1], r) ||
+			    RIP_BIT_TEST(shadow->vol, r)) {
+				r++;
+				continue;
+			}
+			first = r;
+			while (r < RIP_REG_SPACE &&
+			       RIP_BIT_TEST(wanted[reg_size - 1], r) &&
+			       !RIP_BIT_TEST(shadow->vol, r))
+				r++;
+
+			ret = rip_read_registers(run, conn->file, addr, first,
+						 reg_size, chunk,
+						 reg_size == 1 ?
+						 I2C_RIP_8_READ_BLOCK :
+						 I2C_RIP_16_READ_BLOCK,
+						 &shadow->values[first],
+						 r - first);
+			if (ret < 0) {
+				rip_err(run, "%sError: Reconcile read of 0x%02x on bus %d failed: %s\n",
+					line, addr, bus, strerror(-ret));
+				for (k = first; k < r; k++)
+					RIP_BIT_CLEAR(shadow->known, k);
+				return 0;
+			}
+			for (k = first; k < r; k++)
+				RIP_BIT_SET(shadow->known, k);
+			nregs += r - first;
+			nranges++;
+		}
+	}
+
+	rip_msg(run, "%sReconcile 0x%02x on bus %d, read %d register(s) in %d range(s)\n",
+		line, addr, bus, nregs, nranges);
+	return 1;
+}
+
+/*
+ * Reads a file back from consecutive registers. Returns the offset of
+ * the first byte that differs, size if all match, or -errno.
+ */
+static long rip_file_read_back(struct i2c_rip_run *run, int file, int addr,
+			       int first, int reg_size, int chunk,
+			       const __u8 *expected, size_t size, __u32 *crc)
+{
+	long mismatch = (long)size;
+	__u8 *data;
+	size_t i;
+	int ret;
+
+	data = malloc(size);
+	if (!data)
+		return -ENOMEM;
+	ret = rip_read_registers(run, file, addr, first, reg_size, chunk,
+				 reg_size == 1 ? I2C_RIP_8_VERIFY_FILE :
+				 I2C_RIP_16_VERIFY_FILE, data, size);
+	if (ret < 0) {
+		free(data);
+		return ret;
+	}
+
+	*crc = rip_crc32(run->ctx, data, size);
+	for (i = 0; i < size; i++) {
+		if (data[i] != expected[i]) {
+			mismatch = (long)i;
+			break;
+		}
+	}
+	free(data);
+	return mismatch;
+}
+
+/*
+ * Runs a block command as chunks to consecutive registers. Chunks are
+ * as large as a transfer buffer, or SET-BURST for the device, and go
+ * out together in as few I2C_RDWR calls as the batch allows.
+ */
+static int rip_block(struct i2c_rip_run *run, int index, enum i2c_rip_op op,
+		     const struct i2c_rip_block *block, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	const int bus = run->bus;
+	const struct rip_bus *conn = &ctx->bus[bus];
+	const int reg_size = (op == I2C_RIP_8_WRITE_BLOCK ||
+			      op == I2C_RIP_8_READ_BLOCK ||
+			      op == I2C_RIP_8_VERIFY_BLOCK) ? 1 : 2;
+	const int max_reg = reg_size == 1 ? 0xFF : 0xFFFF;
+	int chunk = rip_burst_limit(ctx, bus, conn->addr, reg_size);
+	__u8 zeros[I2C_RIP_XFER_MAX];
+	__u8 reg[RIP_REG_MAX];
+	int failed = 0, offset, length;
+	const __u8 *bytes;
+
+	if (block->addr + block->length - 1 > max_reg) {
+		rip_err(run, "%sError: Block of %d bytes runs past register 0x%x\n",
+			line, block->length, max_reg);
+		return 0;
+	}
+	if (rip_op_is_write(op) && !rip_reconcile(run, index, line) &&
+	    !ctx->supress)
+		return 0;
+	memset(zeros, 0, sizeof(zeros));
+
+	for (offset = 0; offset < block->length; offset += chunk) {
+		length = block->length - offset;
+		if (length > chunk)
+			length = chunk;
+		bytes = block->offset >= 0 ?
+			&run->payload[block->offset + offset] : zeros;
+		rip_reg_bytes(reg, block->addr + offset, reg_size);
+
+		if (rip_op_is_write(op) &&
+		    rip_shadow_elide(run, index, op, bus, conn->addr, reg,
+				     reg_size, bytes, length, 0))
+			continue;
+
+		if (rip_batch_full(&run->batch, op) &&
+		    !rip_batch_flush(run)) {
+			failed = 1;
+			if (!ctx->supress)
+				return 0;
+		}
+
+		if (!rip_batch_add(run, index, bus, conn->file, conn->addr, op,
+				   reg, reg_size, bytes, length)) {
+			rip_log_failure(run, line, op, bus, conn->addr);
+			return 0;
+		}
+	}
+
+	/* Batched writes and reads may wait for the next command, verify
+	   results may not */
+	if ((!(ctx->flags & I2C_RIP_BATCH) || rip_op_is_verify(op)) &&
+	    !rip_batch_flush(run))
+		failed = 1;
+	return !failed;
+}
+
+/* Maps a whole file read only, NULL when it is empty */
+static __u8 *rip_map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	*size = st.st_size;
+	return map;
+}
+
+/* VERIFY-FILE, the file is read back and CRCs are compared */
+static int rip_verify_file(struct i2c_rip_run *run, enum i2c_rip_op op,
+			   const struct i2c_rip_file *file, const char *path,
+			   const __u8 *bytes, size_t size, int reg_size,
+			   int chunk, const char *line)
+{
+	const struct rip_bus *conn = &run->ctx->bus[run->bus];
+	__u32 expected_crc, crc = 0;
+	long mismatch;
+
+	expected_crc = rip_crc32(run->ctx, bytes, size);
+	mismatch = rip_file_read_back(run, conn->file, conn->addr, file->addr,
+				      reg_size, chunk, bytes, size, &crc);
+	if (mismatch < 0) {
+		rip_err(run, "%sError: Sending messages failed: %s\n", line,
+			strerror((int)-mismatch));
+		rip_log_failure(run, line, op, run->bus, conn->addr);
+		return 0;
+	}
+	if (crc != expected_crc) {
+		rip_err(run, "%sError: Verify file %s FAILED, CRC32 0x%08x expected 0x%08x, first difference at register 0x%lx\n",
+			line, path, crc, expected_crc, file->addr + mismatch);
+		return 0;
+	}
+	rip_msg(run, "%sVerify file %s PASSED, %zu bytes from 0x%x, CRC32 0x%08x\n",
+		line, path, size, file->addr, crc);
+	return 1;
+}
+
+/*
+ * Streams a binary file to consecutive registers, or reads it back and
+ * checks it. The file is mapped, never copied. Chunks are the [chunk]
+ * size of the command, else as large as the transfer buffer or
+ * SET-BURST; with I2C_RIP_BATCH several chunks share an I2C_RDWR call.
+ */
+static int rip_file(struct i2c_rip_run *run, int index, enum i2c_rip_op op,
+		    const struct i2c_rip_file *file, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	const int bus = run->bus;
+	const struct rip_bus *conn = &ctx->bus[bus];
+	const char *path = (const char *)&run->payload[file->path];
+	const int reg_size = (op == I2C_RIP_8_WRITE_FILE ||
+			      op == I2C_RIP_8_VERIFY_FILE) ? 1 : 2;
+	const int max_reg = reg_size == 1 ? 0xFF : 0xFFFF;
+	int chunk = file->chunk;
+	int failed = 0, nelided = 0, length;
+	__u8 reg[RIP_REG_MAX];
+	size_t size = 0, offset;
+	__u8 *map;
+
+	if (chunk == 0)
+		chunk = rip_burst_limit(ctx, bus, conn->addr, reg_size);
+	if (chunk > I2C_RIP_XFER_MAX - 1 - reg_size)
+		chunk = I2C_RIP_XFER_MAX - 1 - reg_size;
+
+	map = rip_map_file(path, &size);
+	if (!map) {
+		rip_err(run, "%sError: Unable to map file %s\n", line, path);
+		return 0;
+	}
+	if (file->addr + size - 1 > (size_t)max_reg) {
+		rip_err(run, "%sError: File %s of %zu bytes does not fit from register 0x%x\n",
+			line, path, size, file->addr);
+		munmap(map, size);
+		return 0;
+	}
+
+	if (op == I2C_RIP_8_VERIFY_FILE || op == I2C_RIP_16_VERIFY_FILE) {
+		failed = !rip_verify_file(run, op, file, path, map, size,
+					  reg_size, chunk, line);
+		munmap(map, size);
+		return !failed;
+	}
+
+	if (!rip_reconcile(run, index, line) && !ctx->supress)
+		goto out;
+
+	/* Earlier transfers are logged before the file */
+	if (run->batch.npending > 0 && !rip_batch_flush(run) && !ctx->supress)
+		goto out;
+
+	rip_msg(run, "%sWriting file %s, %zu bytes from 0x%x in %d byte chunks\n",
+		line, path, size, file->addr, chunk);
+	for (offset = 0; offset < size; offset += chunk) {
+		length = size - offset > (size_t)chunk ? chunk :
+			 (int)(size - offset);
+		rip_reg_bytes(reg, file->addr + (int)offset, reg_size);
+
+		if (rip_shadow_elide(run, index, op, bus, conn->addr, reg,
+				     reg_size, &map[offset], length, 1)) {
+			nelided++;
+			continue;
+		}
+
+		/* Without I2C_RIP_BATCH every chunk is its own call */
+		if (run->batch.npending > 0 &&
+		    (!(ctx->flags & I2C_RIP_BATCH) ||
+		     rip_batch_full(&run->batch, op)) &&
+		    !rip_batch_flush(run)) {
+			failed = 1;
+			if (!ctx->supress)
+				break;
+		}
+
+		if (!rip_batch_add(run, index, bus, conn->file, conn->addr, op,
+				   reg, reg_size, &map[offset], length)) {
+			rip_log_failure(run, line, op, bus, conn->addr);
+			failed = 1;
+			break;
+		}
+		run->batch.pending[run->batch.npending - 1].no_log = 1;
+	}
+
+	/* Chunks point into the mapping, they go out before it is unmapped */
+	if (run->batch.npending > 0 && !rip_batch_flush(run))
+		failed = 1;
+	if (nelided > 0)
+		rip_msg(run, "%s%d chunk(s) unchanged\n", line, nelided);
+	munmap(map, size);
+	return !failed;
+
+out:
+	munmap(map, size);
+	return 0;
+}
+
+/* Loops */
+
+/* LOOP, checks the body and starts the schedule, the first iteration
+   runs now */
+static int rip_loop_start(struct i2c_rip_run *run, int index,
+			  const struct i2c_rip_loop *loop, const char *line)
+{
+	const struct i2c_rip_ctx *ctx = run->ctx;
+	int end = index + 1;
+	int r;
+
+	if (loop->period_us <= 0 || loop->count <= 0) {
+		rip_err(run, "%sError: Invalid loop of %d x %dus\n", line,
+			loop->count, loop->period_us);
+		return 0;
+	}
+	if (run->loop_first >= 0) {
+		rip_err(run, "%sError: Loops can not be nested\n", line);
+		return 0;
+	}
+	while (end < ctx->ncmds && ctx->cmds[end].op != I2C_RIP_END_LOOP &&
+	       ctx->cmds[end].op != I2C_RIP_LOOP)
+		end++;
+	if (end >= ctx->ncmds || ctx->cmds[end].op != I2C_RIP_END_LOOP) {
+		rip_err(run, "%sError: LOOP without END-LOOP\n", line);
+		return 0;
+	}
+
+	run->loop_first = index + 1;
+	run->loop_iteration = 0;
+	run->loop_missed = 0;
+	memset(&run->loop_late, 0, sizeof(run->loop_late));
+	/* The default 50us timer slack would show up as jitter on every
+	   iteration, the thread gets its own back when the loop ends */
+	r = prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+	if (r >= 0 && prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == 0) {
+		run->loop_old_slack = (unsigned long)r;
+		run->loop_slack = 1;
+	}
+	run->loop_start_ns = rip_now();
+	rip_msg(run, "%sLoop of %d x %dus\n", line, loop->count,
+		loop->period_us);
+	return 1;
+}
+
+/* Ends the running loop, also when a command in its body failed */
+static void rip_loop_end(struct i2c_rip_run *run)
+{
+	if (run->loop_slack)
+		prctl(PR_SET_TIMERSLACK, run->loop_old_slack, 0UL, 0UL, 0UL);
+	run->loop_slack = 0;
+	run->loop_first = -1;
+}
+
+/*
+ * END-LOOP, sleeps until the next iteration is due and moves index back
+ * to the start of the body. Deadlines are absolute, start + n * period,
+ * so time spent in the body does not add up; an iteration that is late
+ * already when the one before ends starts right away and counts as a
+ * missed deadline.
+ */
+static int rip_loop_next(struct i2c_rip_run *run, int *index,
+			 const char *line)
+{
+	const struct i2c_rip_loop *loop;
+	struct timespec ts;
+	__u64 deadline, now;
+
+	if (run->loop_first < 0) {
+		rip_err(run, "%sError: END-LOOP without LOOP\n", line);
+		return 0;
+	}
+	loop = &run->ctx->cmds[run->loop_first - 1].data.loop;
+
+	if (++run->loop_iteration >= loop->count) {
+		now = rip_now();
+		rip_msg(run, "%sLoop done, %d iterations in %.3f ms, late p50 %.1fus p99 %.1fus max %.1fus, missed %llu deadline(s)\n",
+			line, run->loop_iteration,
+			(now - run->loop_start_ns) / 1e6,
+			rip_hist_percentile(&run->loop_late, 50.0) / 1e3,
+			rip_hist_percentile(&run->loop_late, 99.0) / 1e3,
+			run->loop_late.max / 1e3,
+			(unsigned long long)run->loop_missed);
+		rip_loop_end(run);
+		return 1;
+	}
+
+	deadline = run->loop_start_ns +
+		   (__u64)run->loop_iteration * loop->period_us * 1000ULL;
+	now = rip_now();
+	if (now > deadline) {
+		run->loop_missed++;
+	} else {
+		ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+		ts.tv_nsec = (long)(deadline % 1000000000ULL);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+		rip_event(run->ctx, I2C_RIP_EVENT_SLEEP, I2C_RIP_END_LOOP,
+			  run->bus, -1, rip_now() - now, 0);
+		now = rip_now();
+	}
+	rip_hist_record(&run->loop_late, now - deadline);
+	*index = run->loop_first - 1;
+	return 1;
+}
+
+/* Commands */
+
+/* The active bus is open and has a device selected */
+static int rip_check_device(struct i2c_rip_run *run, const char *line)
+{
+	const struct i2c_rip_ctx *ctx = run->ctx;
+
+	if (run->bus < 0 || run->bus >= RIP_MAX_BUSSES ||
+	    !ctx->bus[run->bus].connected) {
+		rip_err(run, "%sError: Invalid Active Bus: Not Connected %d\n",
+			line, run->bus);
+		return 0;
+	}
+	if (ctx->bus[run->bus].addr == RIP_NO_SLAVE) {
+		rip_err(run, "%sError: Invalid slave address 0x%x\n", line,
+			ctx->bus[run->bus].addr);
+		return 0;
+	}
+	return 1;
+}
+
+static int rip_set_bus(struct i2c_rip_run *run, int bus, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+
+	if (bus < 0 || bus >= RIP_MAX_BUSSES) {
+		rip_err(run, "%sError: Invalid Bus selection: %d\n", line, bus);
+		return 0;
+	}
+	if (!ctx->bus[bus].connected &&
+	    !rip_bus_open(ctx, run->index, bus, line))
+		return 0;
+	if (rip_arbitrated(ctx) && !rip_arbiter_acquire(run, bus, line))
+		return 0;
+	run->bus = bus;
+	ctx->bus[bus].addr = RIP_NO_SLAVE;
+	rip_msg(run, "%sChanged I2cBus to bus %d\n", line, bus);
+	return 1;
+}
+
+static int rip_set_id(struct i2c_rip_run *run, int addr, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	struct rip_bus *conn;
+	int ret;
+
+	if (run->bus < 0 || run->bus >= RIP_MAX_BUSSES) {
+		rip_err(run, "%sError: Invalid Active Bus: Out of range %d\n",
+			line, run->bus);
+		return 0;
+	}
+	conn = &ctx->bus[run->bus];
+	if (!conn->connected) {
+		rip_err(run, "%sError: Invalid Active Bus: Not Connected %d\n",
+			line, run->bus);
+		return 0;
+	}
+	if (ctx->transport.set_slave) {
+		ret = ctx->transport.set_slave(ctx->transport_user, conn->file,
+					       addr);
+		if (ret < 0) {
+			rip_err(run, "%sError: Unable to set slave address 0x%x to bus %d: %s\n",
+				line, addr, run->bus, strerror(-ret));
+			conn->addr = RIP_NO_SLAVE;
+			return 0;
+		}
+	}
+	conn->addr = addr;
+	rip_msg(run, "%sChanged Slave addess %#x on bus %d\n", line,
+		conn->addr, run->bus);
+	return 1;
+}
+
+static int rip_volatile(struct i2c_rip_run *run,
+			const struct i2c_rip_range *range, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	struct rip_shadow *shadow;
+	int r;
+
+	if (range->first < 0 || range->last < range->first ||
+	    range->last >= RIP_REG_SPACE) {
+		rip_err(run, "%sError: Invalid volatile range 0x%x-0x%x\n",
+			line, range->first, range->last);
+		return 0;
+	}
+	if (run->bus < 0 || run->bus >= RIP_MAX_BUSSES ||
+	    ctx->bus[run->bus].addr == RIP_NO_SLAVE) {
+		rip_err(run, "%sError: Volatile range needs a device (SET-BUS, SET-ID)\n",
+			line);
+		return 0;
+	}
+	/* Only the shadow registers use it */
+	if (ctx->flags & I2C_RIP_SHADOW) {
+		shadow = rip_shadow_device(ctx, run->bus,
+					   ctx->bus[run->bus].addr);
+		if (!shadow) {
+			rip_err(run, "Error: Memory allocation failed\n");
+			return 0;
+		}
+		for (r = range->first; r <= range->last; r++) {
+			RIP_BIT_SET(shadow->vol, r);
+			RIP_BIT_CLEAR(shadow->known, r);
+		}
+	}
+	rip_msg(run, "%sVolatile registers 0x%x-0x%x\n", line, range->first,
+		range->last);
+	return 1;
+}
+
+static int rip_log_to_file(struct i2c_rip_run *run, int enable,
+			   const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+
+	ctx->log_to_file = 0;
+	if (enable) {
+		if (!ctx->log_file) {
+			ctx->log_file = fopen(RIP_LOG_FILE_NAME, "w");
+			if (!ctx->log_file) {
+				rip_err(run, "%sError: LogFile: %s could not be opened\n",
+					line, RIP_LOG_FILE_NAME);
+				return 1;
+			}
+		}
+		ctx->log_to_file = 1;
+		return 1;
+	}
+	rip_msg(run, "%sLogging to file %s: %s\n", line, RIP_LOG_FILE_NAME,
+		"Disabled");
+	return 1;
+}
+
+/* WB, WW, RB, RW, VB and VW */
+static int rip_transfer(struct i2c_rip_run *run, int index,
+			const struct i2c_rip_cmd *cmd, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	const union i2c_rip_data *data = &cmd->data;
+	const enum i2c_rip_op op = cmd->op;
+	__u8 bytes[2], reg[RIP_REG_MAX];
+	int reg_size, size;
+	struct rip_bus *conn;
+
+	if (run->bus < 0 || run->bus >= RIP_MAX_BUSSES) {
+		rip_err(run, "%sError: Invalid Active Bus: Out of range 0x%x\n",
+			line, run->bus);
+		return 0;
+	}
+	conn = &ctx->bus[run->bus];
+	if (!conn->connected) {
+		rip_err(run, "%sError: Invalid Active Bus: Not Connected 0x%x\n",
+			line, run->bus);
+		return 0;
+	}
+	if (conn->addr == RIP_NO_SLAVE) {
+		rip_err(run, "%sError: Invalid slave address 0x%x\n", line,
+			conn->addr);
+		return 0;
+	}
+
+	switch (op) {
+	case I2C_RIP_8_WRITE_BYTE:
+	case I2C_RIP_8_READ_BYTE:
+	case I2C_RIP_8_VERIFY_BYTE:
+		reg_size = 1;
+		size = 1;
+		rip_reg_bytes(reg, data->byte8.addr, reg_size);
+		bytes[0] = data->byte8.data;
+		break;
+	case I2C_RIP_8_WRITE_WORD:
+	case I2C_RIP_8_READ_WORD:
+	case I2C_RIP_8_VERIFY_WORD:
+		reg_size = 1;
+		size = 2;
+		rip_reg_bytes(reg, data->word8.addr, reg_size);
+		bytes[0] = (__u8)((data->word8.data >> 8) & 0xFF);
+		bytes[1] = (__u8)(data->word8.data & 0xFF);
+		break;
+	case I2C_RIP_16_WRITE_BYTE:
+	case I2C_RIP_16_READ_BYTE:
+	case I2C_RIP_16_VERIFY_BYTE:
+		reg_size = 2;
+		size = 1;
+		rip_reg_bytes(reg, data->byte16.addr, reg_size);
+		bytes[0] = data->byte16.data;
+		break;
+	case I2C_RIP_16_WRITE_WORD:
+	case I2C_RIP_16_READ_WORD:
+	case I2C_RIP_16_VERIFY_WORD:
+		reg_size = 2;
+		size = 2;
+		rip_reg_bytes(reg, data->word16.addr, reg_size);
+		bytes[0] = (__u8)((data->word16.data >> 8) & 0xFF);
+		bytes[1] = (__u8)(data->word16.data & 0xFF);
+		break;
+	default:
+		rip_err(run, "%sError: Invalid Write/Read/Verify command\n",
+			line);
+		return 0;
+	}
+
+	if (rip_op_is_write(op)) {
+		if (!rip_reconcile(run, index, line) && !ctx->supress)
+			return 0;
+		/* Writes that would not change a known value are left out */
+		if (rip_shadow_elide(run, index, op, run->bus, conn->addr, reg,
+				     reg_size, bytes, size, 0))
+			return 1;
+	}
+
+	/* Make room for this transfer */
+	if (rip_batch_full(&run->batch, op) && !rip_batch_flush(run) &&
+	    !ctx->supress)
+		return 0;
+
+	if (!rip_batch_add(run, index, run->bus, conn->file, conn->addr, op,
+			   reg, reg_size, bytes, size)) {
+		rip_log_failure(run, line, op, run->bus, conn->addr);
+		return 0;
+	}
+
+	/* Verify results decide whether the script goes on */
+	if (!(ctx->flags & I2C_RIP_BATCH) || rip_op_is_verify(op))
+		return rip_batch_flush(run);
+	return 1;
+}
+
+/* Runs the command at *index, END-LOOP moves it back */
+static int rip_cmd(struct i2c_rip_run *run, int *index, const char *line)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	const struct i2c_rip_cmd *cmd = &ctx->cmds[*index];
+	const union i2c_rip_data *data = &cmd->data;
+	__u64 start = 0;
+
+	switch (cmd->op) {
+	case I2C_RIP_SET_BUS:
+		return rip_set_bus(run, data->single, line);
+
+	case I2C_RIP_SET_ID:
+		return rip_set_id(run, data->single, line);
+
+	case I2C_RIP_SYNC:
+		rip_msg(run, "%sSync\n", line);
+		return 1;
+
+	case I2C_RIP_POLL_INTERVAL:
+		if (data->interval.initial_us <= 0 ||
+		    data->interval.max_us < data->interval.initial_us) {
+			rip_err(run, "%sError: Invalid Poll interval %d-%dus.\n",
+				line, data->interval.initial_us,
+				data->interval.max_us);
+			return 0;
+		}
+		ctx->poll_us = data->interval.initial_us;
+		ctx->poll_max_us = data->interval.max_us;
+		rip_msg(run, "%sPoll interval %d-%dus\n", line, ctx->poll_us,
+			ctx->poll_max_us);
+		return 1;
+
+	case I2C_RIP_VOLATILE:
+		return rip_volatile(run, &data->range, line);
+
+	case I2C_RIP_8_POLL:
+	case I2C_RIP_16_POLL:
+		if (data->poll.timeout_ms <= 0) {
+			rip_err(run, "%sError: Invalid Poll timeout %d.\n",
+				line, data->poll.timeout_ms);
+			return 0;
+		}
+		if (!rip_check_device(run, line))
+			return 0;
+		return rip_poll(run, line, ctx->bus[run->bus].file,
+				ctx->bus[run->bus].addr, &data->poll,
+				cmd->op == I2C_RIP_8_POLL ? 1 : 2);
+
+	case I2C_RIP_SET_BURST:
+		/* Merged writes are split already, blocks split at run time */
+		if (run->bus >= 0 && run->bus < RIP_MAX_BUSSES &&
+		    ctx->bus[run->bus].addr < RIP_MAX_SLAVES)
+			ctx->burst[run->bus][ctx->bus[run->bus].addr] =
+				data->single;
+		rip_msg(run, "%sMax burst %d bytes\n", line, data->single);
+		return 1;
+
+	case I2C_RIP_8_WRITE_BLOCK:
+	case I2C_RIP_16_WRITE_BLOCK:
+	case I2C_RIP_8_READ_BLOCK:
+	case I2C_RIP_16_READ_BLOCK:
+	case I2C_RIP_8_VERIFY_BLOCK:
+	case I2C_RIP_16_VERIFY_BLOCK:
+		if (!rip_check_device(run, line))
+			return 0;
+		return rip_block(run, *index, cmd->op, &data->block, line);
+
+	case I2C_RIP_8_WRITE_FILE:
+	case I2C_RIP_16_WRITE_FILE:
+	case I2C_RIP_8_VERIFY_FILE:
+	case I2C_RIP_16_VERIFY_FILE:
+		if (!rip_check_device(run, line))
+			return 0;
+		return rip_file(run, *index, cmd->op, &data->file, line);
+
+	case I2C_RIP_LOOP:
+		return rip_loop_start(run, *index, &data->loop, line);
+
+	case I2C_RIP_END_LOOP:
+		return rip_loop_next(run, index, line);
+
+	case I2C_RIP_DELAY:
+		if (data->single <= 0) {
+			rip_err(run, "%sError: Invalid Delay time %d.\n", line,
+				data->single);
+			return 0;
+		}
+		rip_msg(run, "%sDelay of %dms\n", line, data->single);
+		if (rip_timed(ctx))
+			start = rip_now();
+		usleep(data->single * 1000);
+		if (rip_timed(ctx))
+			rip_event(ctx, I2C_RIP_EVENT_SLEEP, cmd->op, run->bus,
+				  -1, rip_now() - start, 0);
+		return 1;
+
+	case I2C_RIP_SUPRESS_ERRORS:
+		ctx->supress = data->single != 0;
+		if (!ctx->supress)
+			rip_msg(run, "%sSupress Errors: %s\n", line,
+				"Disabled");
+		return 1;
+
+	case I2C_RIP_LOG_TO_FILE:
+		return rip_log_to_file(run, data->single, line);
+
+	case I2C_RIP_LOG_TO_TERM:
+		ctx->log_to_term = data->single != 0;
+		if (!ctx->log_to_term)
+			rip_msg(run, "%sLogging to Term: %s\n", line,
+				"Disabled");
+		return 1;
+
+	default:
+		break;
+	}
+
+	if (rip_op_is_transfer(cmd->op))
+		return rip_transfer(run, *index, cmd, line);
+	rip_err(run, "%sError: Invalid Write/Read/Verify command\n", line);
+	return 0;
+}
+
+/* Context */
+
+static void rip_ctx_unload(struct i2c_rip_ctx *ctx)
+{
+	free(ctx->own_cmds);
+	free(ctx->own_lines);
+	ctx->own_cmds = NULL;
+	ctx->own_lines = NULL;
+	ctx->own_size = 0;
+	i2c_rip_arena_free(&ctx->arena);
+	ctx->cmds = NULL;
+	ctx->lines = NULL;
+	ctx->ncmds = 0;
+	ctx->payload = NULL;
+	ctx->streams = NULL;
+}
+
+struct i2c_rip_ctx *i2c_rip_ctx_new(void)
+{
+	struct i2c_rip_ctx *ctx;
+	__u32 n, c;
+	int bus, k;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+	for (bus = 0; bus < RIP_MAX_BUSSES; bus++) {
+		ctx->bus[bus].file = -1;
+		ctx->bus[bus].addr = RIP_NO_SLAVE;
+	}
+	ctx->transport = rip_dev_transport;
+	i2c_rip_ctx_reset(ctx);
+
+	for (n = 0; n < 256; n++) {
+		c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		ctx->crc_table[n] = c;
+	}
+	return ctx;
+}
+
+void i2c_rip_ctx_free(struct i2c_rip_ctx *ctx)
+{
+	int bus, addr;
+
+	if (!ctx)
+		return;
+	i2c_rip_ctx_close(ctx);
+	for (bus = 0; bus < RIP_MAX_BUSSES; bus++)
+		for (addr = 0; addr < RIP_MAX_SLAVES; addr++)
+			free(ctx->shadow[bus][addr]);
+	rip_ctx_unload(ctx);
+	if (ctx->log_file)
+		fclose(ctx->log_file);
+	free(ctx);
+}
+
+void i2c_rip_ctx_set_ops(struct i2c_rip_ctx *ctx,
+			 const struct i2c_rip_ops *ops, void *user)
+{
+	if (ops)
+		ctx->ops = *ops;
+	else
+		memset(&ctx->ops, 0, sizeof(ctx->ops));
+	ctx->user = user;
+}
+
+void i2c_rip_ctx_set_transport(struct i2c_rip_ctx *ctx,
+			       const struct i2c_rip_transport *transport,
+			       void *user)
+{
+	i2c_rip_ctx_close(ctx);
+	ctx->transport = transport ? *transport : rip_dev_transport;
+	ctx->transport_user = user;
+}
+
+void i2c_rip_ctx_set_flags(struct i2c_rip_ctx *ctx, unsigned int flags)
+{
+	if (flags & I2C_RIP_RECONCILE)
+		flags |= I2C_RIP_SHADOW;
+	ctx->flags = flags;
+}
+
+void i2c_rip_ctx_set_priority(struct i2c_rip_ctx *ctx, int priority)
+{
+	ctx->priority = priority;
+}
+
+void i2c_rip_ctx_set_script(struct i2c_rip_ctx *ctx,
+			    const struct i2c_rip_cmd *cmds, const int *lines,
+			    int ncmds, const __u8 *payload)
+{
+	rip_ctx_unload(ctx);
+	ctx->cmds = cmds;
+	ctx->lines = lines;
+	ctx->ncmds = ncmds;
+	ctx->payload = payload;
+}
+
+int i2c_rip_ctx_ncmds(const struct i2c_rip_ctx *ctx)
+{
+	return ctx->ncmds;
+}
+
+void i2c_rip_ctx_set_streams(struct i2c_rip_ctx *ctx, const int *streams)
+{
+	ctx->streams = streams;
+}
+
+void i2c_rip_ctx_reset(struct i2c_rip_ctx *ctx)
+{
+	int bus, addr;
+
+	ctx->supress = 0;
+	ctx->log_to_term = 1;
+	ctx->log_to_file = 0;
+	ctx->poll_us = RIP_POLL_US;
+	ctx->poll_max_us = RIP_POLL_MAX_US;
+	for (bus = 0; bus < RIP_MAX_BUSSES; bus++)
+		for (addr = 0; addr < RIP_MAX_SLAVES; addr++)
+			ctx->burst[bus][addr] = I2C_RIP_BURST_DEFAULT;
+}
+
+static int rip_ctx_append(struct i2c_rip_ctx *ctx,
+			  const struct i2c_rip_cmd *cmd, int line)
+{
+	struct i2c_rip_cmd *cmds;
+	int new_size, *lines;
+
+	if (ctx->ncmds == ctx->own_size) {
+		new_size = ctx->own_size > 0 ? ctx->own_size * 2 : 256;
+		cmds = realloc(ctx->own_cmds, sizeof(*cmds) * new_size);
+		if (!cmds)
+			return -ENOMEM;
+		ctx->own_cmds = cmds;
+		lines = realloc(ctx->own_lines, sizeof(*lines) * new_size);
+		if (!lines)
+			return -ENOMEM;
+		ctx->own_lines = lines;
+		ctx->own_size = new_size;
+	}
+	ctx->own_cmds[ctx->ncmds] = *cmd;
+	ctx->own_lines[ctx->ncmds++] = line;
+	return 0;
+}
+
+/* Parses a script into the context, replacing the one it held; the
+   context is empty when a line fails */
+int i2c_rip_ctx_load(struct i2c_rip_ctx *ctx, const char *text, size_t size)
+{
+	char error[I2C_RIP_LOG_FORMAT_MAX];
+	const char *end = text + size;
+	const char *pos = text;
+	struct i2c_rip_cmd cmd;
+	const char *eol;
+	int line = 0, ret;
+
+	rip_ctx_unload(ctx);
+	while (pos <= end) {
+		eol = memchr(pos, '\n', end - pos);
+		if (!eol)
+			eol = end;
+		line++;
+
+		ret = i2c_rip_parse_line(pos, (int)(eol - pos), &cmd,
+					 &ctx->arena, error, sizeof(error));
+		if (ret < 0) {
+			if (error[0] != '\0')
+				rip_log(ctx, 0, 1, "%s\n", error);
+			rip_log(ctx, 0, 1,
+				"Error: Failed to parse line: %d: %.*s\n",
+				line, (int)(eol - pos), pos);
+			rip_ctx_unload(ctx);
+			return ret;
+		}
+		if (cmd.valid) {
+			ret = rip_ctx_append(ctx, &cmd, line);
+			if (ret < 0) {
+				rip_log(ctx, 0, 1,
+					"Error: Memory allocation failed\n");
+				rip_ctx_unload(ctx);
+				return ret;
+			}
+		}
+		pos = eol + 1;
+	}
+	ctx->cmds = ctx->own_cmds;
+	ctx->lines = ctx->own_lines;
+	ctx->payload = ctx->arena.data;
+	return 0;
+}
+
+int i2c_rip_ctx_take_script(struct i2c_rip_ctx *ctx, struct i2c_rip_cmd **cmds,
+			    int **lines, struct i2c_rip_arena *payload)
+{
+	int ncmds = ctx->ncmds;
+
+	*cmds = ctx->own_cmds;
+	*lines = ctx->own_lines;
+	*payload = ctx->arena;
+	ctx->own_cmds = NULL;
+	ctx->own_lines = NULL;
+	memset(&ctx->arena, 0, sizeof(ctx->arena));
+	rip_ctx_unload(ctx);
+	return ncmds;
+}
+
+int i2c_rip_ctx_lock_bus(struct i2c_rip_ctx *ctx, int bus, int index)
+{
+	char line[16];
+	int ret;
+
+	if (!rip_arbitrated(ctx) || bus < 0 || bus >= RIP_MAX_BUSSES ||
+	    ctx->bus[bus].locked)
+		return 0;
+	rip_line_str(ctx, index, line, sizeof(line));
+	if (!ctx->bus[bus].connected && !rip_bus_open(ctx, index, bus, line))
+		return -EIO;
+	ret = rip_arbiter_lock(ctx, bus, 1);
+	if (ret < 0)
+		rip_log(ctx, index, 1, "%sError: Unable to lock bus %d: %s\n",
+			line, bus, strerror(-ret));
+	return ret;
+}
+
+/* Other jobs may use the busses before the next run, so their shadow
+   registers go too */
+void i2c_rip_ctx_release(struct i2c_rip_ctx *ctx)
+{
+	int bus;
+
+	for (bus = 0; bus < RIP_MAX_BUSSES; bus++) {
+		if (rip_arbitrated(ctx))
+			rip_arbiter_unlock(ctx, bus);
+		rip_shadow_forget_bus(ctx, bus);
+	}
+}
+
+/* Closes the busses, the next run opens them again */
+void i2c_rip_ctx_close(struct i2c_rip_ctx *ctx)
+{
+	int bus;
+
+	i2c_rip_ctx_release(ctx);
+	for (bus = 0; bus < RIP_MAX_BUSSES; bus++) {
+		if (ctx->bus[bus].connected)
+			ctx->transport.close(ctx->transport_user,
+					     ctx->bus[bus].file);
+		ctx->bus[bus].connected = 0;
+		ctx->bus[bus].file = -1;
+		ctx->bus[bus].addr = RIP_NO_SLAVE;
+	}
+}
+
+int i2c_rip_ctx_run(struct i2c_rip_ctx *ctx)
+{
+	struct i2c_rip_run *run;
+	int ret;
+
+	run = i2c_rip_run_new(ctx);
+	if (!run)
+		return -ENOMEM;
+	ret = i2c_rip_run_cmds(run, 0, ctx->ncmds, I2C_RIP_ALL_STREAMS);
+	i2c_rip_run_free(run);
+	i2c_rip_ctx_release(ctx);
+	return ret;
+}
+
+/* Runs */
+
+struct i2c_rip_run *i2c_rip_run_new(struct i2c_rip_ctx *ctx)
+{
+	struct i2c_rip_run *run;
+
+	run = malloc(sizeof(*run));
+	if (!run)
+		return NULL;
+	run->ctx = ctx;
+	run->bus = I2C_RIP_NO_BUS;
+	run->stream = I2C_RIP_ALL_STREAMS;
+	run->segment = 0;
+	run->index = 0;
+	run->payload = ctx->payload;
+	run->hold = 0;
+	run->arbiter_next = 0;
+	run->loop_first = -1;
+	run->loop_slack = 0;
+	run->batch.nmsgs = 0;
+	run->batch.npending = 0;
+	return run;
+}
+
+void i2c_rip_run_free(struct i2c_rip_run *run)
+{
+	if (run->loop_first >= 0)
+		rip_loop_end(run);
+	free(run);
+}
+
+void i2c_rip_run_set_payload(struct i2c_rip_run *run, const __u8 *payload)
+{
+	run->payload = payload;
+}
+
+void i2c_rip_run_set_hold(struct i2c_rip_run *run, int hold)
+{
+	run->hold = hold;
+}
+
+int i2c_rip_run_pending(const struct i2c_rip_run *run)
+{
+	return run->batch.npending;
+}
+
+int i2c_rip_run_flush(struct i2c_rip_run *run)
+{
+	if (run->batch.npending > 0 && !rip_batch_flush(run) &&
+	    !run->ctx->supress)
+		return -EIO;
+	return 0;
+}
+
+/* Stops at the first error unless errors are supressed */
+int i2c_rip_run_cmds(struct i2c_rip_run *run, int first, int last,
+		     int stream)
+{
+	struct i2c_rip_ctx *ctx = run->ctx;
+	enum i2c_rip_op op;
+	__u64 start = 0;
+	char line[16];
+	int i, ok = 1;
+
+	run->stream = stream;
+	if (stream != I2C_RIP_ALL_STREAMS)
+		run->bus = stream;
+	run->segment = first;
+	for (i = first; i < last; i++) {
+		op = ctx->cmds[i].op;
+		if (stream != I2C_RIP_ALL_STREAMS && ctx->streams[i] != stream)
+			continue;
+
+		run->index = i;
+		rip_line_str(ctx, i, line, sizeof(line));
+
+		/* Anything other than a transfer ends the current batch */
+		if (!rip_op_is_transfer(op) && run->batch.npending > 0 &&
+		    !rip_batch_flush(run) && !ctx->supress) {
+			ok = 0;
+			break;
+		}
+
+		/* Higher priority jobs get the bus between commands, never
+		   inside a batch */
+		if (rip_arbitrated(ctx) &&
+		    ctx->priority < I2C_BUS_PRIORITY_MAX &&
+		    run->batch.npending == 0 && !rip_arbiter_yield(run, line)) {
+			ok = 0;
+			break;
+		}
+
+		/* Transfers are timed when they go out, files per chunk */
+		if (rip_timed(ctx))
+			start = rip_now();
+		ok = rip_cmd(run, &i, line);
+		if (ok && rip_timed(ctx) && !rip_op_is_transfer(op) &&
+		    !i2c_rip_op_is_file(op))
+			rip_event(ctx, I2C_RIP_EVENT_CMD, op, run->bus, -1,
+				  rip_now() - start, 0);
+
+		if (rip_op_ends_segment(op))
+			run->segment = i + 1;
+		if (!ok && !ctx->supress)
+			break;
+		ok = 1;
+	}
+
+	/* Whatever is still queued comes before any failed command */
+	if (run->batch.npending > 0 && !run->hold && !rip_batch_flush(run) &&
+	    !ctx->supress)
+		ok = 0;
+
+	return ok ? 0 : -EIO;
+}
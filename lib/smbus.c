@@ -11,13 +11,24 @@
     (at your option) any later version.
 */
 
+#include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <i2c/smbus.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
+#ifdef __PCLMUL__
+#include <wmmintrin.h>
+#endif
+#include <i2c/stats.h>
+#include "stats.h"
 
 /* Compatibility defines */
 #ifndef I2C_SMBUS_I2C_BLOCK_BROKEN
@@ -26,6 +37,9 @@
 #ifndef I2C_FUNC_SMBUS_PEC
 #define I2C_FUNC_SMBUS_PEC I2C_FUNC_SMBUS_HWPEC_CALC
 #endif
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS 42
+#endif
 
 __s32 i2c_smbus_access(int file, char read_write, __u8 command,
 		       int size, union i2c_smbus_data *data)
@@ -38,12 +52,33 @@ __s32 i2c_smbus_access(int file, char read_write, __u8 command,
 	args.size = size;
 	args.data = data;
 
+	if (i2c_stats_files)
+		return i2c_stats_smbus(file, &args);
+
 	err = ioctl(file, I2C_SMBUS, &args);
 	if (err == -1)
 		err = -errno;
 	return err;
 }
 
+/* Returns the number of transferred messages */
+__s32 i2c_rdwr_access(int file, struct i2c_msg *msgs, int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+	__s32 err;
+
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = nmsgs;
+
+	if (i2c_stats_files)
+		return i2c_stats_rdwr(file, &rdwr);
+
+	err = ioctl(file, I2C_RDWR, &rdwr);
+	if (err == -1)
+		err = -errno;
+	return err;
+}
+
 
 __s32 i2c_smbus_write_quick(int file, __u8 value)
 {
@@ -212,3 +247,724 @@ __s32 i2c_smbus_block_process_call(int file, __u8 command, __u8 length,
 		values[i-1] = data.block[i];
 	return data.block[0];
 }
+
+/*
+ * Packet error checking. The PEC is a CRC-8 with polynomial
+ * x^8 + x^2 + x + 1 over every byte of the transaction, address bytes
+ * included, that the kernel only computes for I2C_SMBUS transfers.
+ */
+
+static const __u8 i2c_smbus_crc8[256] = {
+	0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+	0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+	0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65,
+	0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d,
+	0xe0, 0xe7, 0xee, 0xe9, 0xfc, 0xfb, 0xf2, 0xf5,
+	0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+	0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85,
+	0xa8, 0xaf, 0xa6, 0xa1, 0xb4, 0xb3, 0xba, 0xbd,
+	0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2,
+	0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea,
+	0xb7, 0xb0, 0xb9, 0xbe, 0xab, 0xac, 0xa5, 0xa2,
+	0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+	0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32,
+	0x1f, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0d, 0x0a,
+	0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42,
+	0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a,
+	0x89, 0x8e, 0x87, 0x80, 0x95, 0x92, 0x9b, 0x9c,
+	0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+	0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec,
+	0xc1, 0xc6, 0xcf, 0xc8, 0xdd, 0xda, 0xd3, 0xd4,
+	0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c,
+	0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44,
+	0x19, 0x1e, 0x17, 0x10, 0x05, 0x02, 0x0b, 0x0c,
+	0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+	0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b,
+	0x76, 0x71, 0x78, 0x7f, 0x6a, 0x6d, 0x64, 0x63,
+	0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b,
+	0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13,
+	0xae, 0xa9, 0xa0, 0xa7, 0xb2, 0xb5, 0xbc, 0xbb,
+	0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+	0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb,
+	0xe6, 0xe1, 0xe8, 0xef, 0xfa, 0xfd, 0xf4, 0xf3,
+};
+
+#ifdef __PCLMUL__
+/* floor(x^72 / P) without its x^64 term */
+#define I2C_SMBUS_PEC_MU	0x07156a166329dd13ULL
+
+/*
+ * Eight bytes at a time by Barrett reduction: with the CRC so far added
+ * to the first byte, v(x) * x^8 mod P is the low byte of q(x) * P(x) for
+ * q(x) = v(x) * mu(x) / x^64, which takes one carry-less multiply.
+ */
+static __u8 i2c_smbus_pec_clmul(__u8 crc, const __u8 *data, size_t len)
+{
+	__m128i prod;
+	__u64 v, q;
+
+	for (; len >= 8; data += 8, len -= 8) {
+		memcpy(&v, data, 8);
+		v = be64toh(v) ^ ((__u64)crc << 56);
+		prod = _mm_clmulepi64_si128(_mm_cvtsi64_si128((long long)v),
+			_mm_cvtsi64_si128((long long)I2C_SMBUS_PEC_MU), 0x00);
+		q = v ^ (__u64)_mm_cvtsi128_si64(_mm_srli_si128(prod, 8));
+		crc = q ^ (q << 1) ^ (q << 2);
+	}
+	while (len--)
+		crc = i2c_smbus_crc8[crc ^ *data++];
+	return crc;
+}
+#endif
+
+/*
+ * Continues crc over len bytes of data, start with 0. Built with
+ * -mpclmul (or a -march that has it), long runs use carry-less multiply.
+ */
+__u8 i2c_smbus_pec(__u8 crc, const __u8 *data, size_t len)
+{
+#ifdef __PCLMUL__
+	if (len >= 16)
+		return i2c_smbus_pec_clmul(crc, data, len);
+#endif
+	while (len--)
+		crc = i2c_smbus_crc8[crc ^ *data++];
+	return crc;
+}
+
+/*
+ * SMBus 3 block transactions. The block is one I2C_RDWR message with
+ * the command and count in front, and a read lets the adapter take its
+ * length from the count byte (I2C_M_RECV_LEN), so up to 255 bytes move in
+ * one transaction. Adapters that cannot do plain I2C transfers get the
+ * SMBus 2 transaction instead, which only fits blocks of up to 32 bytes;
+ * it goes through the address set on the file, so addr is set first.
+ */
+
+static __s32 i2c_smbus3_fallback(int file, __u16 addr, __u8 length)
+{
+	if (length > I2C_SMBUS_BLOCK_MAX)
+		return -EOPNOTSUPP;
+	if (ioctl(file, I2C_SLAVE, addr) < 0)
+		return -errno;
+	return 0;
+}
+
+static __s32 i2c_smbus3_rdwr(int file, struct i2c_msg *msgs, int nmsgs)
+{
+	__s32 err;
+
+	err = i2c_rdwr_access(file, msgs, nmsgs);
+	return err < 0 ? err : 0;
+}
+
+/*
+ * i2c-dev wants room for I2C_SMBUS_BLOCK_MAX bytes past the count, and
+ * the adapter driver limits what it accepts; most still refuse more than
+ * 32 bytes with -EPROTO.
+ */
+static void i2c_smbus3_recv_msg(struct i2c_msg *msg, __u16 addr, __u8 *buf)
+{
+	msg->addr = addr;
+	msg->flags = I2C_M_RD | I2C_M_RECV_LEN;
+	msg->len = 1 + I2C_SMBUS3_BLOCK_MAX;
+	msg->buf = buf;
+	buf[0] = 1;		/* the count byte itself */
+}
+
+/* Returns the number of read bytes */
+__s32 i2c_smbus3_read_block_data(int file, __u16 addr, __u8 command,
+				 __u8 *values)
+{
+	__u8 buf[1 + I2C_SMBUS3_BLOCK_MAX];
+	struct i2c_msg msgs[2];
+	__s32 err;
+
+	msgs[0].addr = addr;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &command;
+	i2c_smbus3_recv_msg(&msgs[1], addr, buf);
+
+	err = i2c_smbus3_rdwr(file, msgs, 2);
+	if (err == -EOPNOTSUPP) {
+		err = i2c_smbus3_fallback(file, addr, 0);
+		if (err < 0)
+			return err;
+		return i2c_smbus_read_block_data(file, command, values);
+	}
+	if (err < 0)
+		return err;
+
+	memcpy(values, buf + 1, buf[0]);
+	return buf[0];
+}
+
+__s32 i2c_smbus3_write_block_data(int file, __u16 addr, __u8 command,
+				  __u8 length, const __u8 *values)
+{
+	__u8 buf[2 + I2C_SMBUS3_BLOCK_MAX];
+	struct i2c_msg msg;
+	__s32 err;
+
+	buf[0] = command;
+	buf[1] = length;
+	memcpy(buf + 2, values, length);
+	msg.addr = addr;
+	msg.flags = 0;
+	msg.len = 2 + length;
+	msg.buf = buf;
+
+	err = i2c_smbus3_rdwr(file, &msg, 1);
+	if (err == -EOPNOTSUPP) {
+		err = i2c_smbus3_fallback(file, addr, length);
+		if (err < 0)
+			return err;
+		return i2c_smbus_write_block_data(file, command, length,
+						  values);
+	}
+	return err;
+}
+
+/* Returns the number of read bytes */
+__s32 i2c_smbus3_block_process_call(int file, __u16 addr, __u8 command,
+				    __u8 length, __u8 *values)
+{
+	__u8 wbuf[2 + I2C_SMBUS3_BLOCK_MAX];
+	__u8 buf[1 + I2C_SMBUS3_BLOCK_MAX];
+	struct i2c_msg msgs[2];
+	__s32 err;
+
+	wbuf[0] = command;
+	wbuf[1] = length;
+	memcpy(wbuf + 2, values, length);
+	msgs[0].addr = addr;
+	msgs[0].flags = 0;
+	msgs[0].len = 2 + length;
+	msgs[0].buf = wbuf;
+	i2c_smbus3_recv_msg(&msgs[1], addr, buf);
+
+	err = i2c_smbus3_rdwr(file, msgs, 2);
+	if (err == -EOPNOTSUPP) {
+		err = i2c_smbus3_fallback(file, addr, length);
+		if (err < 0)
+			return err;
+		return i2c_smbus_block_process_call(file, command, length,
+						    values);
+	}
+	if (err < 0)
+		return err;
+
+	memcpy(values, buf + 1, buf[0]);
+	return buf[0];
+}
+
+/*
+ * Handles. Opening one queries the adapter functionality once and picks
+ * the primitives reads and writes of a register range will use: a single
+ * I2C_RDWR transfer if the adapter can do plain I2C, which needs no
+ * I2C_SLAVE either, else I2C block transactions of up to 32 bytes, else
+ * one byte at a time. The latter two rely on the device incrementing the
+ * register address, as a plain I2C transfer does. The slave address set
+ * on the file is remembered so setting it again costs no ioctl.
+ */
+
+enum i2c_handle_xfer {
+	I2C_HANDLE_XFER_NONE,
+	I2C_HANDLE_XFER_BYTE,
+	I2C_HANDLE_XFER_BLOCK,
+	I2C_HANDLE_XFER_RDWR,
+};
+
+struct i2c_handle {
+	int file;
+	int flags;
+	int addr;		/* -1 until set */
+	unsigned long funcs;
+	enum i2c_handle_xfer read_xfer;
+	enum i2c_handle_xfer write_xfer;
+};
+
+static enum i2c_handle_xfer i2c_handle_pick(unsigned long funcs,
+					    unsigned long block,
+					    unsigned long byte)
+{
+	if (funcs & I2C_FUNC_I2C)
+		return I2C_HANDLE_XFER_RDWR;
+	if (funcs & block)
+		return I2C_HANDLE_XFER_BLOCK;
+	if (funcs & byte)
+		return I2C_HANDLE_XFER_BYTE;
+	return I2C_HANDLE_XFER_NONE;
+}
+
+/* Returns NULL with errno set on failure */
+struct i2c_handle *i2c_handle_open(int i2cbus, int flags)
+{
+	struct i2c_handle *handle;
+	char filename[20];
+	int err;
+
+	handle = calloc(1, sizeof(*handle));
+	if (!handle)
+		return NULL;
+
+	snprintf(filename, sizeof(filename), "/dev/i2c/%d", i2cbus);
+	handle->file = open(filename, O_RDWR | O_CLOEXEC);
+	if (handle->file < 0 && (errno == ENOENT || errno == ENOTDIR)) {
+		snprintf(filename, sizeof(filename), "/dev/i2c-%d", i2cbus);
+		handle->file = open(filename, O_RDWR | O_CLOEXEC);
+	}
+	if (handle->file < 0) {
+		err = errno;
+		free(handle);
+		errno = err;
+		return NULL;
+	}
+
+	if (ioctl(handle->file, I2C_FUNCS, &handle->funcs) < 0) {
+		err = errno;
+		close(handle->file);
+		free(handle);
+		errno = err;
+		return NULL;
+	}
+
+	/* Not being counted is no reason to fail */
+	if (flags & I2C_HANDLE_STATS)
+		i2c_stats_attach(handle->file, i2cbus);
+
+	handle->flags = flags;
+	handle->addr = -1;
+	handle->read_xfer = i2c_handle_pick(handle->funcs,
+					    I2C_FUNC_SMBUS_READ_I2C_BLOCK,
+					    I2C_FUNC_SMBUS_READ_BYTE_DATA);
+	handle->write_xfer = i2c_handle_pick(handle->funcs,
+					     I2C_FUNC_SMBUS_WRITE_I2C_BLOCK,
+					     I2C_FUNC_SMBUS_WRITE_BYTE_DATA);
+	return handle;
+}
+
+void i2c_handle_close(struct i2c_handle *handle)
+{
+	if (!handle)
+		return;
+	if (handle->flags & I2C_HANDLE_STATS)
+		i2c_stats_detach(handle->file);
+	close(handle->file);
+	free(handle);
+}
+
+/*
+ * For the i2c_smbus_* functions. Setting the slave address on it directly
+ * leaves the handle believing in the old one.
+ */
+int i2c_handle_fd(const struct i2c_handle *handle)
+{
+	return handle->file;
+}
+
+unsigned long i2c_handle_funcs(const struct i2c_handle *handle)
+{
+	return handle->funcs;
+}
+
+__s32 i2c_handle_set_slave(struct i2c_handle *handle, __u16 addr)
+{
+	if (handle->addr == addr)
+		return 0;
+
+	if (ioctl(handle->file, (handle->flags & I2C_HANDLE_FORCE) ?
+		  I2C_SLAVE_FORCE : I2C_SLAVE, addr) < 0) {
+		handle->addr = -1;
+		return -errno;
+	}
+	handle->addr = addr;
+	i2c_stats_set_slave(handle->file, addr);
+	return 0;
+}
+
+/* Returns the number of read bytes */
+__s32 i2c_handle_read(struct i2c_handle *handle, __u16 addr, __u8 command,
+		      __u8 length, __u8 *values)
+{
+	struct i2c_msg msgs[2];
+	__s32 err;
+	int i, n;
+
+	if (handle->read_xfer == I2C_HANDLE_XFER_NONE)
+		return -EOPNOTSUPP;
+
+	if (handle->read_xfer == I2C_HANDLE_XFER_RDWR) {
+		msgs[0].addr = addr;
+		msgs[0].flags = 0;
+		msgs[0].len = 1;
+		msgs[0].buf = &command;
+		msgs[1].addr = addr;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].len = length;
+		msgs[1].buf = values;
+		err = i2c_rdwr_access(handle->file, msgs, 2);
+		if (err < 0)
+			return err;
+		return length;
+	}
+
+	err = i2c_handle_set_slave(handle, addr);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < length; i += n) {
+		if (handle->read_xfer == I2C_HANDLE_XFER_BLOCK) {
+			n = length - i;
+			if (n > I2C_SMBUS_BLOCK_MAX)
+				n = I2C_SMBUS_BLOCK_MAX;
+			err = i2c_smbus_read_i2c_block_data(handle->file,
+							    command + i, n,
+							    values + i);
+			if (err < 0)
+				return err;
+			if (err == 0)
+				return -EIO;
+			n = err;
+		} else {
+			err = i2c_smbus_read_byte_data(handle->file,
+						       command + i);
+			if (err < 0)
+				return err;
+			values[i] = err;
+			n = 1;
+		}
+	}
+	return length;
+}
+
+__s32 i2c_handle_write(struct i2c_handle *handle, __u16 addr, __u8 command,
+		       __u8 length, const __u8 *values)
+{
+	__u8 buf[1 + I2C_SMBUS3_BLOCK_MAX];
+	struct i2c_msg msg;
+	__s32 err;
+	int i, n;
+
+	if (handle->write_xfer == I2C_HANDLE_XFER_NONE)
+		return -EOPNOTSUPP;
+
+	if (handle->write_xfer == I2C_HANDLE_XFER_RDWR) {
+		buf[0] = command;
+		memcpy(buf + 1, values, length);
+		msg.addr = addr;
+		msg.flags = 0;
+		msg.len = 1 + length;
+		msg.buf = buf;
+		err = i2c_rdwr_access(handle->file, &msg, 1);
+		return err < 0 ? err : 0;
+	}
+
+	err = i2c_handle_set_slave(handle, addr);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < length; i += n) {
+		if (handle->write_xfer == I2C_HANDLE_XFER_BLOCK) {
+			n = length - i;
+			if (n > I2C_SMBUS_BLOCK_MAX)
+				n = I2C_SMBUS_BLOCK_MAX;
+			err = i2c_smbus_write_i2c_block_data(handle->file,
+							     command + i, n,
+							     values + i);
+		} else {
+			n = 1;
+			err = i2c_smbus_write_byte_data(handle->file,
+							command + i,
+							values[i]);
+		}
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * Batched transactions. Every operation is one message (writes) or a
+ * write of the command followed by a read with a repeated start (reads),
+ * and consecutive operations are packed into I2C_RDWR calls of up to
+ * I2C_RDWR_IOCTL_MAX_MSGS messages. The command, write data and read
+ * space of all operations share one buffer; it and the operation array
+ * only grow, so a batch that is reset and refilled does not allocate.
+ */
+
+#define I2C_BATCH_READ		0x01
+#define I2C_BATCH_BYTE		0x00
+#define I2C_BATCH_WORD		0x02
+#define I2C_BATCH_BLOCK		0x04
+#define I2C_BATCH_PEC		0x08
+
+struct i2c_batch_op {
+	__u16 addr;
+	__u8 kind;
+	__u8 length;		/* data bytes after the command, without PEC */
+	__u32 offset;		/* of the command in buf */
+	__u8 *values;		/* caller buffer of a block read */
+	__s32 result;
+};
+
+struct i2c_batch {
+	struct i2c_batch_op *ops;
+	int nops;
+	int ops_size;
+	__u8 *buf;
+	__u32 buf_len;
+	__u32 buf_size;
+	int pec;
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+};
+
+struct i2c_batch *i2c_batch_new(void)
+{
+	struct i2c_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->ops_size = 16;
+	batch->ops = malloc(batch->ops_size * sizeof(*batch->ops));
+	batch->buf_size = 256;
+	batch->buf = malloc(batch->buf_size);
+	if (!batch->ops || !batch->buf) {
+		i2c_batch_free(batch);
+		return NULL;
+	}
+	return batch;
+}
+
+void i2c_batch_free(struct i2c_batch *batch)
+{
+	if (!batch)
+		return;
+	free(batch->ops);
+	free(batch->buf);
+	free(batch);
+}
+
+/* Drops all operations but keeps the memory for the next ones */
+void i2c_batch_reset(struct i2c_batch *batch)
+{
+	batch->nops = 0;
+	batch->buf_len = 0;
+}
+
+/* Operations queued from now on carry a PEC byte */
+void i2c_batch_set_pec(struct i2c_batch *batch, int pec)
+{
+	batch->pec = pec;
+}
+
+static int i2c_batch_add(struct i2c_batch *batch, __u16 addr, __u8 kind,
+			 __u8 command, __u8 length, const __u8 *data,
+			 __u8 *values)
+{
+	struct i2c_batch_op *op;
+	__u32 need;
+	__u8 addr_byte;
+
+	/* Ten-bit addresses would need I2C_M_TEN on every message */
+	if (addr > 0x7f || length == 0)
+		return -EINVAL;
+
+	if (batch->nops == batch->ops_size) {
+		struct i2c_batch_op *ops;
+
+		ops = realloc(batch->ops,
+			      2 * batch->ops_size * sizeof(*batch->ops));
+		if (!ops)
+			return -ENOMEM;
+		batch->ops = ops;
+		batch->ops_size *= 2;
+	}
+	if (batch->pec)
+		kind |= I2C_BATCH_PEC;
+	need = 1 + length + ((kind & I2C_BATCH_PEC) ? 1 : 0);
+	if (batch->buf_len + need > batch->buf_size) {
+		__u32 size = batch->buf_size;
+		__u8 *buf;
+
+		while (batch->buf_len + need > size)
+			size *= 2;
+		buf = realloc(batch->buf, size);
+		if (!buf)
+			return -ENOMEM;
+		batch->buf = buf;
+		batch->buf_size = size;
+	}
+
+	op = &batch->ops[batch->nops];
+	op->addr = addr;
+	op->kind = kind;
+	op->length = length;
+	op->offset = batch->buf_len;
+	op->values = values;
+	op->result = -ENODATA;
+
+	batch->buf[batch->buf_len] = command;
+	if (data)
+		memcpy(batch->buf + batch->buf_len + 1, data, length);
+	if ((kind & (I2C_BATCH_PEC | I2C_BATCH_READ)) == I2C_BATCH_PEC) {
+		addr_byte = addr << 1;
+		batch->buf[batch->buf_len + 1 + length] =
+			i2c_smbus_pec(i2c_smbus_pec(0, &addr_byte, 1),
+				      batch->buf + batch->buf_len, 1 + length);
+	}
+	batch->buf_len += need;
+
+	return batch->nops++;
+}
+
+int i2c_batch_read_byte_data(struct i2c_batch *batch, __u16 addr,
+			     __u8 command)
+{
+	return i2c_batch_add(batch, addr, I2C_BATCH_READ | I2C_BATCH_BYTE,
+			     command, 1, NULL, NULL);
+}
+
+int i2c_batch_write_byte_data(struct i2c_batch *batch, __u16 addr,
+			      __u8 command, __u8 value)
+{
+	return i2c_batch_add(batch, addr, I2C_BATCH_BYTE, command, 1,
+			     &value, NULL);
+}
+
+int i2c_batch_read_word_data(struct i2c_batch *batch, __u16 addr,
+			     __u8 command)
+{
+	return i2c_batch_add(batch, addr, I2C_BATCH_READ | I2C_BATCH_WORD,
+			     command, 2, NULL, NULL);
+}
+
+/* SMBus words go out low byte first */
+int i2c_batch_write_word_data(struct i2c_batch *batch, __u16 addr,
+			      __u8 command, __u16 value)
+{
+	__u8 data[2] = { value & 0xff, value >> 8 };
+
+	return i2c_batch_add(batch, addr, I2C_BATCH_WORD, command, 2,
+			     data, NULL);
+}
+
+int i2c_batch_read_i2c_block_data(struct i2c_batch *batch, __u16 addr,
+				  __u8 command, __u8 length, __u8 *values)
+{
+	return i2c_batch_add(batch, addr, I2C_BATCH_READ | I2C_BATCH_BLOCK,
+			     command, length, NULL, values);
+}
+
+int i2c_batch_write_i2c_block_data(struct i2c_batch *batch, __u16 addr,
+				   __u8 command, __u8 length,
+				   const __u8 *values)
+{
+	return i2c_batch_add(batch, addr, I2C_BATCH_BLOCK, command, length,
+			     values, NULL);
+}
+
+static void i2c_batch_scatter(struct i2c_batch *batch, struct i2c_batch_op *op)
+{
+	const __u8 *data = batch->buf + op->offset + 1;
+	__u8 addr_bytes[2], crc;
+
+	if (!(op->kind & I2C_BATCH_READ)) {
+		op->result = 0;
+		return;
+	}
+
+	if (op->kind & I2C_BATCH_PEC) {
+		addr_bytes[0] = op->addr << 1;
+		addr_bytes[1] = (op->addr << 1) | 1;
+		crc = i2c_smbus_pec(0, addr_bytes, 1);
+		crc = i2c_smbus_pec(crc, data - 1, 1);
+		crc = i2c_smbus_pec(crc, addr_bytes + 1, 1);
+		crc = i2c_smbus_pec(crc, data, op->length);
+		if (crc != data[op->length]) {
+			op->result = -EBADMSG;
+			return;
+		}
+	}
+
+	switch (op->kind & ~(I2C_BATCH_READ | I2C_BATCH_PEC)) {
+	case I2C_BATCH_BYTE:
+		op->result = data[0];
+		break;
+	case I2C_BATCH_WORD:
+		op->result = data[0] | (data[1] << 8);
+		break;
+	default:
+		if (op->values)
+			memcpy(op->values, data, op->length);
+		op->result = op->length;
+		break;
+	}
+}
+
+/*
+ * An I2C_RDWR call succeeds or fails as a whole, so when one fails all of
+ * its operations get its error and the operations after it are not sent.
+ * Returns 0 if every operation went through; a read with a bad PEC only
+ * fails itself, with -EBADMSG.
+ */
+__s32 i2c_batch_submit(int file, struct i2c_batch *batch)
+{
+	int first, last, nmsgs, i;
+	__s32 err;
+
+	for (first = 0; first < batch->nops; first = last) {
+		nmsgs = 0;
+		for (last = first; last < batch->nops; last++) {
+			struct i2c_batch_op *op = &batch->ops[last];
+			struct i2c_msg *msg;
+
+			if (nmsgs + ((op->kind & I2C_BATCH_READ) ? 2 : 1) >
+			    I2C_RDWR_IOCTL_MAX_MSGS)
+				break;
+
+			msg = &batch->msgs[nmsgs++];
+			msg->addr = op->addr;
+			msg->flags = 0;
+			msg->buf = batch->buf + op->offset;
+			if (op->kind & I2C_BATCH_READ) {
+				msg->len = 1;
+				msg = &batch->msgs[nmsgs++];
+				msg->addr = op->addr;
+				msg->flags = I2C_M_RD;
+				msg->buf = batch->buf + op->offset + 1;
+				msg->len = op->length;
+			} else {
+				msg->len = 1 + op->length;
+			}
+			if (op->kind & I2C_BATCH_PEC)
+				msg->len++;
+		}
+
+		err = i2c_rdwr_access(file, batch->msgs, nmsgs);
+		if (err >= 0 && err != nmsgs)
+			err = -EIO;
+		if (err < 0) {
+			for (i = first; i < last; i++)
+				batch->ops[i].result = err;
+			for (; i < batch->nops; i++)
+				batch->ops[i].result = -ECANCELED;
+			return err;
+		}
+
+		for (i = first; i < last; i++)
+			i2c_batch_scatter(batch, &batch->ops[i]);
+	}
+
+	return 0;
+}
+
+__s32 i2c_batch_result(const struct i2c_batch *batch, int op)
+{
+	if (op < 0 || op >= batch->nops)
+		return -EINVAL;
+	return batch->ops[op].result;
+}
@@ -0,0 +1,343 @@
+/*
+    stats.c - Transfer counters of libi2c in shared memory
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * A process maps the page of a bus once per attached file and takes a
+ * slot in it, found again by pid or taken over from a process that is
+ * gone. Transfers on files that are not attached cost one test of
+ * i2c_stats_files; attach and detach are not meant to race with
+ * transfers on the same file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <i2c/stats.h>
+#include "stats.h"
+
+#define I2C_STATS_FILES		16
+
+struct i2c_stats_file {
+	int file;
+	int addr;		/* -1 until set */
+	struct i2c_stats_page *page;
+	struct i2c_stats_slot *slot;
+};
+
+int i2c_stats_files;
+static struct i2c_stats_file i2c_stats_file[I2C_STATS_FILES];
+
+static struct i2c_stats_file *i2c_stats_find(int file)
+{
+	int i;
+
+	for (i = 0; i < I2C_STATS_FILES; i++)
+		if (i2c_stats_file[i].page && i2c_stats_file[i].file == file)
+			return &i2c_stats_file[i];
+	return NULL;
+}
+
+/* Creates the page of a bus or waits for whoever is creating it */
+static struct i2c_stats_page *i2c_stats_map(int i2cbus)
+{
+	struct i2c_stats_page *page;
+	char filename[64];
+	struct stat st;
+	int fd, tries, created = 0;
+
+	snprintf(filename, sizeof(filename), "%s/i2c-stats-%d", I2C_STATS_DIR,
+		 i2cbus);
+	/*
+	 * Only the owner updates the page, anyone may read it whatever the
+	 * umask, i2ctop needs no more
+	 */
+	fd = open(filename, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+		  0644);
+	if (fd >= 0) {
+		created = 1;
+		if (fchmod(fd, 0644) < 0 || ftruncate(fd, sizeof(*page)) < 0) {
+			close(fd);
+			unlink(filename);
+			return NULL;
+		}
+	} else if (errno == EEXIST) {
+		/* /dev/shm is world writable, do not follow planted links */
+		fd = open(filename, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0)
+			return NULL;
+		for (tries = 0; ; tries++) {
+			if (fstat(fd, &st) < 0) {
+				close(fd);
+				return NULL;
+			}
+			/* Nor count into a page another user may have planted */
+			if (!S_ISREG(st.st_mode) ||
+			    (st.st_uid != geteuid() && st.st_uid != 0)) {
+				close(fd);
+				errno = EPERM;
+				return NULL;
+			}
+			if (st.st_size >= (off_t)sizeof(*page))
+				break;
+			if (tries == 100) {
+				close(fd);
+				errno = EPROTO;
+				return NULL;
+			}
+			usleep(1000);
+		}
+	} else {
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	if (created) {
+		page->version = I2C_STATS_VERSION;
+		page->size = sizeof(*page);
+		page->bus = i2cbus;
+		__atomic_store_n(&page->magic, I2C_STATS_MAGIC,
+				 __ATOMIC_RELEASE);
+		return page;
+	}
+
+	for (tries = 0; __atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) !=
+	     I2C_STATS_MAGIC; tries++) {
+		if (tries == 100)
+			break;
+		usleep(1000);
+	}
+	if (page->magic != I2C_STATS_MAGIC ||
+	    page->version != I2C_STATS_VERSION ||
+	    page->size != sizeof(*page)) {
+		munmap(page, sizeof(*page));
+		errno = EPROTO;
+		return NULL;
+	}
+	return page;
+}
+
+static struct i2c_stats_slot *i2c_stats_claim(struct i2c_stats_page *page)
+{
+	struct i2c_stats_slot *slot;
+	__s32 pid = getpid(), old;
+	FILE *f;
+	int i;
+
+	for (i = 0; i < I2C_STATS_SLOTS; i++)
+		if (__atomic_load_n(&page->slot[i].pid, __ATOMIC_RELAXED) ==
+		    pid)
+			return &page->slot[i];
+
+	for (i = 0; i < I2C_STATS_SLOTS; i++) {
+		slot = &page->slot[i];
+		old = __atomic_load_n(&slot->pid, __ATOMIC_RELAXED);
+		if (old && (kill(old, 0) == 0 || errno != ESRCH))
+			continue;
+		if (!__atomic_compare_exchange_n(&slot->pid, &old, pid, 0,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED))
+			continue;
+
+		/* Counters of the previous owner start over */
+		memset(&slot->total, 0, sizeof(slot->total));
+		memset(slot->errnos, 0, sizeof(slot->errnos));
+		memset(slot->comm, 0, sizeof(slot->comm));
+		f = fopen("/proc/self/comm", "re");
+		if (f) {
+			if (fgets(slot->comm, sizeof(slot->comm), f))
+				slot->comm[strcspn(slot->comm, "\n")] = '\0';
+			fclose(f);
+		}
+		return slot;
+	}
+
+	errno = ENOSPC;
+	return NULL;
+}
+
+/* Counts the transfers libi2c makes on file from now on */
+int i2c_stats_attach(int file, int i2cbus)
+{
+	struct i2c_stats_file *entry;
+	int i;
+
+	i2c_stats_detach(file);
+	for (i = 0; i < I2C_STATS_FILES; i++)
+		if (!i2c_stats_file[i].page)
+			break;
+	if (i == I2C_STATS_FILES)
+		return -EMFILE;
+	entry = &i2c_stats_file[i];
+
+	entry->page = i2c_stats_map(i2cbus);
+	if (!entry->page)
+		return -errno;
+	entry->slot = i2c_stats_claim(entry->page);
+	if (!entry->slot) {
+		munmap(entry->page, sizeof(*entry->page));
+		entry->page = NULL;
+		return -errno;
+	}
+	entry->file = file;
+	entry->addr = -1;
+	i2c_stats_files++;
+	return 0;
+}
+
+/* The slot stays with the process until it exits */
+void i2c_stats_detach(int file)
+{
+	struct i2c_stats_file *entry;
+
+	entry = i2c_stats_find(file);
+	if (!entry)
+		return;
+	munmap(entry->page, sizeof(*entry->page));
+	entry->page = NULL;
+	i2c_stats_files--;
+}
+
+void i2c_stats_set_slave(int file, __u16 addr)
+{
+	struct i2c_stats_file *entry;
+
+	if (!i2c_stats_files)
+		return;
+	entry = i2c_stats_find(file);
+	if (entry)
+		entry->addr = addr;
+}
+
+static __u64 i2c_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void i2c_stats_add(struct i2c_stats_counters *counters, __u64 ops,
+			  __u64 bytes, int err, __u64 ns)
+{
+	__atomic_fetch_add(&counters->ops, ops, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters->bytes, bytes, __ATOMIC_RELAXED);
+	if (err < 0)
+		__atomic_fetch_add(&counters->errors, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters->busy_ns, ns, __ATOMIC_RELAXED);
+}
+
+static void i2c_stats_error(struct i2c_stats_slot *slot, int err)
+{
+	int index = -err;
+
+	if (index >= I2C_STATS_ERRNOS)
+		index = I2C_STATS_ERRNOS - 1;
+	__atomic_fetch_add(&slot->errnos[index], 1, __ATOMIC_RELAXED);
+}
+
+/* Bytes on the bus after the address, once the transaction is done */
+static __u32 i2c_stats_smbus_bytes(const struct i2c_smbus_ioctl_data *args)
+{
+	switch (args->size) {
+	case I2C_SMBUS_QUICK:
+		return 0;
+	case I2C_SMBUS_BYTE:
+		return 1;
+	case I2C_SMBUS_BYTE_DATA:
+		return 2;
+	case I2C_SMBUS_WORD_DATA:
+		return 3;
+	case I2C_SMBUS_PROC_CALL:
+		return 5;
+	case I2C_SMBUS_BLOCK_DATA:
+	case I2C_SMBUS_BLOCK_PROC_CALL:
+		return 2 + args->data->block[0];
+	default:		/* I2C block transactions */
+		return 1 + args->data->block[0];
+	}
+}
+
+__s32 i2c_stats_smbus(int file, struct i2c_smbus_ioctl_data *args)
+{
+	struct i2c_stats_file *entry;
+	__u64 start, ns;
+	__s32 err;
+
+	entry = i2c_stats_find(file);
+	if (!entry) {
+		err = ioctl(file, I2C_SMBUS, args);
+		return err == -1 ? -errno : err;
+	}
+
+	start = i2c_stats_now();
+	err = ioctl(file, I2C_SMBUS, args);
+	if (err == -1)
+		err = -errno;
+	ns = i2c_stats_now() - start;
+
+	i2c_stats_add(&entry->slot->total, 1,
+		      err < 0 ? 0 : i2c_stats_smbus_bytes(args), err, ns);
+	if (err < 0)
+		i2c_stats_error(entry->slot, err);
+	if (entry->addr >= 0 && entry->addr < I2C_STATS_ADDRS)
+		i2c_stats_add(&entry->page->addr[entry->addr], 1,
+			      err < 0 ? 0 : i2c_stats_smbus_bytes(args), err,
+			      ns);
+	return err;
+}
+
+__s32 i2c_stats_rdwr(int file, struct i2c_rdwr_ioctl_data *rdwr)
+{
+	struct i2c_stats_file *entry;
+	__u64 start, ns, bytes = 0;
+	__s32 err;
+	__u32 i;
+
+	entry = i2c_stats_find(file);
+	if (!entry) {
+		err = ioctl(file, I2C_RDWR, rdwr);
+		return err == -1 ? -errno : err;
+	}
+
+	start = i2c_stats_now();
+	err = ioctl(file, I2C_RDWR, rdwr);
+	if (err == -1)
+		err = -errno;
+	ns = i2c_stats_now() - start;
+
+	for (i = 0; i < rdwr->nmsgs; i++) {
+		struct i2c_msg *msg = &rdwr->msgs[i];
+		__u32 len = 0;
+
+		/* i2c-dev does not give back the length of I2C_M_RECV_LEN */
+		if (err >= 0)
+			len = (msg->flags & I2C_M_RECV_LEN) ?
+			      1 + msg->buf[0] : msg->len;
+		bytes += len;
+		if (msg->addr < I2C_STATS_ADDRS && !(msg->flags & I2C_M_TEN))
+			i2c_stats_add(&entry->page->addr[msg->addr], 1, len,
+				      err, ns / rdwr->nmsgs);
+	}
+	i2c_stats_add(&entry->slot->total, rdwr->nmsgs, bytes, err, ns);
+	if (err < 0)
+		i2c_stats_error(entry->slot, err);
+	return err;
+}
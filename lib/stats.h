@@ -0,0 +1,24 @@
+/*
+    stats.h - Transfer accounting hooks inside libi2c
+
+    This library is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+*/
+
+#ifndef LIB_I2C_STATS_INTERNAL_H
+#define LIB_I2C_STATS_INTERNAL_H
+
+#include <linux/types.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+/* Number of attached files, transfers only look further when non-zero */
+extern int i2c_stats_files;
+
+/* Do the ioctl like the callers would, counting it if file is attached */
+extern __s32 i2c_stats_smbus(int file, struct i2c_smbus_ioctl_data *args);
+extern __s32 i2c_stats_rdwr(int file, struct i2c_rdwr_ioctl_data *rdwr);
+
+#endif /* LIB_I2C_STATS_INTERNAL_H */
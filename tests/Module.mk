@@ -0,0 +1,50 @@
+# Tests of the libraries and of i2crip
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+TESTS_DIR	:= tests
+
+# Nothing here needs an I2C adapter: the libraries are tested through a
+# fake transport or ioctl(), i2crip through its simulator. Test programs
+# link the static libraries, so they are not part of all or install.
+TESTS_CFLAGS	:= $(LIB_CFLAGS)
+TESTS_LIBS	:= $(LIB_DIR)/$(RIP_STLIBNAME) $(LIB_DIR)/$(LIB_STLIBNAME)
+
+TESTS_PROGRAMS	:= rip-batch rip-shadow smbus3-block smbus-pec
+TESTS_SCRIPTS	:= rip-scripts.sh rip-cache.sh
+
+#
+# Programs
+#
+
+$(TESTS_DIR)/rip-batch: $(TESTS_DIR)/rip-batch.c $(TESTS_DIR)/check.h $(INCLUDE_DIR)/i2c/rip.h $(TESTS_LIBS)
+	$(CC) $(CFLAGS) $(TESTS_CFLAGS) $(LDFLAGS) -o $@ $< $(TESTS_LIBS)
+
+$(TESTS_DIR)/rip-shadow: $(TESTS_DIR)/rip-shadow.c $(TESTS_DIR)/check.h $(INCLUDE_DIR)/i2c/rip.h $(TESTS_LIBS)
+	$(CC) $(CFLAGS) $(TESTS_CFLAGS) $(LDFLAGS) -o $@ $< $(TESTS_LIBS)
+
+$(TESTS_DIR)/smbus3-block: $(TESTS_DIR)/smbus3-block.c $(TESTS_DIR)/check.h $(INCLUDE_DIR)/i2c/smbus.h $(LIB_DIR)/$(LIB_STLIBNAME)
+	$(CC) $(CFLAGS) $(TESTS_CFLAGS) $(LDFLAGS) -o $@ $< $(LIB_DIR)/$(LIB_STLIBNAME)
+
+$(TESTS_DIR)/smbus-pec: $(TESTS_DIR)/smbus-pec.c $(TESTS_DIR)/check.h $(INCLUDE_DIR)/i2c/smbus.h $(LIB_DIR)/$(LIB_STLIBNAME)
+	$(CC) $(CFLAGS) $(TESTS_CFLAGS) $(LDFLAGS) -o $@ $< $(LIB_DIR)/$(LIB_STLIBNAME)
+
+#
+# Commands
+#
+
+check: all $(addprefix $(TESTS_DIR)/,$(TESTS_PROGRAMS))
+	@for test in $(TESTS_PROGRAMS) ; do \
+	echo "  TEST    $$test" ; \
+	$(TESTS_DIR)/$$test || exit 1 ; done
+	@for test in $(TESTS_SCRIPTS) ; do \
+	echo "  TEST    $$test" ; \
+	$(SHELL) $(TESTS_DIR)/$$test || exit 1 ; done
+
+clean-tests:
+	$(RM) $(addprefix $(TESTS_DIR)/,$(TESTS_PROGRAMS))
+
+clean: clean-tests
@@ -0,0 +1,30 @@
+/*
+    check.h - Assertions shared by the i2c-tools tests
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+#ifndef _TESTS_CHECK_H
+#define _TESTS_CHECK_H
+
+#include <stdio.h>
+
+/* A failed check is reported and counted, the test goes on */
+static int check_failures;
+
+#define CHECK(cond, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);	\
+			fprintf(stderr, __VA_ARGS__);			\
+			fputc('\n', stderr);				\
+			check_failures++;				\
+		}							\
+	} while (0)
+
+#define CHECK_DONE()	(check_failures ? 1 : 0)
+
+#endif
@@ -0,0 +1,195 @@
+/*
+    rip-batch.c - Errors of batched i2crip transfers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * Runs scripts with I2C_RIP_BATCH over a transport that fails calls on
+ * demand, and checks which lines an error is reported against and that
+ * nothing the adapter may have sent is sent again.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <i2c/rip.h>
+#include "check.h"
+
+#define MAX_CALLS	8
+
+/* How the next I2C_RDWR call ends: -errno, a count, or all sent */
+static int next_result[MAX_CALLS];
+static int calls;
+static int call_nmsgs[MAX_CALLS];
+static char log_text[4096];
+static int log_length;
+
+static int fake_open(void *user, int bus)
+{
+	(void)user;
+	return 100 + bus;
+}
+
+static int fake_rdwr(void *user, int file, struct i2c_rdwr_ioctl_data *rdwr)
+{
+	int result;
+
+	(void)user;
+	(void)file;
+	if (calls == MAX_CALLS)
+		return -E2BIG;
+	call_nmsgs[calls] = rdwr->nmsgs;
+	result = next_result[calls++];
+	return result ? result : (int)rdwr->nmsgs;
+}
+
+static void fake_close(void *user, int file)
+{
+	(void)user;
+	(void)file;
+}
+
+static const struct i2c_rip_transport fake_transport = {
+	.open = fake_open,
+	.rdwr = fake_rdwr,
+	.close = fake_close,
+};
+
+static void capture_log(void *user, int index, unsigned int dest,
+			const char *text, int length)
+{
+	(void)user;
+	(void)index;
+	(void)dest;
+	if (length > (int)sizeof(log_text) - 1 - log_length)
+		length = sizeof(log_text) - 1 - log_length;
+	memcpy(log_text + log_length, text, length);
+	log_length += length;
+	log_text[log_length] = '\0';
+}
+
+static const struct i2c_rip_ops capture_ops = {
+	.log = capture_log,
+};
+
+/* Runs script with the given call results, returns what the run did */
+static int run_script(const char *script, const int *results, int nresults)
+{
+	struct i2c_rip_ctx *ctx;
+	int ret;
+
+	memset(next_result, 0, sizeof(next_result));
+	memcpy(next_result, results, nresults * sizeof(*results));
+	calls = 0;
+	log_length = 0;
+	log_text[0] = '\0';
+
+	ctx = i2c_rip_ctx_new();
+	if (!ctx)
+		return -ENOMEM;
+	i2c_rip_ctx_set_ops(ctx, &capture_ops, NULL);
+	i2c_rip_ctx_set_transport(ctx, &fake_transport, NULL);
+	i2c_rip_ctx_set_flags(ctx, I2C_RIP_BATCH | I2C_RIP_DEBUG);
+	ret = i2c_rip_ctx_load(ctx, script, strlen(script));
+	if (ret == 0)
+		ret = i2c_rip_ctx_run(ctx);
+	i2c_rip_ctx_close(ctx);
+	i2c_rip_ctx_free(ctx);
+	return ret;
+}
+
+static const char writes[] =
+	"SET-BUS 1\n"
+	"SET-ID 0x50\n"
+	"WB-8 0x10 0x01\n"
+	"WB-8 0x11 0x02\n"
+	"WB-8 0x12 0x03\n";
+
+static const char supressed_writes[] =
+	"SUPRESS-ERRORS 1\n"
+	"SET-BUS 1\n"
+	"SET-ID 0x50\n"
+	"WB-8 0x10 0x01\n"
+	"WB-8 0x11 0x02\n"
+	"WB-8 0x12 0x03\n";
+
+/* A call that fails without a count is reported once for all its lines */
+static void test_lost_batch(void)
+{
+	static const int results[] = { -EIO };
+
+	CHECK(run_script(writes, results, 1) < 0, "failed batch passed");
+	CHECK(calls == 1, "%d I2C_RDWR calls, the batch was sent again",
+	      calls);
+	CHECK(call_nmsgs[0] == 3, "batch of %d messages", call_nmsgs[0]);
+	CHECK(strstr(log_text, "Lines 3-5:Error: Sending messages failed") !=
+	      NULL, "no error for lines 3-5 in:\n%s", log_text);
+}
+
+/* Supressing errors does not make a lost batch go out again either */
+static void test_lost_batch_supressed(void)
+{
+	static const int results[] = { -EIO };
+
+	run_script(supressed_writes, results, 1);
+	CHECK(calls == 1, "%d I2C_RDWR calls, the batch was sent again",
+	      calls);
+	CHECK(strstr(log_text, "Lines 4-6:Error: Sending messages failed") !=
+	      NULL, "no error for lines 4-6 in:\n%s", log_text);
+}
+
+/* A single transfer names its own line */
+static void test_lost_single(void)
+{
+	static const char script[] =
+		"SET-BUS 1\n"
+		"SET-ID 0x50\n"
+		"WB-8 0x10 0x01\n";
+	static const int results[] = { -ENXIO };
+
+	CHECK(run_script(script, results, 1) < 0, "failed write passed");
+	CHECK(calls == 1, "%d I2C_RDWR calls", calls);
+	CHECK(strstr(log_text, "Line 3:Error: Sending messages failed") !=
+	      NULL, "no error for line 3 in:\n%s", log_text);
+}
+
+/* A count points at the failed line, the rest goes out with errors
+   supressed and nothing before it is sent twice */
+static void test_short_count(void)
+{
+	static const int results[] = { 1 };
+
+	run_script(supressed_writes, results, 1);
+	CHECK(calls == 2, "%d I2C_RDWR calls, expected 2", calls);
+	CHECK(call_nmsgs[0] == 3 && call_nmsgs[1] == 1,
+	      "calls of %d and %d messages, expected 3 and 1",
+	      call_nmsgs[0], call_nmsgs[1]);
+	CHECK(strstr(log_text, "Line 5:Error: Failed to Write") != NULL,
+	      "no error for line 5 in:\n%s", log_text);
+	CHECK(strstr(log_text, "Lines ") == NULL,
+	      "a line range was reported in:\n%s", log_text);
+}
+
+/* Without supressed errors the script stops at the failed line */
+static void test_short_count_stops(void)
+{
+	static const int results[] = { 1 };
+
+	CHECK(run_script(writes, results, 1) < 0, "short batch passed");
+	CHECK(calls == 1, "%d I2C_RDWR calls, expected 1", calls);
+	CHECK(strstr(log_text, "Line 4:Error: Failed to Write") != NULL,
+	      "no error for line 4 in:\n%s", log_text);
+}
+
+int main(void)
+{
+	test_lost_batch();
+	test_lost_batch_supressed();
+	test_lost_single();
+	test_short_count();
+	test_short_count_stops();
+	return CHECK_DONE();
+}
@@ -0,0 +1,136 @@
+#!/bin/sh
+#
+# rip-cache.sh - Checks which compiled script images i2crip uses
+#
+# Runs a script on the simulator with the cache in a temporary directory,
+# then damages the cached image in several ways and checks that i2crip
+# parses the script again instead of using it. Run from the top directory,
+# as "make check" does.
+
+top=$PWD
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+LD_LIBRARY_PATH="$top/lib${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+I2CRIP_CACHE_DIR="$tmp/cache"
+export LD_LIBRARY_PATH I2CRIP_CACHE_DIR
+umask 022
+
+cat > "$tmp/script.txt" <<EOF
+SET-BUS 1
+SET-ID 0x50
+WBLK-8 0x10 01020304
+VBLK-8 0x10 01020304
+EOF
+
+# Header fields, see i2cRipImageHeader_t in tools/i2crip.h
+SOURCE_LENGTH=28
+FIRST_OP=40
+
+# run OPTIONS SCRIPT: runs i2crip, the output is left in $tmp/out
+run() {
+	"$top/tools/i2crip" -y -s -u "$@" > "$tmp/out" 2>&1
+}
+
+# expect TEXT WHAT: the last run printed TEXT
+expect() {
+	if ! grep -q -- "$1" "$tmp/out" ; then
+		echo "$2: no \"$1\" in:"
+		cat "$tmp/out"
+		failed=1
+	fi
+}
+
+# expect_not TEXT WHAT: the last run did not print TEXT
+expect_not() {
+	if grep -q -- "$1" "$tmp/out" ; then
+		echo "$2: \"$1\" in:"
+		cat "$tmp/out"
+		failed=1
+	fi
+}
+
+# patch FILE OFFSET: overwrites 4 bytes of FILE at OFFSET
+patch() {
+	printf '\377\377\377\177' |
+		dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# fresh: a valid cached image of the script, its name in $image
+fresh() {
+	rm -rf "$I2CRIP_CACHE_DIR"
+	run --validate-first "$tmp/script.txt"
+	image=$(ls "$I2CRIP_CACHE_DIR"/*.ripc 2>/dev/null)
+}
+
+fresh
+expect "I2cRip was SUCCESSFUL" "first run"
+expect_not "(cached)" "first run"
+if [ -z "$image" ] ; then
+	echo "first run: no image in $I2CRIP_CACHE_DIR"
+	exit 1
+fi
+if [ "$(stat -c %a "$image")" != 600 ] ; then
+	echo "cached image has mode $(stat -c %a "$image"), expected 600"
+	failed=1
+fi
+run --validate-first "$tmp/script.txt"
+expect "Number of commands: 4 (cached)" "second run"
+expect "I2cRip was SUCCESSFUL" "second run"
+
+# Streamed scripts do not use the cache
+run "$tmp/script.txt"
+expect_not "(cached)" "streamed run"
+
+# A damaged image is parsed again and replaced
+truncate -s -1 "$image"
+run --validate-first "$tmp/script.txt"
+expect_not "(cached)" "truncated image"
+expect "I2cRip was SUCCESSFUL" "truncated image"
+run --validate-first "$tmp/script.txt"
+expect "(cached)" "image replacing a truncated one"
+
+fresh
+patch "$image" $FIRST_OP
+run --validate-first "$tmp/script.txt"
+expect_not "(cached)" "image with an unknown command"
+expect "I2cRip was SUCCESSFUL" "image with an unknown command"
+
+fresh
+patch "$image" $SOURCE_LENGTH
+run --validate-first "$tmp/script.txt"
+expect_not "(cached)" "image of another source length"
+
+# Images and directories others could have written are not trusted
+fresh
+chmod g+w "$image"
+run --validate-first "$tmp/script.txt"
+expect_not "(cached)" "group writable image"
+
+fresh
+mv "$image" "$tmp/link.ripc"
+ln -s "$tmp/link.ripc" "$image"
+run --validate-first "$tmp/script.txt"
+expect_not "(cached)" "symbolic link to an image"
+
+fresh
+chmod 0775 "$I2CRIP_CACHE_DIR"
+rm -f "$image"
+run --validate-first "$tmp/script.txt"
+expect "Warning: Not using cache" "group writable cache directory"
+expect "I2cRip was SUCCESSFUL" "group writable cache directory"
+if [ -n "$(ls "$I2CRIP_CACHE_DIR")" ] ; then
+	echo "group writable cache directory: an image was written"
+	failed=1
+fi
+
+# A corrupt compiled script given by name is an error
+"$top/tools/i2crip" -c -o "$tmp/script.ripc" "$tmp/script.txt" > "$tmp/out" 2>&1
+run "$tmp/script.ripc"
+expect "I2cRip was SUCCESSFUL" "compiled script"
+patch "$tmp/script.ripc" $FIRST_OP
+run "$tmp/script.ripc"
+expect "Error: Compiled script" "corrupt compiled script"
+
+exit $failed
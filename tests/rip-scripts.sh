@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# rip-scripts.sh - Runs the i2crip test scripts on the simulator
+#
+# Every scripts/NAME.txt is run with the options on its first line,
+# "// i2crip OPTIONS", and with NAME.model as the simulator model if there
+# is one. The output must match NAME.out. Run from the top directory,
+# as "make check" does; "rip-scripts.sh NAME" runs one script.
+
+top=$PWD
+dir=tests/scripts
+failed=0
+
+LD_LIBRARY_PATH="$top/lib${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+export LD_LIBRARY_PATH
+
+if [ $# -gt 0 ] ; then
+	scripts=$(for name in "$@" ; do echo "$dir/$name.txt" ; done)
+else
+	scripts=$(ls $dir/*.txt)
+fi
+
+for script in $scripts ; do
+	name=$(basename "$script" .txt)
+	options=$(sed -n '1s|^// i2crip ||p' "$script")
+	if [ -f "$dir/$name.model" ] ; then
+		options="$options -S $name.model"
+	fi
+	# Synchronous logging gives the same order every run, loop
+	# reports lose their timings
+	if ! (cd $dir && "$top/tools/i2crip" -y -s -n -u $options "$name.txt" 2>&1) |
+	     sed '/Loop done/s/ in .*//' | diff -u "$dir/$name.out" - ; then
+		echo "$script: unexpected output"
+		failed=1
+	fi
+done
+exit $failed
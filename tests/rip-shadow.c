@@ -0,0 +1,217 @@
+/*
+    rip-shadow.c - Writes the i2crip shadow registers leave out
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * Runs scripts with I2C_RIP_SHADOW over a transport that counts the
+ * register writes reaching the bus. Reads return READ_VALUE, and a
+ * write can be made to fail.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <i2c/rip.h>
+#include "check.h"
+
+#define READ_VALUE	0x5a
+
+static int writes;
+static int fail_write;		/* number of the write to fail, 1 based */
+
+static int fake_open(void *user, int bus)
+{
+	(void)user;
+	return 100 + bus;
+}
+
+/* A write message not followed by a read is a register write */
+static int fake_rdwr(void *user, int file, struct i2c_rdwr_ioctl_data *rdwr)
+{
+	struct i2c_msg *msg;
+	__u32 i;
+
+	(void)user;
+	(void)file;
+	for (i = 0; i < rdwr->nmsgs; i++) {
+		msg = &rdwr->msgs[i];
+		if (msg->flags & I2C_M_RD) {
+			memset(msg->buf, READ_VALUE, msg->len);
+			continue;
+		}
+		if (i + 1 < rdwr->nmsgs &&
+		    (rdwr->msgs[i + 1].flags & I2C_M_RD))
+			continue;
+		if (++writes == fail_write)
+			return -EIO;
+	}
+	return rdwr->nmsgs;
+}
+
+static void fake_close(void *user, int file)
+{
+	(void)user;
+	(void)file;
+}
+
+static const struct i2c_rip_transport fake_transport = {
+	.open = fake_open,
+	.rdwr = fake_rdwr,
+	.close = fake_close,
+};
+
+static void quiet_log(void *user, int index, unsigned int dest,
+		      const char *text, int length)
+{
+	(void)user;
+	(void)index;
+	(void)dest;
+	(void)text;
+	(void)length;
+}
+
+static const struct i2c_rip_ops quiet_ops = {
+	.log = quiet_log,
+};
+
+/* Runs script, returns the number of register writes that went out */
+static int run_script(const char *script, unsigned int flags, int fail)
+{
+	struct i2c_rip_ctx *ctx;
+
+	writes = 0;
+	fail_write = fail;
+	ctx = i2c_rip_ctx_new();
+	if (!ctx)
+		return -ENOMEM;
+	i2c_rip_ctx_set_ops(ctx, &quiet_ops, NULL);
+	i2c_rip_ctx_set_transport(ctx, &fake_transport, NULL);
+	i2c_rip_ctx_set_flags(ctx, I2C_RIP_SHADOW | flags);
+	if (i2c_rip_ctx_load(ctx, script, strlen(script)) == 0)
+		i2c_rip_ctx_run(ctx);
+	i2c_rip_ctx_close(ctx);
+	i2c_rip_ctx_free(ctx);
+	return writes;
+}
+
+#define DEVICE	"SET-BUS 1\nSET-ID 0x50\n"
+
+static void test_same_value(void)
+{
+	static const char script[] = DEVICE
+		"WB-8 0x10 0x01\n"
+		"WB-8 0x10 0x01\n";
+	int n;
+
+	n = run_script(script, 0, 0);
+	CHECK(n == 1, "same value written %d times", n);
+	n = run_script(script, I2C_RIP_BATCH, 0);
+	CHECK(n == 1, "same value written %d times in a batch", n);
+}
+
+static void test_new_value(void)
+{
+	static const char script[] = DEVICE
+		"WB-8 0x10 0x01\n"
+		"WB-8 0x10 0x02\n";
+	int n;
+
+	n = run_script(script, 0, 0);
+	CHECK(n == 2, "changed value written %d times", n);
+}
+
+/* A read makes the value known as well */
+static void test_read_value(void)
+{
+	static const char script[] = DEVICE
+		"RB-8 0x11\n"
+		"WB-8 0x11 0x5a\n"
+		"WB-8 0x12 0x5a\n";
+	int n;
+
+	n = run_script(script, 0, 0);
+	CHECK(n == 1, "%d writes after a read, expected 1", n);
+}
+
+/* Both registers of a word write are known, each on its own */
+static void test_word(void)
+{
+	static const char covered[] = DEVICE
+		"WW-8 0x20 0x1234\n"
+		"WB-8 0x20 0x12\n"
+		"WB-8 0x21 0x34\n";
+	static const char partial[] = DEVICE
+		"WB-8 0x20 0x12\n"
+		"WW-8 0x20 0x1234\n";
+	int n;
+
+	n = run_script(covered, 0, 0);
+	CHECK(n == 1, "%d writes of registers a word write set", n);
+	n = run_script(partial, 0, 0);
+	CHECK(n == 2, "%d writes of a word half known", n);
+}
+
+static void test_volatile(void)
+{
+	static const char script[] = DEVICE
+		"VOLATILE 0x30 0x31\n"
+		"WB-8 0x30 0x01\n"
+		"WB-8 0x30 0x01\n"
+		"WB-8 0x32 0x01\n"
+		"WB-8 0x32 0x01\n";
+	int n;
+
+	n = run_script(script, 0, 0);
+	CHECK(n == 3, "%d writes with a volatile register, expected 3", n);
+}
+
+/* Registers of one device say nothing about another */
+static void test_devices(void)
+{
+	static const char script[] = DEVICE
+		"WB-8 0x10 0x01\n"
+		"SET-ID 0x51\n"
+		"WB-8 0x10 0x01\n"
+		"SET-BUS 2\n"
+		"SET-ID 0x50\n"
+		"WB-8 0x10 0x01\n";
+	int n;
+
+	n = run_script(script, 0, 0);
+	CHECK(n == 3, "%d writes to three devices", n);
+}
+
+/* The value of a failed write is not known; in a batch the failure
+   covers the writes left out behind it, the next batch writes again */
+static void test_failed_write(void)
+{
+	static const char script[] = "SUPRESS-ERRORS 1\n" DEVICE
+		"WB-8 0x10 0x01\n"
+		"WB-8 0x10 0x01\n";
+	static const char batches[] = "SUPRESS-ERRORS 1\n" DEVICE
+		"WB-8 0x10 0x01\n"
+		"DELAY 1\n"
+		"WB-8 0x10 0x01\n";
+	int n;
+
+	n = run_script(script, 0, 1);
+	CHECK(n == 2, "%d writes after a failed one, expected 2", n);
+	n = run_script(batches, I2C_RIP_BATCH, 1);
+	CHECK(n == 2, "%d writes after a failed batch, expected 2", n);
+}
+
+int main(void)
+{
+	test_same_value();
+	test_new_value();
+	test_read_value();
+	test_word();
+	test_volatile();
+	test_devices();
+	test_failed_write();
+	return CHECK_DONE();
+}
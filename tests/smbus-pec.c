@@ -0,0 +1,220 @@
+/*
+    smbus-pec.c - Packet error checking of libi2c
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * Checks i2c_smbus_pec() against known CRC-8 values and a bit at a time
+ * reference over every length up to a few hundred bytes, so the carry-less
+ * multiply path is covered as well when the library is built with it.
+ * Then replaces ioctl() to check the PEC bytes batches send and check.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <i2c/smbus.h>
+#include "check.h"
+
+#define FILE_FD		42
+#define ADDR		0x2c
+#define MAX_LEN		300
+
+/* CRC-8, polynomial x^8 + x^2 + x + 1, one bit at a time */
+static __u8 reference_pec(__u8 crc, const __u8 *data, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static void test_known_values(void)
+{
+	static const __u8 check[] = "123456789";
+	static const __u8 ones[] = { 0xff };
+	/* Write byte 0x55 to command 0x01 of slave 0x2c */
+	static const __u8 write_byte[] = { ADDR << 1, 0x01, 0x55 };
+	__u8 crc;
+
+	crc = i2c_smbus_pec(0, check, 9);
+	CHECK(crc == 0xf4, "PEC of \"123456789\" is 0x%02x, expected 0xf4",
+	      crc);
+	crc = i2c_smbus_pec(0, ones, 1);
+	CHECK(crc == 0xf3, "PEC of 0xff is 0x%02x, expected 0xf3", crc);
+	crc = i2c_smbus_pec(0x5a, check, 0);
+	CHECK(crc == 0x5a, "PEC of nothing is 0x%02x, expected 0x5a", crc);
+	crc = i2c_smbus_pec(0, write_byte, 3);
+	CHECK(crc == reference_pec(0, write_byte, 3),
+	      "PEC of a byte write is 0x%02x, expected 0x%02x",
+	      crc, reference_pec(0, write_byte, 3));
+}
+
+/* Every length, and the same bytes in two parts */
+static void test_lengths(void)
+{
+	__u8 data[MAX_LEN];
+	unsigned int seed = 1;
+	size_t len;
+	int bad = 0, bad_split = 0;
+
+	for (len = 0; len < MAX_LEN; len++) {
+		seed = seed * 1103515245 + 12345;
+		data[len] = seed >> 16;
+	}
+	for (len = 0; len <= MAX_LEN; len++) {
+		__u8 start = len * 37;
+		__u8 crc = i2c_smbus_pec(start, data, len);
+
+		if (crc != reference_pec(start, data, len)) {
+			if (!bad)
+				fprintf(stderr, "first bad length %zu\n", len);
+			bad++;
+		}
+		if (i2c_smbus_pec(i2c_smbus_pec(start, data, len / 3),
+				  data + len / 3, len - len / 3) != crc)
+			bad_split++;
+	}
+	CHECK(bad == 0, "%d lengths with a wrong PEC", bad);
+	CHECK(bad_split == 0, "%d lengths where a split changes the PEC",
+	      bad_split);
+}
+
+/*
+ * Fake adapter for batches: the bytes of every write message are kept,
+ * a read gets READ_VALUE and a PEC that is right unless bad_pec is set.
+ * Reads of commands from PLAIN_COMMAND on have no PEC.
+ */
+#define READ_VALUE	0xa5
+#define PLAIN_COMMAND	0x30
+
+static __u8 written[I2C_RDWR_IOCTL_MAX_MSGS][8];
+static int written_len[I2C_RDWR_IOCTL_MAX_MSGS];
+static int bad_pec;
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct i2c_rdwr_ioctl_data *rdwr;
+	__u8 bytes[3], crc;
+	va_list ap;
+	__u32 i;
+
+	va_start(ap, request);
+	rdwr = va_arg(ap, struct i2c_rdwr_ioctl_data *);
+	va_end(ap);
+
+	if (fd != FILE_FD || request != I2C_RDWR) {
+		errno = ENOTTY;
+		return -1;
+	}
+	for (i = 0; i < rdwr->nmsgs; i++) {
+		struct i2c_msg *msg = &rdwr->msgs[i];
+
+		if (!(msg->flags & I2C_M_RD)) {
+			written_len[i] = msg->len;
+			memcpy(written[i], msg->buf,
+			       msg->len < 8 ? msg->len : 8);
+			continue;
+		}
+		memset(msg->buf, READ_VALUE, msg->len);
+		if (rdwr->msgs[i - 1].buf[0] >= PLAIN_COMMAND)
+			continue;
+		/* The PEC covers both addresses, the command and the data */
+		bytes[0] = msg->addr << 1;
+		bytes[1] = rdwr->msgs[i - 1].buf[0];
+		bytes[2] = (msg->addr << 1) | 1;
+		crc = reference_pec(0, bytes, 3);
+		crc = reference_pec(crc, msg->buf, msg->len - 1);
+		msg->buf[msg->len - 1] = bad_pec ? crc ^ 1 : crc;
+	}
+	return rdwr->nmsgs;
+}
+
+static void test_batch_write(void)
+{
+	struct i2c_batch *batch;
+	__u8 expected[4] = { ADDR << 1, 0x10, 0x34, 0x12 };
+	int ret;
+
+	batch = i2c_batch_new();
+	if (!batch) {
+		CHECK(0, "no batch");
+		return;
+	}
+	i2c_batch_write_byte_data(batch, ADDR, 0x10, 0x34);
+	i2c_batch_set_pec(batch, 1);
+	i2c_batch_write_byte_data(batch, ADDR, 0x10, 0x34);
+	i2c_batch_write_word_data(batch, ADDR, 0x10, 0x1234);
+	ret = i2c_batch_submit(FILE_FD, batch);
+	CHECK(ret == 0, "batch returned %d", ret);
+
+	CHECK(written_len[0] == 2, "write without PEC of %d bytes",
+	      written_len[0]);
+	CHECK(written_len[1] == 3 &&
+	      written[1][2] == reference_pec(0, expected, 3),
+	      "byte write of %d bytes, PEC 0x%02x, expected 0x%02x",
+	      written_len[1], written[1][2], reference_pec(0, expected, 3));
+	CHECK(written_len[2] == 4 &&
+	      written[2][3] == reference_pec(0, expected, 4),
+	      "word write of %d bytes, PEC 0x%02x, expected 0x%02x",
+	      written_len[2], written[2][3], reference_pec(0, expected, 4));
+	i2c_batch_free(batch);
+}
+
+/* A read with a bad PEC fails by itself */
+static void test_batch_read(void)
+{
+	struct i2c_batch *batch;
+	int byte, word, plain, ret;
+
+	batch = i2c_batch_new();
+	if (!batch) {
+		CHECK(0, "no batch");
+		return;
+	}
+	i2c_batch_set_pec(batch, 1);
+	byte = i2c_batch_read_byte_data(batch, ADDR, 0x20);
+	word = i2c_batch_read_word_data(batch, ADDR, 0x21);
+	bad_pec = 0;
+	ret = i2c_batch_submit(FILE_FD, batch);
+	CHECK(ret == 0, "batch returned %d", ret);
+	ret = i2c_batch_result(batch, byte);
+	CHECK(ret == READ_VALUE, "byte read returned %d", ret);
+	ret = i2c_batch_result(batch, word);
+	CHECK(ret == (READ_VALUE << 8 | READ_VALUE), "word read returned %d",
+	      ret);
+
+	i2c_batch_reset(batch);
+	i2c_batch_set_pec(batch, 1);
+	byte = i2c_batch_read_byte_data(batch, ADDR, 0x20);
+	i2c_batch_set_pec(batch, 0);
+	plain = i2c_batch_read_byte_data(batch, ADDR, PLAIN_COMMAND);
+	bad_pec = 1;
+	ret = i2c_batch_submit(FILE_FD, batch);
+	CHECK(ret == 0, "batch with a bad PEC returned %d", ret);
+	ret = i2c_batch_result(batch, byte);
+	CHECK(ret == -EBADMSG, "read with a bad PEC returned %d", ret);
+	ret = i2c_batch_result(batch, plain);
+	CHECK(ret == READ_VALUE, "read without PEC returned %d", ret);
+	i2c_batch_free(batch);
+}
+
+int main(void)
+{
+	test_known_values();
+	test_lengths();
+	test_batch_write();
+	test_batch_read();
+	return CHECK_DONE();
+}
@@ -0,0 +1,286 @@
+/*
+    smbus3-block.c - SMBus 3 block transactions of libi2c
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+/*
+ * Replaces ioctl() with an adapter that answers I2C_RDWR the way i2c-dev
+ * does, including I2C_M_RECV_LEN, or refuses it with EOPNOTSUPP like an
+ * SMBus only adapter, and checks the messages of 255 byte blocks and the
+ * fallback to SMBus 2 transactions.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <i2c/smbus.h>
+#include "check.h"
+
+#define FILE_FD		42
+#define ADDR		0x50
+
+static int smbus_only;		/* I2C_RDWR fails with EOPNOTSUPP */
+static int rdwr_calls, slave_calls, smbus_calls;
+static unsigned long slave_addr;
+
+/* The last I2C_RDWR call */
+static struct i2c_msg last_msgs[2];
+static int last_nmsgs;
+static __u8 last_write[2 + I2C_SMBUS3_BLOCK_MAX];
+
+/* The last I2C_SMBUS call */
+static struct i2c_smbus_ioctl_data last_smbus;
+static __u8 last_block[I2C_SMBUS_BLOCK_MAX + 2];
+
+/* Byte i of a block the device returns */
+static __u8 pattern(int i)
+{
+	return (__u8)(i * 7 + 3);
+}
+
+/* A read of I2C_M_RECV_LEN gets its length from the device, 255 here */
+static int fake_rdwr(struct i2c_rdwr_ioctl_data *rdwr)
+{
+	__u32 i;
+	int j;
+
+	rdwr_calls++;
+	if (smbus_only) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (rdwr->nmsgs > 2) {
+		errno = EINVAL;
+		return -1;
+	}
+	last_nmsgs = rdwr->nmsgs;
+	for (i = 0; i < rdwr->nmsgs; i++) {
+		struct i2c_msg *msg = &rdwr->msgs[i];
+
+		last_msgs[i] = *msg;
+		if (!(msg->flags & I2C_M_RD)) {
+			if (msg->len > sizeof(last_write)) {
+				errno = EINVAL;
+				return -1;
+			}
+			memcpy(last_write, msg->buf, msg->len);
+			continue;
+		}
+		if (msg->flags & I2C_M_RECV_LEN) {
+			if (msg->len < 1 + I2C_SMBUS3_BLOCK_MAX) {
+				errno = EINVAL;
+				return -1;
+			}
+			msg->buf[0] = I2C_SMBUS3_BLOCK_MAX;
+			msg->len = 1 + I2C_SMBUS3_BLOCK_MAX;
+		}
+		for (j = 1; j < msg->len; j++)
+			msg->buf[j] = pattern(j - 1);
+	}
+	return rdwr->nmsgs;
+}
+
+/* Block reads return 32 bytes of the pattern */
+static int fake_smbus(struct i2c_smbus_ioctl_data *args)
+{
+	int i;
+
+	smbus_calls++;
+	last_smbus = *args;
+	if (args->data)
+		memcpy(last_block, args->data->block, sizeof(last_block));
+	if (args->read_write == I2C_SMBUS_READ ||
+	    args->size == I2C_SMBUS_BLOCK_PROC_CALL) {
+		args->data->block[0] = I2C_SMBUS_BLOCK_MAX;
+		for (i = 0; i < I2C_SMBUS_BLOCK_MAX; i++)
+			args->data->block[i + 1] = pattern(i);
+	}
+	return 0;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd != FILE_FD) {
+		errno = EBADF;
+		return -1;
+	}
+	switch (request) {
+	case I2C_RDWR:
+		return fake_rdwr(arg);
+	case I2C_SLAVE:
+		slave_calls++;
+		slave_addr = (unsigned long)arg;
+		return 0;
+	case I2C_SMBUS:
+		return fake_smbus(arg);
+	}
+	errno = ENOTTY;
+	return -1;
+}
+
+static void reset(int rdwr_refused)
+{
+	smbus_only = rdwr_refused;
+	rdwr_calls = slave_calls = smbus_calls = 0;
+	last_nmsgs = 0;
+	slave_addr = 0;
+}
+
+static void test_read(void)
+{
+	__u8 values[I2C_SMBUS3_BLOCK_MAX];
+	__s32 ret;
+	int i, bad = 0;
+
+	reset(0);
+	memset(values, 0, sizeof(values));
+	ret = i2c_smbus3_read_block_data(FILE_FD, ADDR, 0x20, values);
+	CHECK(ret == I2C_SMBUS3_BLOCK_MAX, "read returned %d", ret);
+	CHECK(rdwr_calls == 1 && last_nmsgs == 2,
+	      "%d I2C_RDWR calls of %d messages", rdwr_calls, last_nmsgs);
+	CHECK(last_msgs[0].addr == ADDR && last_msgs[0].flags == 0 &&
+	      last_msgs[0].len == 1 && last_write[0] == 0x20,
+	      "command message 0x%02x flags 0x%x len %d",
+	      last_msgs[0].addr, last_msgs[0].flags, last_msgs[0].len);
+	CHECK(last_msgs[1].addr == ADDR &&
+	      last_msgs[1].flags == (I2C_M_RD | I2C_M_RECV_LEN),
+	      "read message 0x%02x flags 0x%x",
+	      last_msgs[1].addr, last_msgs[1].flags);
+	for (i = 0; i < I2C_SMBUS3_BLOCK_MAX; i++)
+		bad += values[i] != pattern(i);
+	CHECK(bad == 0, "%d of 255 read bytes wrong", bad);
+	CHECK(slave_calls == 0, "I2C_SLAVE set for an I2C_RDWR read");
+}
+
+static void test_write(void)
+{
+	__u8 values[I2C_SMBUS3_BLOCK_MAX];
+	__s32 ret;
+	int i;
+
+	reset(0);
+	for (i = 0; i < I2C_SMBUS3_BLOCK_MAX; i++)
+		values[i] = pattern(i);
+	ret = i2c_smbus3_write_block_data(FILE_FD, ADDR, 0x21,
+					  I2C_SMBUS3_BLOCK_MAX, values);
+	CHECK(ret == 0, "write returned %d", ret);
+	CHECK(rdwr_calls == 1 && last_nmsgs == 1,
+	      "%d I2C_RDWR calls of %d messages", rdwr_calls, last_nmsgs);
+	CHECK(last_msgs[0].len == 2 + I2C_SMBUS3_BLOCK_MAX,
+	      "write message of %d bytes", last_msgs[0].len);
+	CHECK(last_write[0] == 0x21 && last_write[1] == I2C_SMBUS3_BLOCK_MAX,
+	      "command 0x%02x count %d", last_write[0], last_write[1]);
+	CHECK(memcmp(last_write + 2, values, I2C_SMBUS3_BLOCK_MAX) == 0,
+	      "written data differs");
+}
+
+static void test_process_call(void)
+{
+	__u8 values[I2C_SMBUS3_BLOCK_MAX];
+	__s32 ret;
+	int i, bad = 0;
+
+	reset(0);
+	memset(values, 0xee, sizeof(values));
+	ret = i2c_smbus3_block_process_call(FILE_FD, ADDR, 0x22, 100, values);
+	CHECK(ret == I2C_SMBUS3_BLOCK_MAX, "process call returned %d", ret);
+	CHECK(rdwr_calls == 1 && last_nmsgs == 2,
+	      "%d I2C_RDWR calls of %d messages", rdwr_calls, last_nmsgs);
+	CHECK(last_msgs[0].len == 2 + 100 && last_write[0] == 0x22 &&
+	      last_write[1] == 100 && last_write[2] == 0xee,
+	      "write message of %d bytes, command 0x%02x count %d",
+	      last_msgs[0].len, last_write[0], last_write[1]);
+	CHECK(last_msgs[1].flags == (I2C_M_RD | I2C_M_RECV_LEN),
+	      "read message flags 0x%x", last_msgs[1].flags);
+	for (i = 0; i < I2C_SMBUS3_BLOCK_MAX; i++)
+		bad += values[i] != pattern(i);
+	CHECK(bad == 0, "%d of 255 returned bytes wrong", bad);
+}
+
+/* Without I2C_RDWR, blocks that fit SMBus 2 go through I2C_SMBUS */
+static void test_fallback(void)
+{
+	__u8 values[I2C_SMBUS3_BLOCK_MAX];
+	__s32 ret;
+	int i, bad = 0;
+
+	reset(1);
+	ret = i2c_smbus3_read_block_data(FILE_FD, ADDR, 0x20, values);
+	CHECK(ret == I2C_SMBUS_BLOCK_MAX, "fallback read returned %d", ret);
+	CHECK(slave_calls == 1 && slave_addr == ADDR,
+	      "%d I2C_SLAVE calls, address 0x%02lx", slave_calls, slave_addr);
+	CHECK(smbus_calls == 1 && last_smbus.size == I2C_SMBUS_BLOCK_DATA &&
+	      last_smbus.read_write == I2C_SMBUS_READ &&
+	      last_smbus.command == 0x20,
+	      "%d I2C_SMBUS calls, size %u", smbus_calls, last_smbus.size);
+	for (i = 0; i < I2C_SMBUS_BLOCK_MAX; i++)
+		bad += values[i] != pattern(i);
+	CHECK(bad == 0, "%d of 32 read bytes wrong", bad);
+
+	reset(1);
+	for (i = 0; i < I2C_SMBUS_BLOCK_MAX; i++)
+		values[i] = pattern(i);
+	ret = i2c_smbus3_write_block_data(FILE_FD, ADDR, 0x21,
+					  I2C_SMBUS_BLOCK_MAX, values);
+	CHECK(ret == 0, "fallback write returned %d", ret);
+	CHECK(smbus_calls == 1 && last_smbus.size == I2C_SMBUS_BLOCK_DATA &&
+	      last_block[0] == I2C_SMBUS_BLOCK_MAX &&
+	      memcmp(last_block + 1, values, I2C_SMBUS_BLOCK_MAX) == 0,
+	      "fallback write of %d bytes", last_block[0]);
+
+	reset(1);
+	ret = i2c_smbus3_block_process_call(FILE_FD, ADDR, 0x22, 4, values);
+	CHECK(ret == I2C_SMBUS_BLOCK_MAX, "fallback process call returned %d",
+	      ret);
+	CHECK(smbus_calls == 1 &&
+	      last_smbus.size == I2C_SMBUS_BLOCK_PROC_CALL &&
+	      last_block[0] == 4,
+	      "fallback process call size %u count %d",
+	      last_smbus.size, last_block[0]);
+}
+
+/* Blocks longer than SMBus 2 allows are refused, not cut short */
+static void test_fallback_too_long(void)
+{
+	__u8 values[I2C_SMBUS3_BLOCK_MAX];
+	__s32 ret;
+
+	memset(values, 0, sizeof(values));
+	reset(1);
+	ret = i2c_smbus3_write_block_data(FILE_FD, ADDR, 0x21,
+					  I2C_SMBUS_BLOCK_MAX + 1, values);
+	CHECK(ret == -EOPNOTSUPP, "write of 33 bytes returned %d", ret);
+	CHECK(smbus_calls == 0, "write of 33 bytes went out with I2C_SMBUS");
+
+	reset(1);
+	ret = i2c_smbus3_block_process_call(FILE_FD, ADDR, 0x22,
+					    I2C_SMBUS3_BLOCK_MAX, values);
+	CHECK(ret == -EOPNOTSUPP, "process call of 255 bytes returned %d",
+	      ret);
+	CHECK(smbus_calls == 0,
+	      "process call of 255 bytes went out with I2C_SMBUS");
+}
+
+int main(void)
+{
+	test_read();
+	test_write();
+	test_process_call();
+	test_fallback();
+	test_fallback_too_long();
+	return CHECK_DONE();
+}
@@ -14,11 +14,13 @@ TOOLS_CFLAGS	+= -Wstrict-prototypes -Wshadow -Wpointer-arith -Wcast-qual \
 		   -W -Wundef -Wmissing-prototypes -Iinclude
 ifeq ($(USE_STATIC_LIB),1)
 TOOLS_LDFLAGS	+= $(LIB_DIR)/$(LIB_STLIBNAME)
+RIP_LDFLAGS	:= $(LIB_DIR)/$(RIP_STLIBNAME)
 else
 TOOLS_LDFLAGS	+= -L$(LIB_DIR) -li2c
+RIP_LDFLAGS	:= -L$(LIB_DIR) -lrip
 endif
 
-TOOLS_TARGETS	:= i2cdetect i2cdump i2cset i2cget i2ctransfer i2crip
+TOOLS_TARGETS	:= i2cdetect i2cdump i2cset i2cget i2ctransfer i2crip i2cripc i2ctop
 
 #
 # Programs
@@ -39,7 +41,13 @@ $(TOOLS_DIR)/i2cget: $(TOOLS_DIR)/i2cget.o $(TOOLS_DIR)/i2cbusses.o $(TOOLS_DIR)
 $(TOOLS_DIR)/i2ctransfer: $(TOOLS_DIR)/i2ctransfer.o $(TOOLS_DIR)/i2cbusses.o $(TOOLS_DIR)/util.o $(LIB_DEPS)
 	$(CC) $(LDFLAGS) -o $@ $^ $(TOOLS_LDFLAGS)
 
-$(TOOLS_DIR)/i2crip: $(TOOLS_DIR)/i2crip.o $(TOOLS_DIR)/i2cbusses.o $(TOOLS_DIR)/util.o $(LIB_DEPS)
+$(TOOLS_DIR)/i2crip: $(TOOLS_DIR)/i2crip.o $(TOOLS_DIR)/i2cripsim.o $(TOOLS_DIR)/i2cripstats.o $(TOOLS_DIR)/i2cripresults.o $(TOOLS_DIR)/i2cripd.o $(TOOLS_DIR)/i2cbusses.o $(TOOLS_DIR)/util.o $(RIP_DEPS) $(LIB_DEPS)
+	$(CC) $(LDFLAGS) -o $@ $^ $(RIP_LDFLAGS) $(TOOLS_LDFLAGS) -lpthread
+
+$(TOOLS_DIR)/i2cripc: $(TOOLS_DIR)/i2cripc.o $(TOOLS_DIR)/i2cripd.o
+	$(CC) $(LDFLAGS) -o $@ $^
+
+$(TOOLS_DIR)/i2ctop: $(TOOLS_DIR)/i2ctop.o $(TOOLS_DIR)/i2cbusses.o $(LIB_DEPS)
 	$(CC) $(LDFLAGS) -o $@ $^ $(TOOLS_LDFLAGS)
 
 #
@@ -58,16 +66,34 @@ $(TOOLS_DIR)/i2cset.o: $(TOOLS_DIR)/i2cset.c $(TOOLS_DIR)/i2cbusses.h $(TOOLS_DI
 $(TOOLS_DIR)/i2cget.o: $(TOOLS_DIR)/i2cget.c $(TOOLS_DIR)/i2cbusses.h $(TOOLS_DIR)/util.h version.h $(INCLUDE_DIR)/i2c/smbus.h
 	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
 
-$(TOOLS_DIR)/i2ctransfer.o: $(TOOLS_DIR)/i2ctransfer.c $(TOOLS_DIR)/i2cbusses.h $(TOOLS_DIR)/util.h version.h
+$(TOOLS_DIR)/i2ctransfer.o: $(TOOLS_DIR)/i2ctransfer.c $(TOOLS_DIR)/i2cbusses.h $(TOOLS_DIR)/util.h version.h $(INCLUDE_DIR)/i2c/smbus.h
 	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
 
-$(TOOLS_DIR)/i2cbusses.o: $(TOOLS_DIR)/i2cbusses.c $(TOOLS_DIR)/i2cbusses.h
+$(TOOLS_DIR)/i2cbusses.o: $(TOOLS_DIR)/i2cbusses.c $(TOOLS_DIR)/i2cbusses.h $(INCLUDE_DIR)/i2c/stats.h $(INCLUDE_DIR)/i2c/lock.h
 	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
 
 $(TOOLS_DIR)/util.o: $(TOOLS_DIR)/util.c $(TOOLS_DIR)/util.h
 	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
 
-$(TOOLS_DIR)/i2crip.o: $(TOOLS_DIR)/i2crip.c $(TOOLS_DIR)/i2crip.h $(TOOLS_DIR)/i2cbusses.h $(TOOLS_DIR)/util.h version.h $(INCLUDE_DIR)/i2c/smbus.h
+$(TOOLS_DIR)/i2crip.o: $(TOOLS_DIR)/i2crip.c $(TOOLS_DIR)/i2crip.h $(TOOLS_DIR)/i2cripsim.h $(TOOLS_DIR)/i2cripstats.h $(TOOLS_DIR)/i2cripresults.h $(TOOLS_DIR)/i2cripd.h $(TOOLS_DIR)/i2cbusses.h $(TOOLS_DIR)/util.h version.h $(INCLUDE_DIR)/i2c/smbus.h $(INCLUDE_DIR)/i2c/rip.h
+	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
+
+$(TOOLS_DIR)/i2cripsim.o: $(TOOLS_DIR)/i2cripsim.c $(TOOLS_DIR)/i2cripsim.h
+	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
+
+$(TOOLS_DIR)/i2cripstats.o: $(TOOLS_DIR)/i2cripstats.c $(TOOLS_DIR)/i2cripstats.h
+	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
+
+$(TOOLS_DIR)/i2cripresults.o: $(TOOLS_DIR)/i2cripresults.c $(TOOLS_DIR)/i2cripresults.h
+	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
+
+$(TOOLS_DIR)/i2cripd.o: $(TOOLS_DIR)/i2cripd.c $(TOOLS_DIR)/i2cripd.h
+	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
+
+$(TOOLS_DIR)/i2cripc.o: $(TOOLS_DIR)/i2cripc.c $(TOOLS_DIR)/i2cripd.h version.h
+	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
+
+$(TOOLS_DIR)/i2ctop.o: $(TOOLS_DIR)/i2ctop.c $(TOOLS_DIR)/i2cbusses.h version.h $(INCLUDE_DIR)/i2c/stats.h
 	$(CC) $(CFLAGS) $(TOOLS_CFLAGS) -c $< -o $@
 
 #
@@ -39,9 +39,11 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include "i2cbusses.h"
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
+#include <i2c/stats.h>
 
 enum adt { adt_dummy, adt_isa, adt_i2c, adt_smbus, adt_unknown };
 
@@ -417,7 +419,7 @@ int parse_i2c_address(const char *address_arg, int all_addrs)
 
 int open_i2c_dev(int i2cbus, char *filename, size_t size, int quiet)
 {
-	int file, len;
+	int file, len, err;
 
 	len = snprintf(filename, size, "/dev/i2c/%d", i2cbus);
 	if (len >= (int)size) {
@@ -448,9 +450,111 @@ int open_i2c_dev(int i2cbus, char *filename, size_t size, int quiet)
 		}
 	}
 
+	/* Opt in to the shared transfer counters read by i2ctop */
+	if (file >= 0 && getenv("I2C_STATS")) {
+		err = i2c_stats_attach(file, i2cbus);
+		if (err < 0 && !quiet)
+			fprintf(stderr, "Warning: Could not attach transfer "
+				"counters: %s\n", strerror(-err));
+	}
+
 	return file;
 }
 
+static void wait_timeout(int sig)
+{
+	(void)sig;
+}
+
+/* Waits for the bus at most timeout seconds: SIGALRM, installed without
+   SA_RESTART, breaks the blocking lock calls with EINTR */
+static int lock_i2c_bus_timeout(int file, int priority, int timeout)
+{
+	struct sigaction sa, old_sa;
+	int ret;
+
+	if (timeout < 0)
+		return i2c_bus_lock(file, priority, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = wait_timeout;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGALRM, &sa, &old_sa) < 0)
+		return -errno;
+	alarm(timeout);
+	ret = i2c_bus_lock(file, priority, 1);
+	alarm(0);
+	sigaction(SIGALRM, &old_sa, NULL);
+	return ret == -EINTR ? -ETIMEDOUT : ret;
+}
+
+/* Takes the bus at the priority of $I2C_BUS_PRIORITY for the rest of
+   the process, or until the file is closed. A bus held by another job
+   is waited for as long as $I2C_BUS_WAIT allows. */
+int lock_i2c_dev(int file, int i2cbus)
+{
+	int priority = lookup_i2c_priority();
+	int timeout = -1, ret;
+
+	ret = i2c_bus_lock(file, priority, 0);
+	if (ret == -EWOULDBLOCK) {
+		timeout = lookup_i2c_wait();
+		if (timeout == 0) {
+			fprintf(stderr, "Error: Bus %d is held by another "
+				"job\n", i2cbus);
+			return ret;
+		}
+		fprintf(stderr, "Waiting for bus %d held by another job\n",
+			i2cbus);
+		ret = lock_i2c_bus_timeout(file, priority, timeout);
+	}
+
+	if (ret == -ETIMEDOUT)
+		fprintf(stderr, "Error: Bus %d still held by another job "
+			"after %d seconds\n", i2cbus, timeout);
+	else if (ret < 0)
+		fprintf(stderr, "Error: Could not lock bus: %s\n",
+			strerror(-ret));
+	return ret;
+}
+
+/* Seconds to wait for a bus held by another job, from $I2C_BUS_WAIT,
+   -1 to wait as long as it takes */
+int lookup_i2c_wait(void)
+{
+	const char *env = getenv("I2C_BUS_WAIT");
+	char *end;
+	long timeout;
+
+	if (env == NULL || *env == '\0')
+		return -1;
+	timeout = strtol(env, &end, 0);
+	if (*end || timeout < 0 || timeout > INT_MAX) {
+		fprintf(stderr, "Warning: Ignoring I2C_BUS_WAIT, "
+			"not a number of seconds\n");
+		return -1;
+	}
+	return (int)timeout;
+}
+
+/* Priority of the jobs of this process, from $I2C_BUS_PRIORITY */
+int lookup_i2c_priority(void)
+{
+	const char *env = getenv("I2C_BUS_PRIORITY");
+	char *end;
+	long priority;
+
+	if (env == NULL || *env == '\0')
+		return 0;
+	priority = strtol(env, &end, 0);
+	if (*end || priority < 0 || priority > I2C_BUS_PRIORITY_MAX) {
+		fprintf(stderr, "Warning: Ignoring I2C_BUS_PRIORITY, "
+			"not a number from 0 to %d\n", I2C_BUS_PRIORITY_MAX);
+		return 0;
+	}
+	return (int)priority;
+}
+
 int set_slave_addr(int file, int address, int force)
 {
 	/* With force, let the user read from/write to the registers
@@ -462,5 +566,6 @@ int set_slave_addr(int file, int address, int force)
 		return -errno;
 	}
 
+	i2c_stats_set_slave(file, address);
 	return 0;
 }
@@ -23,6 +23,7 @@
 #define _I2CBUSSES_H
 
 #include <unistd.h>
+#include <i2c/lock.h>
 
 struct i2c_adap {
 	int nr;
@@ -39,6 +40,11 @@ int parse_i2c_address(const char *address_arg, int all_addrs);
 int open_i2c_dev(int i2cbus, char *filename, size_t size, int quiet);
 int set_slave_addr(int file, int address, int force);
 
+/* Bus locks taken with i2c_bus_lock(), see i2c/lock.h */
+int lookup_i2c_priority(void);
+int lookup_i2c_wait(void);
+int lock_i2c_dev(int file, int i2cbus);
+
 #define MISSING_FUNC_FMT	"Error: Adapter does not have %s capability\n"
 
 #endif
@@ -386,6 +386,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (lock_i2c_dev(file, i2cbus) < 0)
+		exit(1);
+
 	res = scan_i2c_bus(file, mode, funcs, first, last);
 
 	close(file);
@@ -286,6 +286,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (lock_i2c_dev(file, i2cbus) < 0)
+		exit(1);
+
 	/* See Winbond w83781d data sheet for bank details */
 	if (bank) {
 		res = i2c_smbus_read_byte_data(file, bankreg);
@@ -268,6 +268,9 @@ int main(int argc, char *argv[])
 	if (!yes && !confirm(filename, address, size, daddress, length, pec))
 		exit(0);
 
+	if (lock_i2c_dev(file, i2cbus) < 0)
+		exit(1);
+
 	if (pec && ioctl(file, I2C_PEC, 1) < 0) {
 		fprintf(stderr, "Error: Could not set PEC: %s\n",
 			strerror(errno));
@@ -21,7 +21,18 @@
 */
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,48 +46,97 @@
 #include "util.h"
 #include "../version.h"
 #include "i2crip.h"
+#include "i2cripsim.h"
+#include "i2cripstats.h"
+#include "i2cripresults.h"
+#include "i2cripd.h"
 
 /////////////////////// MACROS ////////////////////////
 
-#define IS_LOG_ENABLED ((g_logToTerm || g_logToFile) && !g_quietMode)
+#define IS_STATS_ENABLED (t_stats != NULL)
+#define IS_RESULTS_ENABLED (g_results != NULL)
+#define IS_ARBITRATED (!g_simulate)
 
 /////////////////////// Global Vars ////////////////////////
 
-static __u8 g_logToTerm = 1;	// Default on
-static __u8 g_logToFile = 0;
-static __u8 g_logFileOpen = 0;
-static FILE* g_logFile = NULL;
+static struct i2c_rip_ctx* g_ctx = NULL;
+static unsigned int g_ripFlags = 0;
 static __u8 g_simulate = 0;
-static __u8 g_debug = 0;
-static __u8 g_supressErrors = 0;
-static __u8 g_quietMode = 0;
 static int g_i2cRipCmdListLength = 0;
-static i2cRipCmdStruct_t* g_i2cRipCmdList = NULL;
+static int g_i2cRipCmdListSize = 0;
+static struct i2c_rip_cmd* g_i2cRipCmdList = NULL;
 static int g_cmdToLineNumberSize = 0;
 static int* g_cmdToLineNumber = NULL;
-static i2cBusConnection_t g_i2cBusFiles[I2C_MAX_BUSSES];
+static __u8 g_mergeWrites = 0;
+static __u8 g_optimize = 0;
+static struct i2c_rip_arena g_i2cRipPayload = {NULL, 0, 0};
+static __u8 g_useCache = 1;
+static __u64 g_sourceHash = 0;
+static size_t g_sourceLength = 0;
+static __u8 g_cacheWarned = 0;
+static char* g_imageMap = NULL;
+static size_t g_imageMapSize = 0;
+static __u8 g_parallel = 0;
+static int* g_cmdStream = NULL;
+static __thread i2cRipLogCapture_t* t_logCapture = NULL;
+static __u8 g_logAsyncEnabled = 1;
+static __u8 g_logAsync = 0;
+static i2cRipLogRecord_t* g_logRing = NULL;
+static atomic_uint g_logHead;
+static atomic_uint g_logTail;
+static atomic_int g_logStop;
+static pthread_t g_logThread;
+static char g_logOut[I2C_RIP_LOG_NUM_DESTS][I2C_RIP_LOG_BUFF_SIZE];
+static int g_logOutLength[I2C_RIP_LOG_NUM_DESTS];
+static i2cRipStats_t* g_stats = NULL;
+static const char* g_statsJson = NULL;
+static const char* g_cmdNames[I2C_RIP_NUM_CMDS];
+static __thread i2cRipStats_t* t_stats = NULL;
+static __u8 g_validateFirst = 0;
+static __u8 g_streaming = 0;
+static char* g_streamMap = NULL;
+static size_t g_streamSize = 0;
+static atomic_uint g_streamHead;
+static atomic_uint g_streamTail;
+static atomic_int g_streamDone;
+static atomic_int g_streamStop;
+static int g_streamOk = 0;
+static int g_streamNumCmds = 0;
+static __u64 g_streamParseNs = 0;
+static __u8* g_streamPayload[I2C_RIP_STREAM_QUEUE_SIZE];
+static int g_streamPayloadSize[I2C_RIP_STREAM_QUEUE_SIZE];
+static i2cRipLogCapture_t g_streamLog;
+static i2cRipStreamRest_t g_streamRest;
+static __u8 g_daemon = 0;
+static const char* g_daemonPath = NULL;
+static volatile sig_atomic_t g_daemonStop = 0;
+static i2cRipDaemonCached_t g_daemonCache[I2C_RIP_DAEMON_CACHE_SIZE];
+static __u64 g_daemonUses = 0;
+static int g_busPriority = 0;
+static const char* g_resultsFile = NULL;
+static i2cRipResults_t* g_results = NULL;
 
 /////////////////// FUNCTIONS //////////////////
 
+static void logAsyncStop(void);
+static void resultsFinish(void);
+
 // Frees all allocated memory and exits program
 static void i2cRipExit(int val){
-	if(g_logFileOpen){
-		fclose(g_logFile);
-	}
-	if(!g_simulate){
-		for(int i = 0; i < I2C_MAX_BUSSES; i++){
-			if(g_i2cBusFiles[i].m_isConnected){
-				close(g_i2cBusFiles[i].m_file);
-			}
-			g_i2cBusFiles[i].m_isConnected = 0;
-		}
+	logAsyncStop();
+	resultsFinish();
+	// Closes the busses and the log file
+	i2c_rip_ctx_free(g_ctx);
+	if(g_imageMap != NULL){
+		munmap(g_imageMap, g_imageMapSize);
 	}
-	if(g_i2cRipCmdListLength > 0){
+	else{
 		free(g_i2cRipCmdList);
-	}
-	if(g_cmdToLineNumberSize > 0){
 		free(g_cmdToLineNumber);
 	}
+	i2c_rip_arena_free(&g_i2cRipPayload);
+	free(g_cmdStream);
+	i2cRipStatsFree(g_stats);
 	exit(val);
 }
 
@@ -89,33 +149,276 @@ static void printToTerm(const char* fmt, ...){
 }
 
 
+// Writes a whole buffer, retrying short writes
+static void writeAll(int fd, const char* text, int length){
+	while(length > 0){
+		ssize_t n = write(fd, text, length);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return;
+		}
+		text += n;
+		length -= n;
+	}
+}
+
+// Writes out the logger's buffer for one destination
+static void logOutFlush(int index){
+	static const int fds[] = {-1, STDOUT_FILENO, STDERR_FILENO};
+
+	if(g_logOutLength[index] > 0){
+		writeAll((index == 0) ? fileno(i2c_rip_ctx_log_file(g_ctx)) : fds[index], g_logOut[index], g_logOutLength[index]);
+		g_logOutLength[index] = 0;
+	}
+}
+
+// Adds text to the logger's buffers, one per destination
+static void logOutAppend(__u8 dest, const char* text, int length){
+	for(int i = 0; i < I2C_RIP_LOG_NUM_DESTS; i++){
+		if(!(dest & (1 << i))){
+			continue;
+		}
+		if(g_logOutLength[i] + length > I2C_RIP_LOG_BUFF_SIZE){
+			logOutFlush(i);
+		}
+		memcpy(&g_logOut[i][g_logOutLength[i]], text, length);
+		g_logOutLength[i] += length;
+	}
+}
+
+// Logger thread, formats records from the ring and writes them out in large blocks
+static void* logThreadMain(void* arg){
+	char text[I2C_RIP_LOG_FORMAT_MAX];
+	(void)arg;
+
+	for(;;){
+		unsigned int tail = atomic_load_explicit(&g_logTail, memory_order_relaxed);
+		unsigned int head = atomic_load_explicit(&g_logHead, memory_order_acquire);
+
+		if(tail == head){
+			for(int i = 0; i < I2C_RIP_LOG_NUM_DESTS; i++){
+				logOutFlush(i);
+			}
+			if(atomic_load(&g_logStop) && atomic_load(&g_logHead) == tail){
+				break;
+			}
+			struct timespec idle = {0, 200000};
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		for(; tail != head; tail++){
+			const i2cRipLogRecord_t* rec = &g_logRing[tail & (I2C_RIP_LOG_RING_SIZE - 1)];
+			if(rec->m_isTransfer){
+				logOutAppend(rec->m_dest, text, i2c_rip_format_xfer(text, &rec->m_u.m_transfer));
+			}
+			else{
+				logOutAppend(rec->m_dest, rec->m_u.m_text, rec->m_length);
+			}
+		}
+		atomic_store_explicit(&g_logTail, tail, memory_order_release);
+	}
+	return NULL;
+}
+
+// Claims the next free record, waits for the logger when the ring is full
+static i2cRipLogRecord_t* logRingClaim(void){
+	unsigned int head = atomic_load_explicit(&g_logHead, memory_order_relaxed);
+
+	while(head - atomic_load_explicit(&g_logTail, memory_order_acquire) >= I2C_RIP_LOG_RING_SIZE){
+		sched_yield();
+	}
+	return &g_logRing[head & (I2C_RIP_LOG_RING_SIZE - 1)];
+}
+
+// Hands the claimed record to the logger
+static void logRingPublish(void){
+	unsigned int head = atomic_load_explicit(&g_logHead, memory_order_relaxed);
+	atomic_store_explicit(&g_logHead, head + 1, memory_order_release);
+}
+
+// Queues finished text, split over as many records as needed
+static void logRingText(__u8 dest, const char* text, int length){
+	while(length > 0){
+		int chunk = (length > I2C_RIP_LOG_TEXT_MAX) ? I2C_RIP_LOG_TEXT_MAX : length;
+		i2cRipLogRecord_t* rec = logRingClaim();
+		rec->m_isTransfer = 0;
+		rec->m_dest = dest;
+		rec->m_length = chunk;
+		memcpy(rec->m_u.m_text, text, chunk);
+		logRingPublish();
+		text += chunk;
+		length -= chunk;
+	}
+}
+
+// Starts the logger thread, log output from the main thread goes through it
+static void logAsyncStart(void){
+	g_logRing = (i2cRipLogRecord_t *)malloc(sizeof(i2cRipLogRecord_t) * I2C_RIP_LOG_RING_SIZE);
+	if(g_logRing == NULL){
+		return;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	atomic_store(&g_logHead, 0);
+	atomic_store(&g_logTail, 0);
+	atomic_store(&g_logStop, 0);
+	if(pthread_create(&g_logThread, NULL, logThreadMain, NULL) != 0){
+		free(g_logRing);
+		g_logRing = NULL;
+		return;
+	}
+	g_logAsync = 1;
+}
+
+// Drains the ring and stops the logger thread
+static void logAsyncStop(void){
+	if(!g_logAsync){
+		return;
+	}
+	atomic_store(&g_logStop, 1);
+	pthread_join(g_logThread, NULL);
+	g_logAsync = 0;
+	free(g_logRing);
+	g_logRing = NULL;
+}
+
+// Writes finished log text to its destinations
+static void logWrite(__u8 dest, const char* text, int length){
+	FILE* logFile = i2c_rip_ctx_log_file(g_ctx);
+
+	if(g_logAsync){
+		logRingText(dest, text, length);
+		return;
+	}
+	if((dest & I2C_RIP_LOG_FILE) && logFile != NULL){
+		fwrite(text, 1, length, logFile);
+	}
+	if(dest & I2C_RIP_LOG_STDOUT){
+		fwrite(text, 1, length, stdout);
+	}
+	if(dest & I2C_RIP_LOG_STDERR){
+		fwrite(text, 1, length, stderr);
+	}
+}
+
+// Adds log text of a command to the capture of a worker thread
+// Output of the same command and destination is kept as one entry
+static void logCapture(i2cRipLogCapture_t* capture, int cmdIndex, __u8 dest, const char* text, int length){
+	if(capture->m_textLength + length > capture->m_textSize){
+		int newSize = (capture->m_textSize > 0) ? capture->m_textSize : 4096;
+		while(newSize - capture->m_textLength < length){
+			newSize *= 2;
+		}
+		char* newText = (char *)realloc(capture->m_text, newSize);
+		if(newText == NULL){
+			return;
+		}
+		capture->m_text = newText;
+		capture->m_textSize = newSize;
+	}
+	memcpy(&capture->m_text[capture->m_textLength], text, length);
+
+	i2cRipLogEntry_t* last = (capture->m_numEntries > 0) ? &capture->m_entries[capture->m_numEntries - 1] : NULL;
+	if(last != NULL && last->m_cmdIndex == cmdIndex && last->m_dest == dest &&
+			last->m_offset + last->m_length == capture->m_textLength){
+		last->m_length += length;
+	}
+	else{
+		if(capture->m_numEntries >= capture->m_entriesSize){
+			int newSize = (capture->m_entriesSize > 0) ? capture->m_entriesSize * 2 : 256;
+			i2cRipLogEntry_t* entries = (i2cRipLogEntry_t *)realloc(capture->m_entries, sizeof(i2cRipLogEntry_t) * newSize);
+			if(entries == NULL){
+				return;
+			}
+			capture->m_entries = entries;
+			capture->m_entriesSize = newSize;
+		}
+		i2cRipLogEntry_t* entry = &capture->m_entries[capture->m_numEntries];
+		entry->m_cmdIndex = cmdIndex;
+		entry->m_seq = capture->m_numEntries;
+		entry->m_offset = capture->m_textLength;
+		entry->m_length = length;
+		entry->m_dest = dest;
+		capture->m_numEntries++;
+	}
+	capture->m_textLength += length;
+}
+
+// Log output of the script engine
+// Worker threads capture it to be written later in script order
+static void ripLog(void* user, int cmdIndex, unsigned int dest, const char* text, int length){
+	(void)user;
+	if(t_logCapture != NULL){
+		logCapture(t_logCapture, cmdIndex, (__u8)dest, text, length);
+		return;
+	}
+	logWrite((__u8)dest, text, length);
+}
+
+// Transfers are formatted by the logger thread when there is one
+static void ripLogXfer(void* user, int cmdIndex, unsigned int dest, const struct i2c_rip_xfer* xfer){
+	char text[I2C_RIP_LOG_FORMAT_MAX];
+
+	if(g_logAsync && t_logCapture == NULL){
+		i2cRipLogRecord_t* rec = logRingClaim();
+		rec->m_isTransfer = 1;
+		rec->m_dest = (__u8)dest;
+		rec->m_u.m_transfer = *xfer;
+		logRingPublish();
+		return;
+	}
+	ripLog(user, cmdIndex, dest, text, i2c_rip_format_xfer(text, xfer));
+}
+
+// Formats a message of the front end and sends it to its destinations
+static void logOutput(unsigned int dest, const char* fmt, va_list args){
+	char text[I2C_RIP_LOG_FORMAT_MAX];
+	va_list copy;
+
+	va_copy(copy, args);
+	int length = vsnprintf(text, sizeof(text), fmt, copy);
+	va_end(copy);
+	if(length <= 0){
+		return;
+	}
+	if(length < (int)sizeof(text)){
+		ripLog(NULL, 0, dest, text, length);
+		return;
+	}
+	char* big = (char *)malloc(length + 1);
+	if(big != NULL){
+		vsnprintf(big, length + 1, fmt, args);
+		ripLog(NULL, 0, dest, big, length);
+		free(big);
+	}
+}
+
 // Logs errors messages
 static void logErrors(const char* fmt, ...){
-	if(!g_quietMode){
+	unsigned int dest = i2c_rip_ctx_log_dest(g_ctx, 1);
+
+	if(dest){
 		va_list args;
-		va_start(args, fmt);
-		
-		// File logging is optional
-		if(g_logToFile && g_logFileOpen){
-			vfprintf(g_logFile, fmt, args);
-		}
 
-		vfprintf(stderr, fmt, args);
+		va_start(args, fmt);
+		logOutput(dest, fmt, args);
 		va_end(args);
 	}
 }
 
 // Logs normal messages
 static void logMsg(const char* fmt, ...){
-	if(IS_LOG_ENABLED){
+	unsigned int dest = i2c_rip_ctx_log_dest(g_ctx, 0);
+
+	if(dest){
 		va_list args;
+
 		va_start(args, fmt);
-		if(g_logToFile && g_logFileOpen){
-			vfprintf(g_logFile, fmt, args);
-		}
-		if(g_logToTerm){
-			vfprintf(stdout, fmt, args);
-		}
+		logOutput(dest, fmt, args);
 		va_end(args);
 	}
 }
@@ -124,13 +427,30 @@ static void logMsg(const char* fmt, ...){
 static void help(void){
 	printToTerm(
 		"Usage: i2crip [ACTION] FILELOCATION\n"
+		"       i2crip -c [-m] [-O] -o OUTPUT FILELOCATION\n"
+		"       i2crip --daemon[=SOCKET] [-s] [-b] [-m] [-O] [--shadow] [--reconcile]\n"
 		"  ACTION is a flag to indicate read, write, or verify.\n"
 		"    -y (Yes))\n"
 		"    -s (Simulate)\n"
+		"    -S MODEL (Simulate devices described in MODEL)\n"
+		"    -b (Batch consecutive transfers into one I2C_RDWR call)\n"
+		"    -m (Merge byte writes to consecutive registers into block writes)\n"
+		"    -O (Optimize, remove redundant selections, overwritten writes and fold DELAYs)\n"
+		"    -c (Compile script to OUTPUT instead of running it)\n"
+		"    -n (No script cache)\n"
+		"    -p (Parallel, run each bus on its own thread)\n"
 		"    -q (Quiet)\n"
+		"    -u (Unbuffered, log from the bus thread instead of a logger thread)\n"
+		"    --stats[=FILE] (Print latency statistics, and write them to FILE as JSON)\n"
+		"    --shadow (Skip writes of values registers are known to hold)\n"
+		"    --reconcile (Read back registers the script writes, only write those that differ, implies --shadow)\n"
+		"    --validate-first (Parse the whole script before running it, instead of while it runs)\n"
+		"    --daemon[=SOCKET] (Serve scripts from i2cripc on a local socket, keeping busses open)\n"
+		"    --priority=N (Bus priority 0-7, higher jobs get busses first and between commands of lower ones)\n"
+		"    --results=FILE (Write the data of every read to FILE as fixed size binary records)\n"
 		"    -h (Help)\n"
 		"    -v (Version)\n"
-		"  FILELOCATION is the path to the intput file\n");
+		"  FILELOCATION is the path to the intput file, text or compiled\n");
 }
 
 // Help function returns a message on how to use i2cRip
@@ -140,10 +460,15 @@ static void bigHelp(void) {
         "I2cTool Commands:\n"
         "  SET-BUS <bus_number>: Set the I2C bus to the specified bus number.\n"
         "  SET-ID <device_address>: Set the I2C device ID to the specified address.\n"
+        "  SET-BURST <bytes>: Max data bytes per merged write (-m) or block chunk for the current device, 0 disables merging.\n"
         "  SUPPRESS-ERRORS [1|0]: Enable (1) to suppress errors, or (0) to enable error detection.\n"
         "  LOG-FILE [1|0]: Enable (1) to log data to 'i2cRip.log', or (0) to disable data logging (default location).\n"
         "  LOG-TERM [1|0]: Enable (1) to log data to the terminal, or (0) to disable terminal logging.\n"
         "  DELAY <milliseconds>: Create a specified duration delay in milliseconds.\n"
+        "  SYNC: Wait for all busses before going on (-p).\n"
+        "  POLL-8 <register_address> <mask> <expected> <timeout_ms>: Read 1 byte from the 8-bit address until (data & mask) == expected.\n"
+        "  POLL-16 <register_address> <mask> <expected> <timeout_ms>: Read 1 byte from the 16-bit address until (data & mask) == expected.\n"
+        "  POLL-INTERVAL <initial_us> <max_us>: Time between polls, doubled after every read up to max_us.\n"
         "  RB-8 <register_address>: Read 1 byte from the 8-bit address.\n"
         "  RB-16 <register_address>: Read 1 byte from the 16-bit address.\n"
         "  RW-8 <register_address>: Read 1 word (2 bytes) from the 8-bit address.\n"
@@ -156,6 +481,20 @@ static void bigHelp(void) {
         "  VB-16 <register_address> <expected_data>: Read 1 byte and compare it to the expected data.\n"
         "  VW-8 <register_address> <expected_data>: Read 2 bytes and compare them to the expected data.\n"
         "  VW-16 <register_address> <expected_data>: Read 2 bytes and compare them to the expected data.\n"
+        "  WBLK-8 <register_address> <hex_bytes>: Write the bytes to consecutive registers from the 8-bit address.\n"
+        "  WBLK-16 <register_address> <hex_bytes>: Write the bytes to consecutive registers from the 16-bit address.\n"
+        "  RBLK-8 <register_address> <length>: Read length bytes from the 8-bit address on.\n"
+        "  RBLK-16 <register_address> <length>: Read length bytes from the 16-bit address on.\n"
+        "  VBLK-8 <register_address> <hex_bytes>: Read from the 8-bit address on and compare to the bytes.\n"
+        "  VBLK-16 <register_address> <hex_bytes>: Read from the 16-bit address on and compare to the bytes.\n"
+        "  Block bytes are pairs of hex digits, e.g. 0x0102a0ff or 01 02 a0 ff.\n"
+        "  LOOP <period_us> <count>: Run the commands up to END-LOOP count times, starting one every period_us.\n"
+        "  END-LOOP: End of the LOOP body.\n"
+        "  VOLATILE <first_register> <last_register>: Registers of the current device that change by themselves, never skipped (--shadow).\n"
+        "  WRITE-FILE-8 <register_address> <path> [chunk]: Write a binary file to consecutive registers from the 8-bit address.\n"
+        "  WRITE-FILE-16 <register_address> <path> [chunk]: Write a binary file to consecutive registers from the 16-bit address.\n"
+        "  VERIFY-FILE-8 <register_address> <path> [chunk]: Read a binary file back from the 8-bit address on and compare CRC32s.\n"
+        "  VERIFY-FILE-16 <register_address> <path> [chunk]: Read a binary file back from the 16-bit address on and compare CRC32s.\n"
         "  Use '0x' prefix for hexadecimal numbers throughout the script.\n"
         "  You can add comments using '//' within the command list.\n"
         "\n"
@@ -176,511 +515,1591 @@ static int confirm(void){
 	return 1;
 }
 
-// Parses one line
-// InputFileParser Calls this function
-static int parseLine(char* buffer, int size, i2cRipCmdStruct_t *i2cRipData){
-		int start = 0;
-		int argNum = 0;
-		int numArgReq = 0;
-		int endOfLine = 0;
-		char subString[20];
-		const int subStringSize = 20;
-		i2cRipData->m_cmd = I2C_RIP_INVALID;
-		i2cRipData->m_isValid = 0;
-		for(int i = 0; i < size; i++){
-			// Successful parse
-			if(endOfLine){
-				break;
-			}
+// Appends data to the payload arena
+// Returns offset of the data or -1 on failure
+static int payloadAppend(const __u8* data, int size){
+	int offset = i2c_rip_arena_append(&g_i2cRipPayload, data, size);
+	if(offset < 0){
+		logErrors("Error: Memory allocation failed\n");
+	}
+	return offset;
+}
 
-			// Ignore anything after "//" for comments
-			if(buffer[i] == '/'){
-				if(i + 1 < size){
-					if(buffer[i + 1] == '/'){
-						buffer[i] = '\0';
-					}
-				}
-			}
+// Parses one line, size is the line length without the newline
+// Block data and file paths go to the payload arena
+static int parseLine(const char* buffer, int size, struct i2c_rip_cmd *i2cRipData){
+	char error[I2C_RIP_LOG_FORMAT_MAX];
 
-			// If found argument
-			if((buffer[i] == ' ') || (buffer[i] == '\0') || (buffer[i] == '\t')){
-				if(buffer[i] == '\0'){
-					endOfLine = 1;
-				}
-				//Empty White space
-				if(start == i){
-					start++;
-					continue;
+	if(i2c_rip_parse_line(buffer, size, i2cRipData, &g_i2cRipPayload, error, sizeof(error)) < 0){
+		if(error[0] != '\0'){
+			logErrors("%s\n", error);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+// Parses script text with librip into the command list
+// Line numbers are always kept so compiled scripts carry them
+static int scriptParse(const char* text, size_t size){
+	struct i2c_rip_arena payload;
+	struct i2c_rip_cmd* cmds;
+	int* lines;
+	int numCmds;
+
+	if(i2c_rip_ctx_load(g_ctx, text, size) < 0){
+		return 0;
+	}
+	numCmds = i2c_rip_ctx_take_script(g_ctx, &cmds, &lines, &payload);
+	i2c_rip_arena_free(&g_i2cRipPayload);
+	g_i2cRipPayload = payload;
+	g_i2cRipCmdList = cmds;
+	g_cmdToLineNumber = lines;
+	g_i2cRipCmdListLength = numCmds;
+	g_i2cRipCmdListSize = numCmds;
+	g_cmdToLineNumberSize = numCmds;
+	return 1;
+}
+
+// Names of the command types for reports and statistics
+static void cmdNames(void){
+	for(int j = 0; j < I2C_RIP_NUM_CMDS; j++){
+		g_cmdNames[j] = i2c_rip_op_name(j);
+	}
+}
+
+// Compile pass folding runs of WB-8/WB-16 to consecutive registers
+// of one device into single auto-increment block writes
+// Merged commands keep the line number of the first write
+static int mergeSequentialWrites(void){
+	int bus = I2C_NO_BUS_SELECTED;
+	int address = I2C_INVALID_SLAVE_ADDRESS;
+	int numCmds = 0;
+	int numMerged = 0;
+	int numBlocks = 0;
+	__u8 block[MAX_READ_WRITE_SIZE];
+	int burst[I2C_MAX_BUSSES][I2C_MAX_SLAVES];
+
+	for(int i = 0; i < I2C_MAX_BUSSES; i++){
+		for(int j = 0; j < I2C_MAX_SLAVES; j++){
+			burst[i][j] = I2C_RIP_BURST_DEFAULT;
+		}
+	}
+
+	for(int i = 0; i < g_i2cRipCmdListLength; ){
+		struct i2c_rip_cmd* cmd = &g_i2cRipCmdList[i];
+		int deviceValid = (bus != I2C_NO_BUS_SELECTED) && (address >= 0) && (address < I2C_MAX_SLAVES);
+		int run = 1;
+		int dRegSize, maxAddr, limit, start, offset;
+
+		switch(cmd->op){
+			case I2C_RIP_SET_BUS:
+				bus = I2C_NO_BUS_SELECTED;
+				if(cmd->data.single >= 0 && cmd->data.single < I2C_MAX_BUSSES){
+					bus = cmd->data.single;
 				}
+				address = I2C_INVALID_SLAVE_ADDRESS;
+				break;
 
-				// Find Argument
-				if((i - start) >= subStringSize){
-					logErrors("Error: Argument too long\n");
-					return 0;
+			case I2C_RIP_SET_ID:
+				address = cmd->data.single;
+				break;
+
+			case I2C_RIP_SET_BURST:
+				if(deviceValid){
+					burst[bus][address] = cmd->data.single;
 				}
+				break;
 
-				strncpy(subString, &buffer[start], i - start);
-				subString[i - start] = '\0';
-				start = i + 1;
-
-				// If cmd not filled
-				if(i2cRipData->m_cmd == I2C_RIP_INVALID){
-					// Find Command
-					for(int j = 0; j < I2C_RIP_LOOKUP_TABLE_SIZE; j++){
-						if(strcmp(g_cmdLookUpTable[j].m_string, subString) == 0){
-							i2cRipData->m_cmd = g_cmdLookUpTable[j].m_cmd;
-							numArgReq = g_cmdLookUpTable[j].m_numArgs;
-							break;
-						}
-					}
-					// If unable to find command
-					if(i2cRipData->m_cmd == I2C_RIP_INVALID){
-						logErrors("Error: Invalid Cmd: %s\n", subString);
-						return 0;
-					}
+			case I2C_RIP_8_WRITE_BYTE:
+			case I2C_RIP_16_WRITE_BYTE:
+				if(!deviceValid){
+					break;
 				}
-				else{
-					long num = 0;
-					char *endptr;
-					int strLength = strlen(subString);
-					if(strLength > 2){
-						// Hex numbers
-						if(subString[0] == '0' && subString[1] == 'x'){
-							num = strtol(&subString[2], &endptr, 16);
-						}
-						else{
-							num = strtol(subString, &endptr, 10);
-						}
-					}
-					else{
-						// Decimal conversion
-						num = strtol(subString, &endptr, 10);
-					}
-					// Checks conversions
-					if (*endptr != '\0')
-					{
-						logErrors("Error: Invalid Arg: %s\n", subString);
-						return 0;
+				dRegSize = (cmd->op == I2C_RIP_8_WRITE_BYTE) ? 1 : 2;
+				maxAddr = (dRegSize == 1) ? 0xFF : 0xFFFF;
+				limit = i2c_rip_burst_limit(burst[bus][address], dRegSize);
+				start = (dRegSize == 1) ? cmd->data.byte8.addr : cmd->data.byte16.addr;
+
+				while(run < limit && i + run < g_i2cRipCmdListLength && start + run <= maxAddr){
+					struct i2c_rip_cmd* next = &g_i2cRipCmdList[i + run];
+					int nextAddr = (dRegSize == 1) ? next->data.byte8.addr : next->data.byte16.addr;
+					if(next->op != cmd->op || nextAddr != start + run){
+						break;
 					}
+					run++;
+				}
+				if(run < 2){
+					break;
+				}
 
-					switch(argNum++){
-						// First Argument
-						case 0:
-							switch(i2cRipData->m_cmd){
-								case I2C_RIP_SET_BUS:
-								case I2C_RIP_SET_ID:
-								case I2C_RIP_DELAY:
-								case I2C_RIP_SUPRESS_ERRORS:
-								case I2C_RIP_LOG_TO_FILE:
-								case I2C_RIP_LOG_TO_TERM:
-									i2cRipData->m_data.m_single = (int)num;
-									break;
-
-								case I2C_RIP_8_WRITE_BYTE:
-								case I2C_RIP_8_READ_BYTE:
-								case I2C_RIP_8_VERIFY_BYTE:
-									i2cRipData->m_data.m_8_8.m_addr = (__u8)num;
-									break;
-
-								case I2C_RIP_8_WRITE_WORD:
-								case I2C_RIP_8_READ_WORD:
-								case I2C_RIP_8_VERIFY_WORD:
-									i2cRipData->m_data.m_8_16.m_addr = (__u8)num;
-									break;
-
-								case I2C_RIP_16_WRITE_BYTE:
-								case I2C_RIP_16_READ_BYTE:
-								case I2C_RIP_16_VERIFY_BYTE:
-									i2cRipData->m_data.m_16_8.m_addr = (__u16)num;
-									break;
-
-								case I2C_RIP_16_WRITE_WORD:
-								case I2C_RIP_16_READ_WORD:
-								case I2C_RIP_16_VERIFY_WORD:
-									i2cRipData->m_data.m_16_16.m_addr = (__u16)num;
-									break;
-
-								default:
-									logErrors("Error: Invalid arguemts %s\n", subString);
-									return 0;
-							}
-							break;
-
-						// Second Argument
-						case 1:
-							switch(i2cRipData->m_cmd){
-								case I2C_RIP_8_WRITE_BYTE:
-								case I2C_RIP_8_READ_BYTE:
-								case I2C_RIP_8_VERIFY_BYTE:
-									i2cRipData->m_data.m_8_8.m_data = (__u8)num;
-									break;
-
-								case I2C_RIP_8_WRITE_WORD:
-								case I2C_RIP_8_READ_WORD:
-								case I2C_RIP_8_VERIFY_WORD:
-									i2cRipData->m_data.m_8_16.m_data = (__u16)num;
-									break;
-
-								case I2C_RIP_16_WRITE_BYTE:
-								case I2C_RIP_16_READ_BYTE:
-								case I2C_RIP_16_VERIFY_BYTE:
-									i2cRipData->m_data.m_16_8.m_data = (__u8)num;
-									break;
-
-								case I2C_RIP_16_WRITE_WORD:
-								case I2C_RIP_16_READ_WORD:
-								case I2C_RIP_16_VERIFY_WORD:
-									i2cRipData->m_data.m_16_16.m_data = (__u16)num;
-									break;
-
-								default:
-									logErrors("Error: Invalid arguemts %s\n", subString);
-									return 0;
-							}
-							break;
-
-						default:
-							logErrors("Error: Invalid arguemts %s\n", subString);
-							return 0;
-					}
+				for(int j = 0; j < run; j++){
+					union i2c_rip_data* data = &g_i2cRipCmdList[i + j].data;
+					block[j] = (dRegSize == 1) ? data->byte8.data : data->byte16.data;
 				}
-			}
-		}
-		if(argNum != numArgReq){
-			logErrors("Error: Invalid number of arguments got %d: needed %d\n", argNum, numArgReq);
-			return 0;
-		}
+				offset = payloadAppend(block, run);
+				if(offset < 0){
+					return 0;
+				}
+				cmd->op = (dRegSize == 1) ? I2C_RIP_8_WRITE_BLOCK : I2C_RIP_16_WRITE_BLOCK;
+				cmd->data.block.addr = (__u16)start;
+				cmd->data.block.length = (__u16)run;
+				cmd->data.block.offset = offset;
+				numMerged += run;
+				numBlocks++;
+				break;
 
-		// Empty lines parse successfully
-		// But command will not be valid
-		if(i2cRipData->m_cmd != I2C_RIP_INVALID){
-			i2cRipData->m_isValid = 1;
+			default:
+				break;
 		}
-		return 1;
-}
-
-// Gets one line of input file
-// InputFileParser Calls this function
-static int getLine(FILE* file, char* buffer, int size, int* endOfFile){
-	int ch;
-	*endOfFile = 0;
 
-	for(int i = 0; i < size; i++){
-		ch = fgetc(file);
-		
-		// Check for new line or EOF
-		if(ch == '\n' || ch == EOF){
-			if(ch == EOF){
-				*endOfFile = 1;
-			}
-			buffer[i] = '\0';
-			return 1;
+		// Compact list and line numbers in place
+		g_i2cRipCmdList[numCmds] = *cmd;
+		if(i < g_cmdToLineNumberSize){
+			g_cmdToLineNumber[numCmds] = g_cmdToLineNumber[i];
 		}
+		numCmds++;
+		i += run;
+	}
 
-		// Ignore
-		if (ch == '\r'){
-			i--;
-			continue;
-		}
+	if(g_cmdToLineNumberSize > 0){
+		g_cmdToLineNumberSize = numCmds;
+	}
+	g_i2cRipCmdListLength = numCmds;
+	logMsg("Merged %d writes into %d block writes\n", numMerged, numBlocks);
+	return 1;
+}
 
-		// put on buffer
-		buffer[i] = (char) ch;
+// "Line N: " of a command for the optimizer report, empty without line numbers
+static void optLineStr(int cmdIndex, char* str, int size){
+	str[0] = '\0';
+	if(cmdIndex >= 0 && cmdIndex < g_cmdToLineNumberSize){
+		snprintf(str, size, "Line %d: ", g_cmdToLineNumber[cmdIndex]);
 	}
+}
 
-	// Out of buffer
-	return 0;
+// Next command not yet removed by the optimizer, or the list length
+static int optNext(const __u8* removed, int i){
+	for(i++; i < g_i2cRipCmdListLength && removed[i]; i++){
+	}
+	return i;
 }
 
-// Parsing input file
-static int inputFileParser(const char* filename){
-	FILE *file = fopen(filename, "r");
-	int failed = 0;
-	int lines = 0;
-	int numOfCmds = 0;
-    char buffer[100];
-	int endOfFile = 0;
-
-    if (file == NULL) {
-		logErrors("File: %s could not be opened\n", filename);
-        return 0;
-    }	
-	for(lines = 0; !endOfFile ; lines++){
-		if(!getLine(file, buffer, 100, &endOfFile)){
-			logErrors("Error: Buffer too small, line number: %d\n", lines);
-			failed = 1;
-			break;
+// Index of the write that overwrites every register of the write at i
+// before the device sees any other command, -1 if there is none
+static int optOverwrittenBy(const __u8* removed, int i, int bus, int address){
+	int reg, dRegSize, length;
+	int scanBus = bus;
+	int scanAddress = address;
+
+	i2c_rip_write_range(&g_i2cRipCmdList[i], &reg, &dRegSize, &length);
+	for(int j = optNext(removed, i); j < g_i2cRipCmdListLength; j = optNext(removed, j)){
+		const struct i2c_rip_cmd* cmd = &g_i2cRipCmdList[j];
+		int nextReg, nextDRegSize, nextLength;
+
+		if(cmd->op == I2C_RIP_SET_BUS){
+			scanBus = cmd->data.single;
+			scanAddress = I2C_INVALID_SLAVE_ADDRESS;
 		}
-		
-		i2cRipCmdStruct_t i2cRipData;
-		if(!parseLine(buffer, 100, &i2cRipData)){
-			logErrors("Error: Failed to parse line: %d: %s\n", lines + 1, buffer);
-			failed = 1;
-			break;
+		else if(cmd->op == I2C_RIP_SET_ID){
+			scanAddress = cmd->data.single;
 		}
-		if (i2cRipData.m_isValid){
-			numOfCmds++;
+		else if(!i2c_rip_write_range(cmd, &nextReg, &nextDRegSize, &nextLength)){
+			return -1;
 		}
-
-		if(lines >= 100000){
-			logErrors("Error: File too large or in recursive loop\n");
-			failed = 1;
-			break;
+		else if(scanBus == bus && scanAddress == address){
+			if(nextDRegSize == dRegSize && nextReg <= reg && nextReg + nextLength >= reg + length){
+				return j;
+			}
+			return -1;
 		}
 	}
-    fclose(file);
+	return -1;
+}
 
-	if(failed){
+// Compile pass (-O) removing commands that do not change what devices see:
+// writes overwritten before any other command reaches the device, SET-ID of the
+// selected slave or followed by another selection, SET-BUS of the active bus
+// when no slave is selected or a SET-ID follows, and DELAYs folded into the one
+// before. Writes to VOLATILE registers are kept. Removed commands are reported,
+// the rest keep their line numbers
+static int optimizeCmds(void){
+	const int numIn = g_i2cRipCmdListLength;
+	__u8* removed = (__u8 *)calloc(numIn > 0 ? numIn : 1, 1);
+	ripCmdVolatile_t* volatiles = NULL;
+	int numVolatiles = 0;
+	int numSetBus = 0;
+	int numSetId = 0;
+	int numDelays = 0;
+	int numWrites = 0;
+	int bus = I2C_NO_BUS_SELECTED;
+	int address = I2C_INVALID_SLAVE_ADDRESS;
+	int numCmds = 0;
+	char lineStr[20];
+	char otherStr[20];
+
+	if(removed == NULL){
+		logErrors("Error: Memory allocation failed\n");
 		return 0;
 	}
+	cmdNames();
 
-	if(lines <= 0){
-		logErrors("Empty File\n");
-        return 0;
-	}
-
-	logMsg("Number of commands: %d\n", numOfCmds);
+	// Overwritten writes first, the selections they leave behind go next
+	for(int i = 0; i < numIn; i++){
+		const struct i2c_rip_cmd* cmd = &g_i2cRipCmdList[i];
+		int reg, dRegSize, length, by, isVolatile = 0;
 
-	// Allocate memory for commands
-	g_i2cRipCmdList = (i2cRipCmdStruct_t *)malloc(sizeof(i2cRipCmdStruct_t) * numOfCmds);
-	if (g_i2cRipCmdList == NULL) {
-        logErrors("Error: Memory allocation failed\n");
-        return 0;
-    }
-	g_i2cRipCmdListLength = numOfCmds;
-
-	// Allocate memory for Debugging
-	if(g_debug){
-		g_cmdToLineNumber = (int *)malloc(sizeof(int) * numOfCmds);
-		if (g_i2cRipCmdList == NULL) {
-			logErrors("Error: Memory allocation failed\n");
-			return 0;
+		if(cmd->op == I2C_RIP_SET_BUS){
+			bus = cmd->data.single;
+			address = I2C_INVALID_SLAVE_ADDRESS;
+			continue;
 		}
-		g_cmdToLineNumberSize = numOfCmds;
-	}
-
-
-	// INIT
-	for(int i = 0; i < g_i2cRipCmdListLength; i++){
-		g_i2cRipCmdList[i].m_cmd = I2C_RIP_INVALID;
-		g_i2cRipCmdList[i].m_isValid = 0;
-	}
-
-	// Open file again
-	file = fopen(filename, "r");
-	if (file == NULL) {
-        logErrors("File could not be opened\n");
-        return 0;
-    }
-
-	numOfCmds = 0;
-	endOfFile = 0;
-	for(int i = 0; !endOfFile && (numOfCmds < g_i2cRipCmdListLength); i++){
-		if(!getLine(file, buffer, 100, &endOfFile)){
-			logErrors("Error: Buffer too small, line number: %d\n", i + 1);
-			failed = 1;
-			break;
+		if(cmd->op == I2C_RIP_SET_ID){
+			address = cmd->data.single;
+			continue;
 		}
-		
-		if(!parseLine(buffer, 100, &g_i2cRipCmdList[numOfCmds])){
-			logErrors("Error: Failed to parse line: %d: %s\n", lines + 1, buffer);
-			failed = 1;
-			break;
+		if(cmd->op == I2C_RIP_VOLATILE){
+			ripCmdVolatile_t* grown = (ripCmdVolatile_t *)realloc(volatiles, sizeof(ripCmdVolatile_t) * (numVolatiles + 1));
+			if(grown == NULL){
+				logErrors("Error: Memory allocation failed\n");
+				free(volatiles);
+				free(removed);
+				return 0;
+			}
+			volatiles = grown;
+			volatiles[numVolatiles].m_bus = bus;
+			volatiles[numVolatiles].m_address = address;
+			volatiles[numVolatiles].m_range = cmd->data.range;
+			numVolatiles++;
+			continue;
+		}
+		if(!i2c_rip_write_range(cmd, &reg, &dRegSize, &length) || (by = optOverwrittenBy(removed, i, bus, address)) < 0){
+			continue;
 		}
-		if (g_i2cRipCmdList[numOfCmds].m_isValid){
-			if(numOfCmds < g_cmdToLineNumberSize){
-				g_cmdToLineNumber[numOfCmds] = i + 1;
+		for(int v = 0; v < numVolatiles; v++){
+			if(volatiles[v].m_bus == bus && volatiles[v].m_address == address &&
+					volatiles[v].m_range.first < reg + length && volatiles[v].m_range.last >= reg){
+				isVolatile = 1;
+				break;
 			}
-			numOfCmds++;
 		}
+		if(isVolatile){
+			continue;
+		}
+		removed[i] = 1;
+		numWrites++;
+		optLineStr(i, lineStr, sizeof(lineStr));
+		optLineStr(by, otherStr, sizeof(otherStr));
+		logMsg("%sRemoved %s 0x%x, overwritten by %s%s\n", lineStr, g_cmdNames[cmd->op], reg,
+			otherStr, g_cmdNames[g_i2cRipCmdList[by].op]);
 	}
+	free(volatiles);
 
-	fclose(file);
-	return !failed;
-}
+	bus = I2C_NO_BUS_SELECTED;
+	address = I2C_INVALID_SLAVE_ADDRESS;
+	int lastKept = -1;
+	for(int i = 0; i < numIn; i++){
+		struct i2c_rip_cmd* cmd = &g_i2cRipCmdList[i];
+		int next = optNext(removed, i);
+		enum i2c_rip_op nextCmd = (next < numIn) ? g_i2cRipCmdList[next].op : I2C_RIP_NUM_CMDS;
 
-// Checks IOCtrl For correct functions
-static int check_funcs(int file){
-	unsigned long funcs;
+		if(removed[i]){
+			continue;
+		}
+		optLineStr(i, lineStr, sizeof(lineStr));
 
-	if(g_simulate){
-		return 0;
-	}
+		switch(cmd->op){
+			case I2C_RIP_SET_BUS:
+				if(cmd->data.single == bus && bus != I2C_NO_BUS_SELECTED &&
+						(address == I2C_INVALID_SLAVE_ADDRESS || nextCmd == I2C_RIP_SET_ID)){
+					removed[i] = 1;
+					numSetBus++;
+					logMsg("%sRemoved SET-BUS %d, bus already selected\n", lineStr, cmd->data.single);
+					break;
+				}
+				bus = cmd->data.single;
+				address = I2C_INVALID_SLAVE_ADDRESS;
+				break;
+
+			case I2C_RIP_SET_ID:
+				if(bus != I2C_NO_BUS_SELECTED && cmd->data.single == address){
+					removed[i] = 1;
+					numSetId++;
+					logMsg("%sRemoved SET-ID 0x%x, slave already selected\n", lineStr, cmd->data.single);
+					break;
+				}
+				if(nextCmd == I2C_RIP_SET_ID || nextCmd == I2C_RIP_SET_BUS){
+					removed[i] = 1;
+					numSetId++;
+					logMsg("%sRemoved SET-ID 0x%x, another selection follows\n", lineStr, cmd->data.single);
+					break;
+				}
+				address = cmd->data.single;
+				break;
+
+			// Later iterations enter the body with what its end selected
+			case I2C_RIP_LOOP:
+				bus = I2C_NO_BUS_SELECTED;
+				address = I2C_INVALID_SLAVE_ADDRESS;
+				break;
+
+			case I2C_RIP_DELAY:
+				if(lastKept >= 0 && g_i2cRipCmdList[lastKept].op == I2C_RIP_DELAY &&
+						cmd->data.single > 0 && g_i2cRipCmdList[lastKept].data.single > 0 &&
+						cmd->data.single <= INT_MAX / 1000 - g_i2cRipCmdList[lastKept].data.single){
+					g_i2cRipCmdList[lastKept].data.single += cmd->data.single;
+					removed[i] = 1;
+					numDelays++;
+					optLineStr(lastKept, otherStr, sizeof(otherStr));
+					logMsg("%sFolded DELAY %d into %sDELAY %d\n", lineStr, cmd->data.single,
+						otherStr, g_i2cRipCmdList[lastKept].data.single);
+				}
+				break;
 
-	/* check adapter functionality */
-	if (ioctl(file, I2C_FUNCS, &funcs) < 0) {
-		logErrors("Error: Could not get the adapter "
-			"functionality matrix: %s\n", strerror(errno));
-		return -1;
+			default:
+				break;
+		}
+		if(!removed[i]){
+			lastKept = i;
+		}
 	}
 
-	if (!(funcs & I2C_FUNC_I2C)) {
-		logErrors("Error: I2cDevice missing I2C transfers functions\n");
-		return -1;
+	// Compact list and line numbers in place
+	for(int i = 0; i < numIn; i++){
+		if(removed[i]){
+			continue;
+		}
+		g_i2cRipCmdList[numCmds] = g_i2cRipCmdList[i];
+		if(i < g_cmdToLineNumberSize){
+			g_cmdToLineNumber[numCmds] = g_cmdToLineNumber[i];
+		}
+		numCmds++;
+	}
+	if(g_cmdToLineNumberSize > 0){
+		g_cmdToLineNumberSize = numCmds;
 	}
+	g_i2cRipCmdListLength = numCmds;
+	free(removed);
 
-	return 0;
+	logMsg("Optimized out %d of %d commands: %d SET-BUS, %d SET-ID, %d DELAY, %d overwritten write(s)\n",
+		numIn - numCmds, numIn, numSetBus, numSetId, numDelays, numWrites);
+	return 1;
 }
 
-// RDWR Interface
-// Allows us to inject simulation to fake ioCtl Calls
-static int ioCtlRdwrIf(int file, struct i2c_rdwr_ioctl_data *rdwr){
-	if(g_simulate){
-		return rdwr->nmsgs;
+// FNV-1a hash of the script text, used as the cache key
+static __u64 hashScript(const char* data, size_t size){
+	__u64 hash = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < size; i++){
+		hash ^= (__u8)data[i];
+		hash *= 0x100000001b3ULL;
 	}
-	return ioctl(file, I2C_RDWR, rdwr);
+	return hash;
 }
 
-// i2cRead function to be called by main program
-// dReg and data must be MSB - LSB in array
-static int i2cRead(int file, int reg, __u8* dReg, int dRegSize, __u8 *data, int dataSize){
+// Cached images are run as root, only ones nobody else could have written are used
+static int fileIsPrivate(const struct stat* st){
+	return st->st_uid == geteuid() && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
 
-	struct i2c_msg msgs[2];
+// Maps a whole file copy on write, compiled commands are patched in place
+// With trusted set the file must be a regular file of fileIsPrivate
+static char* mapFile(const char* filename, size_t* size, int trusted){
+	struct stat st;
 
-	if( 0 > reg || reg > 0x7f){
-		logErrors("Error: Read Failed, Register size invalid: %d", reg);
-		return 0;
+	int fd = open(filename, trusted ? O_RDONLY | O_NOFOLLOW : O_RDONLY);
+	if (fd < 0) {
+		return NULL;
 	}
 
-	if(dataSize + dRegSize >= MAX_READ_WRITE_SIZE){
-		logErrors("Error: Read Failed, Size invalid: %d", dataSize + dRegSize);
-		return 0;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0 ||
+			(trusted && (!S_ISREG(st.st_mode) || !fileIsPrivate(&st)))) {
+		close(fd);
+		return NULL;
 	}
 
-	if(dRegSize <= 0){
-		logErrors("Error: Read Failed, dRegSize invalid: %d", dRegSize);
-		return 0;
+	char* map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
 	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	*size = st.st_size;
+	return map;
+}
+
+// Checks a mapped file is a compiled script of this build
+static int imageIsValid(const char* map, size_t size){
+	const i2cRipImageHeader_t* header = (const i2cRipImageHeader_t *)map;
 
-	if(dataSize <= 0){
-		logErrors("Error: Read Failed, dataSize invalid: %d", dataSize);
+	if(size < sizeof(i2cRipImageHeader_t) || memcmp(header->m_magic, I2C_RIP_IMAGE_MAGIC, sizeof(header->m_magic)) != 0){
 		return 0;
 	}
 
-	// Add device ID register
-	msgs[0].addr = reg;
-	msgs[1].addr = reg;
-
-	// First Message write, Second read
-	msgs[0].flags = 0;
-	msgs[1].flags = I2C_M_RD;
+	if(header->m_version != I2C_RIP_IMAGE_VERSION ||
+			header->m_numCmdTypes != I2C_RIP_NUM_CMDS ||
+			header->m_cmdSize != sizeof(struct i2c_rip_cmd)){
+		return 0;
+	}
 
-	// Point to respected buffers
-	msgs[0].buf = dReg;
-	msgs[1].buf = data;
+	size_t expected = sizeof(i2cRipImageHeader_t) +
+		(size_t)header->m_numCmds * (sizeof(struct i2c_rip_cmd) + sizeof(int)) +
+		header->m_payloadLength;
+	return expected == size;
+}
 
-	// Message length
-	msgs[0].len = dRegSize;
-	msgs[1].len = dataSize;
+// Uses a mapped compiled script as the command list
+// Commands and line numbers are used straight from the mapping,
+// the payload is copied so later passes can append to it
+static int imageLoad(char* map, size_t size){
+	const i2cRipImageHeader_t* header = (const i2cRipImageHeader_t *)map;
+	struct i2c_rip_cmd* list = (struct i2c_rip_cmd *)(map + sizeof(i2cRipImageHeader_t));
+	int* lines = (int *)(list + header->m_numCmds);
+	const __u8* payload = (const __u8 *)(lines + header->m_numCmds);
 
-	struct i2c_rdwr_ioctl_data rdwr;
-	rdwr.msgs = msgs;
-	rdwr.nmsgs = 2;
+	if(!imageIsValid(map, size)){
+		return 0;
+	}
 
-	int nmsgs_sent = ioCtlRdwrIf(file, &rdwr);
+	// Corrupt images must not index outside the payload
+	for(__u32 i = 0; i < header->m_numCmds; i++){
+		if(list[i].op < 0 || list[i].op >= I2C_RIP_NUM_CMDS){
+			return 0;
+		}
+		if(i2c_rip_op_is_file(list[i].op) &&
+				(list[i].data.file.path < 0 ||
+				(__u32)list[i].data.file.path >= header->m_payloadLength ||
+				memchr(payload + list[i].data.file.path, '\0',
+					header->m_payloadLength - list[i].data.file.path) == NULL)){
+			return 0;
+		}
+		if(i2c_rip_op_has_payload(list[i].op) &&
+				(list[i].data.block.offset < 0 ||
+				(__u32)list[i].data.block.offset + list[i].data.block.length > header->m_payloadLength)){
+			return 0;
+		}
+	}
 
-	if (nmsgs_sent < 0) {
-		logErrors("Error: Sending messages failed: %s\n", strerror(errno));
-		return 0;
-	} else if (nmsgs_sent < (int)rdwr.nmsgs) {
-		logErrors("Error: only %d/%s messages were sent\n", nmsgs_sent, rdwr.nmsgs);
+	if(header->m_payloadLength > 0 && payloadAppend(payload, header->m_payloadLength) < 0){
 		return 0;
 	}
 
+	g_i2cRipCmdList = list;
+	g_i2cRipCmdListLength = header->m_numCmds;
+	g_cmdToLineNumber = lines;
+	g_cmdToLineNumberSize = header->m_numCmds;
+	g_imageMap = map;
+	g_imageMapSize = size;
 	return 1;
 }
 
-// i2cWrite function to be called by main program
-// dReg and data must be MSB - LSB in array
-static int i2cWrite(int file, int reg,  __u8* dReg, int dRegSize, __u8 *data, int dataSize){
+// Writes the command list, line numbers and payload as a compiled script image
+static int imageWriteFile(FILE* file, __u64 sourceHash, size_t sourceLength, const struct i2c_rip_cmd* list,
+		const int* lines, int numCmds, const struct i2c_rip_arena* payload){
+	i2cRipImageHeader_t header;
+	int ok = 1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, I2C_RIP_IMAGE_MAGIC, sizeof(header.m_magic));
+	header.m_version = I2C_RIP_IMAGE_VERSION;
+	header.m_numCmdTypes = I2C_RIP_NUM_CMDS;
+	header.m_cmdSize = sizeof(struct i2c_rip_cmd);
+	header.m_numCmds = numCmds;
+	header.m_payloadLength = payload->length;
+	header.m_sourceLength = (__u32)sourceLength;
+	header.m_sourceHash = sourceHash;
+
+	ok &= fwrite(&header, sizeof(header), 1, file) == 1;
+	ok &= fwrite(list, sizeof(struct i2c_rip_cmd), numCmds, file) == (size_t)numCmds;
+	ok &= fwrite(lines, sizeof(int), numCmds, file) == (size_t)numCmds;
+	ok &= fwrite(payload->data, 1, payload->length, file) == (size_t)payload->length;
+	return ok;
+}
 
-	struct i2c_msg msgs;
-	__u8 buff[MAX_READ_WRITE_SIZE];
+// Writes a compiled script file with the given mode, less the umask
+// Written to a temporary file first so readers never see a partial image
+static int imageWrite(const char* filename, mode_t mode, __u64 sourceHash, size_t sourceLength,
+		const struct i2c_rip_cmd* list, const int* lines, int numCmds, const struct i2c_rip_arena* payload){
+	char tmpName[PATH_MAX];
+	int ok;
 
-	if( 0 > reg || reg > 0x7f){
-		logErrors("Error: Read Failed, Register size invalid: %d", reg);
+	snprintf(tmpName, sizeof(tmpName), "%s.%d.tmp", filename, (int)getpid());
+	int fd = open(tmpName, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
 		return 0;
 	}
-
-	if(dataSize + dRegSize >= MAX_READ_WRITE_SIZE){
-		logErrors("Error: Write Failed, Size invalid: %d", dataSize + dRegSize);
+	FILE* file = fdopen(fd, "wb");
+	if (file == NULL) {
+		close(fd);
+		unlink(tmpName);
 		return 0;
 	}
 
-	if(dRegSize <= 0){
-		logErrors("Error: Write Failed, dRegSize invalid: %d", dRegSize);
-		return 0;
-	}
+	ok = imageWriteFile(file, sourceHash, sourceLength, list, lines, numCmds, payload);
+	ok &= fclose(file) == 0;
 
-	if(dataSize <= 0){
-		logErrors("Error: Write Failed, dataSize invalid: %d", dataSize);
+	if(!ok || rename(tmpName, filename) < 0){
+		unlink(tmpName);
 		return 0;
 	}
+	return 1;
+}
 
-	memcpy(buff, dReg, dRegSize);
-	memcpy(&buff[dRegSize], data, dataSize);
-	// Add device ID register
-	msgs.addr = reg;
-
-	// First Message write, Second read
-	msgs.flags = 0;
+// Builds the cache file name for a script hash, creating the directory
+// $I2CRIP_CACHE_DIR, else $XDG_CACHE_HOME/i2crip, else ~/.cache/i2crip
+// A directory others can write to is not used, see fileIsPrivate
+static int cachePath(__u64 hash, char* path, int size){
+	char dir[PATH_MAX - 32];
+	const char* env;
+	struct stat st;
 
-	// Point to respected buffers
-	msgs.buf = buff;
+	if((env = getenv("I2CRIP_CACHE_DIR")) != NULL){
+		snprintf(dir, sizeof(dir), "%s", env);
+	}
+	else if((env = getenv("XDG_CACHE_HOME")) != NULL){
+		snprintf(dir, sizeof(dir), "%s/i2crip", env);
+	}
+	else if((env = getenv("HOME")) != NULL){
+		snprintf(dir, sizeof(dir), "%s/.cache/i2crip", env);
+	}
+	else{
+		return 0;
+	}
 
-	// Message length
-	msgs.len = dRegSize + dataSize;
-	
-	struct i2c_rdwr_ioctl_data rdwr;
-	rdwr.msgs = &msgs;
-	rdwr.nmsgs = 1;
+	// mkdir -p
+	for(char* p = dir + 1; ; p++){
+		if(*p == '/' || *p == '\0'){
+			char c = *p;
+			*p = '\0';
+			if(mkdir(dir, 0700) < 0 && errno != EEXIST){
+				return 0;
+			}
+			*p = c;
+			if(c == '\0'){
+				break;
+			}
+		}
+	}
 
-	int nmsgs_sent = ioCtlRdwrIf(file, &rdwr);
-	
-	if (nmsgs_sent < 0) {
-		logErrors("Error: Sending messages failed: %s\n", strerror(errno));
+	if(stat(dir, &st) < 0 || !S_ISDIR(st.st_mode) || !fileIsPrivate(&st)){
+		if(!g_cacheWarned){
+			logErrors("Warning: Not using cache %s, it is writable by other users\n", dir);
+			g_cacheWarned = 1;
+		}
 		return 0;
-	} else if (nmsgs_sent < (int)rdwr.nmsgs) {
-		logErrors("Error: only %d/%d messages were sent\n", nmsgs_sent, rdwr.nmsgs);
+	}
+
+	snprintf(path, size, "%s/%016llx.ripc", dir, (unsigned long long)hash);
+	return 1;
+}
+
+// Loads a cached compilation of a script, if there is a matching one
+// The source length is checked as well so a hash collision alone does not match
+static int cacheLoad(__u64 hash, size_t length){
+	char path[PATH_MAX];
+	size_t size;
+
+	if(!cachePath(hash, path, sizeof(path))){
+		return 0;
+	}
+
+	char* map = mapFile(path, &size, 1);
+	if(map == NULL){
 		return 0;
 	}
 
+	const i2cRipImageHeader_t* header = (const i2cRipImageHeader_t *)map;
+	if(!imageIsValid(map, size) || header->m_sourceHash != hash || header->m_sourceLength != length ||
+			!imageLoad(map, size)){
+		munmap(map, size);
+		return 0;
+	}
 	return 1;
 }
 
-// Opens i2c interface for ioCtl
-static int open_i2c_dev_If(int i2cBus, char *filename, int  size){
-	if(g_simulate){
-		snprintf(filename, size, "Sim_I2cDev_%d", i2cBus);
+// Loads a script, compiled images are used as they are
+// Text scripts are parsed unless an up to date cached copy exists
+static int scriptLoad(const char* filename){
+	size_t size;
+	int ok;
+
+	char* map = mapFile(filename, &size, 0);
+	if (map == NULL) {
+		if(access(filename, R_OK) == 0){
+			logErrors("Empty File\n");
+		}
+		else{
+			logErrors("File: %s could not be opened\n", filename);
+		}
 		return 0;
 	}
-	return open_i2c_dev(i2cBus, filename, size, 0);
+
+	if(size >= sizeof(i2cRipImageHeader_t) && memcmp(map, I2C_RIP_IMAGE_MAGIC, 8) == 0){
+		g_sourceHash = ((const i2cRipImageHeader_t *)map)->m_sourceHash;
+		g_sourceLength = ((const i2cRipImageHeader_t *)map)->m_sourceLength;
+		if(!imageLoad(map, size)){
+			logErrors("Error: Compiled script %s is corrupt or from another i2crip version\n", filename);
+			munmap(map, size);
+			return 0;
+		}
+		logMsg("Number of commands: %d\n", g_i2cRipCmdListLength);
+		g_streaming = 0;
+		return 1;
+	}
+
+	// Streamed scripts are parsed while they run, see executeStream
+	// The cache would need the whole text hashed before the first transfer
+	if(g_streaming){
+		g_streamMap = map;
+		g_streamSize = size;
+		return 1;
+	}
+
+	g_sourceHash = hashScript(map, size);
+	g_sourceLength = size;
+	if(g_useCache && cacheLoad(g_sourceHash, g_sourceLength)){
+		munmap(map, size);
+		logMsg("Number of commands: %d (cached)\n", g_i2cRipCmdListLength);
+		return 1;
+	}
+
+	ok = scriptParse(map, size);
+	munmap(map, size);
+	if(!ok){
+		return 0;
+	}
+
+	// A cache that cannot be written only costs the next run a parse
+	if(g_useCache){
+		char path[PATH_MAX];
+		if(cachePath(g_sourceHash, path, sizeof(path))){
+			imageWrite(path, 0600, g_sourceHash, g_sourceLength, g_i2cRipCmdList, g_cmdToLineNumber,
+				g_i2cRipCmdListLength, &g_i2cRipPayload);
+		}
+	}
+
+	logMsg("Number of commands: %d\n", g_i2cRipCmdListLength);
+	return 1;
+}
+
+// Simulator transport, busses are models from i2cripsim
+static int simOpen(void* user, int bus){
+	(void)user;
+	int file = i2cRipSimOpen(bus);
+	return (file < 0) ? -errno : file;
 }
 
-// Sets slave address on i2cBus
-static int set_slave_addr_If(int file, int address){
-	const int force = 1;
+static int simRdwr(void* user, int file, struct i2c_rdwr_ioctl_data *rdwr){
+	(void)user;
+	int sent = i2cRipSimRdwr(file, rdwr);
+	return (sent < 0) ? -errno : sent;
+}
+
+static void simClose(void* user, int file){
+	(void)user;
+	i2cRipSimClose(file);
+}
+
+// No other jobs share simulated busses, so there is nothing to lock
+static const struct i2c_rip_transport g_simTransport = {
+	.open = simOpen,
+	.rdwr = simRdwr,
+	.close = simClose,
+};
+
+// Stores the data of a completed read in the results file
+static void ripRead(void* user, const struct i2c_rip_read* read){
+	i2cRipResult_t* result = i2cRipResultsClaim(g_results);
+
+	(void)user;
+	if(result == NULL){
+		return;
+	}
+	result->m_cmdIndex = read->index;
+	result->m_line = read->line;
+	result->m_bus = (__u16)read->bus;
+	result->m_reg = (__u16)read->reg;
+	result->m_address = (__u8)read->addr;
+	result->m_cmd = (__u8)read->op;
+	result->m_length = (__u8)read->size;
+	result->m_reserved = 0;
+	memcpy(result->m_data, read->data, read->size);
+}
+
+// Timings of the script engine, kept per thread
+static void ripEvent(void* user, const struct i2c_rip_event* event){
+	(void)user;
+	if(!IS_STATS_ENABLED){
+		return;
+	}
+	switch(event->type){
+		case I2C_RIP_EVENT_RDWR:
+			t_stats->m_busNs += event->ns;
+			t_stats->m_rdwrCalls++;
+			t_stats->m_bytes += event->bytes;
+			break;
+		case I2C_RIP_EVENT_XFER:
+			i2cRipStatsTransfer(t_stats, event->op, event->bus, event->addr, event->ns, event->bytes);
+			break;
+		case I2C_RIP_EVENT_CMD:
+			i2cRipStatsCmd(t_stats, event->op, event->ns);
+			break;
+		case I2C_RIP_EVENT_SLEEP:
+			t_stats->m_sleepNs += event->ns;
+			break;
+		case I2C_RIP_EVENT_OPEN:
+			t_stats->m_openNs += event->ns;
+			break;
+		case I2C_RIP_EVENT_FUNCS:
+			t_stats->m_funcsNs += event->ns;
+			break;
+		case I2C_RIP_EVENT_LOCK:
+			i2cRipHistRecord(&t_stats->m_lockWait, event->ns);
+			break;
+		case I2C_RIP_EVENT_ELIDED:
+			t_stats->m_elided++;
+			break;
+		case I2C_RIP_EVENT_YIELD:
+			t_stats->m_yields++;
+			break;
+	}
+}
+
+// Hands log output, reads and timings of the script engine to the front end
+static void ripOpsInit(void){
+	struct i2c_rip_ops ops;
+
+	memset(&ops, 0, sizeof(ops));
+	ops.log = ripLog;
+	ops.log_xfer = ripLogXfer;
+	if(g_results != NULL){
+		ops.read = ripRead;
+	}
+	if(g_stats != NULL){
+		ops.event = ripEvent;
+	}
+	i2c_rip_ctx_set_ops(g_ctx, &ops, NULL);
+}
+
+// Worker thread running one bus stream of a phase
+static void* workerMain(void* arg){
+	i2cRipWorker_t* worker = (i2cRipWorker_t *)arg;
+	struct i2c_rip_run* run = i2c_rip_run_new(g_ctx);
+
+	t_logCapture = &worker->m_log;
+	t_stats = worker->m_stats;
+	worker->m_ok = 0;
+	if(run != NULL){
+		worker->m_ok = i2c_rip_run_cmds(run, worker->m_first, worker->m_last, worker->m_stream) == 0;
+		i2c_rip_run_free(run);
+	}
+	t_logCapture = NULL;
+	t_stats = NULL;
+	return NULL;
+}
+
+// Orders captured log output by command, then by capture order
+static int logRefCompare(const void* a, const void* b){
+	const i2cRipLogRef_t* refA = (const i2cRipLogRef_t *)a;
+	const i2cRipLogRef_t* refB = (const i2cRipLogRef_t *)b;
+
+	if(refA->m_entry->m_cmdIndex != refB->m_entry->m_cmdIndex){
+		return (refA->m_entry->m_cmdIndex < refB->m_entry->m_cmdIndex) ? -1 : 1;
+	}
+	return refA->m_entry->m_seq - refB->m_entry->m_seq;
+}
+
+// Writes the log output of a phase's workers in script order
+static void logMergeWorkers(i2cRipWorker_t* workers, int numWorkers){
+	int total = 0;
+	int n = 0;
+
+	for(int w = 0; w < numWorkers; w++){
+		total += workers[w].m_log.m_numEntries;
+	}
+	if(total == 0){
+		return;
+	}
+
+	i2cRipLogRef_t* refs = (i2cRipLogRef_t *)malloc(sizeof(i2cRipLogRef_t) * total);
+	if(refs == NULL){
+		logErrors("Error: Memory allocation failed\n");
+		return;
+	}
+
+	for(int w = 0; w < numWorkers; w++){
+		for(int j = 0; j < workers[w].m_log.m_numEntries; j++){
+			refs[n].m_entry = &workers[w].m_log.m_entries[j];
+			refs[n].m_text = workers[w].m_log.m_text;
+			n++;
+		}
+	}
+	qsort(refs, total, sizeof(i2cRipLogRef_t), logRefCompare);
+
+	for(int j = 0; j < total; j++){
+		logWrite(refs[j].m_entry->m_dest, &refs[j].m_text[refs[j].m_entry->m_offset], refs[j].m_entry->m_length);
+	}
+	free(refs);
+}
+
+// Runs every bus on its own thread
+// The script is split into phases at barrier commands, each phase
+// starts one worker per bus it uses and waits for all of them
+// Log output is replayed in script order at the end of each phase
+static int executeParallel(void){
+	static i2cRipWorker_t workers[I2C_MAX_BUSSES + 1];
+	struct i2c_rip_run* run;
+	int bus = I2C_NO_BUS_SELECTED;
+	int ok = 1;
+
+	// A loop jumps back over commands of other busses
+	for(int i = 0; i < g_i2cRipCmdListLength; i++){
+		if(g_i2cRipCmdList[i].op == I2C_RIP_LOOP){
+			logErrors("Error: LOOP does not apply to -p\n");
+			return 0;
+		}
+	}
+
+	g_cmdStream = (int *)malloc(sizeof(int) * (g_i2cRipCmdListLength + 1));
+	if(g_cmdStream == NULL){
+		logErrors("Error: Memory allocation failed\n");
+		return 0;
+	}
+
+	// Each command runs on the stream of the bus selected before it
+	for(int i = 0; i < g_i2cRipCmdListLength; i++){
+		if(g_i2cRipCmdList[i].op == I2C_RIP_SET_BUS &&
+				g_i2cRipCmdList[i].data.single >= 0 && g_i2cRipCmdList[i].data.single < I2C_MAX_BUSSES){
+			bus = g_i2cRipCmdList[i].data.single;
+		}
+		g_cmdStream[i] = bus;
+	}
+	i2c_rip_ctx_set_streams(g_ctx, g_cmdStream);
+
+	// Workers can not give up each other's busses when one is taken by another
+	// job, so all are taken in bus order before anything runs
+	if(IS_ARBITRATED){
+		int firstUse[I2C_MAX_BUSSES];
+
+		for(int b = 0; b < I2C_MAX_BUSSES; b++){
+			firstUse[b] = -1;
+		}
+		for(int i = 0; i < g_i2cRipCmdListLength; i++){
+			if(g_cmdStream[i] >= 0 && firstUse[g_cmdStream[i]] < 0){
+				firstUse[g_cmdStream[i]] = i;
+			}
+		}
+		for(int b = 0; b < I2C_MAX_BUSSES; b++){
+			if(firstUse[b] >= 0 && i2c_rip_ctx_lock_bus(g_ctx, b, firstUse[b]) < 0){
+				return 0;
+			}
+		}
+	}
+
+	// Barriers run on the main thread
+	run = i2c_rip_run_new(g_ctx);
+	if(run == NULL){
+		logErrors("Error: Memory allocation failed\n");
+		return 0;
+	}
+
+	for(int first = 0; ok && first < g_i2cRipCmdListLength; ){
+		int last = first;
+		int numWorkers = 0;
+		__u8 used[I2C_MAX_BUSSES + 1];
+
+		while(last < g_i2cRipCmdListLength && !i2c_rip_op_is_barrier(g_i2cRipCmdList[last].op)){
+			last++;
+		}
+
+		// Streams are offset by one so commands before any SET-BUS get a slot
+		memset(used, 0, sizeof(used));
+		for(int i = first; i < last; i++){
+			used[g_cmdStream[i] + 1] = 1;
+		}
+
+		for(int s = 0; s <= I2C_MAX_BUSSES; s++){
+			if(!used[s]){
+				continue;
+			}
+			i2cRipWorker_t* worker = &workers[numWorkers];
+			worker->m_stream = s - 1;
+			worker->m_first = first;
+			worker->m_last = last;
+			worker->m_ok = 0;
+			worker->m_log.m_numEntries = 0;
+			worker->m_log.m_textLength = 0;
+			// Each worker slot keeps its own statistics, merged once the script is done
+			if(g_stats != NULL && worker->m_stats == NULL){
+				worker->m_stats = i2cRipStatsCreate();
+				if(worker->m_stats == NULL){
+					logErrors("Error: Memory allocation failed\n");
+					ok = 0;
+					break;
+				}
+			}
+			if(pthread_create(&worker->m_thread, NULL, workerMain, worker) != 0){
+				logErrors("Error: Unable to start worker for bus %d\n", s - 1);
+				ok = 0;
+				break;
+			}
+			numWorkers++;
+		}
+
+		for(int w = 0; w < numWorkers; w++){
+			pthread_join(workers[w].m_thread, NULL);
+			if(!workers[w].m_ok){
+				ok = 0;
+			}
+		}
+		logMergeWorkers(workers, numWorkers);
+
+		if(ok && last < g_i2cRipCmdListLength){
+			ok = i2c_rip_run_cmds(run, last, last + 1, I2C_RIP_ALL_STREAMS) == 0;
+		}
+		first = last + 1;
+	}
+	i2c_rip_run_free(run);
+	i2c_rip_ctx_release(g_ctx);
+
+	for(int w = 0; w <= I2C_MAX_BUSSES; w++){
+		free(workers[w].m_log.m_entries);
+		free(workers[w].m_log.m_text);
+		workers[w].m_log.m_entries = NULL;
+		workers[w].m_log.m_text = NULL;
+		workers[w].m_log.m_entriesSize = 0;
+		workers[w].m_log.m_textSize = 0;
+		if(workers[w].m_stats != NULL){
+			i2cRipStatsMerge(g_stats, workers[w].m_stats);
+			i2cRipStatsFree(workers[w].m_stats);
+			workers[w].m_stats = NULL;
+		}
+	}
+	return ok;
+}
+
+// Adds a parsed line to the part of a streamed script after its first LOOP
+// The payload of the line moves to the end of the rest's arena, offsets follow it
+static int streamRestAdd(i2cRipStreamRest_t* rest, struct i2c_rip_cmd cmd, int line){
+	int base = rest->m_payload.length;
+
+	if(rest->m_length == rest->m_size){
+		int size = (rest->m_size > 0) ? rest->m_size * 2 : I2C_RIP_STREAM_QUEUE_SIZE;
+		struct i2c_rip_cmd* cmds = (struct i2c_rip_cmd *)realloc(rest->m_cmds, sizeof(struct i2c_rip_cmd) * size);
+		if(cmds == NULL){
+			return 0;
+		}
+		rest->m_cmds = cmds;
+		int* lines = (int *)realloc(rest->m_lines, sizeof(int) * size);
+		if(lines == NULL){
+			return 0;
+		}
+		rest->m_lines = lines;
+		rest->m_size = size;
+	}
+
+	if(g_i2cRipPayload.length > 0 &&
+			i2c_rip_arena_append(&rest->m_payload, g_i2cRipPayload.data, g_i2cRipPayload.length) < 0){
+		return 0;
+	}
+	if(i2c_rip_op_is_file(cmd.op)){
+		cmd.data.file.path += base;
+	}
+	else if(i2c_rip_op_has_payload(cmd.op)){
+		cmd.data.block.offset += base;
+	}
+	rest->m_cmds[rest->m_length] = cmd;
+	rest->m_lines[rest->m_length] = line;
+	rest->m_length++;
+	return 1;
+}
+
+static void streamRestFree(i2cRipStreamRest_t* rest){
+	free(rest->m_cmds);
+	free(rest->m_lines);
+	i2c_rip_arena_free(&rest->m_payload);
+	memset(rest, 0, sizeof(*rest));
+}
+
+// Parser thread of a streamed script
+// Each command goes into the next free slot of the command ring as soon as its
+// line is parsed; log output is captured and written once the script is done
+// Loops jump back to commands the ring has handed back already, so from the
+// first LOOP on the script goes into g_streamRest instead and runs once parsed
+static void* streamParserMain(void* arg){
+	const char* pos = g_streamMap;
+	const char* end = g_streamMap + g_streamSize;
+	__u64 start = i2cRipStatsNow();
+	int looped = 0;
+	int lines = 0;
+	int stopped = 0;
+
+	(void)arg;
+	t_logCapture = &g_streamLog;
+	g_streamOk = 1;
+	while(pos <= end && !stopped){
+		const char* eol = (const char *)memchr(pos, '\n', end - pos);
+		if(eol == NULL){
+			eol = end;
+		}
+		lines++;
+
+		// Payload of the line is copied to its slot, the arena starts over every line
+		struct i2c_rip_cmd i2cRipData;
+		g_i2cRipPayload.length = 0;
+		if(!parseLine(pos, (int)(eol - pos), &i2cRipData)){
+			logErrors("Error: Failed to parse line: %d: %.*s\n", lines, (int)(eol - pos), pos);
+			g_streamOk = 0;
+			break;
+		}
+
+		if(i2cRipData.valid && (looped || i2cRipData.op == I2C_RIP_LOOP)){
+			looped = 1;
+			if(!streamRestAdd(&g_streamRest, i2cRipData, lines)){
+				logErrors("Error: Memory allocation failed\n");
+				g_streamOk = 0;
+				break;
+			}
+			g_streamNumCmds++;
+		}
+		else if(i2cRipData.valid){
+			unsigned int head = atomic_load_explicit(&g_streamHead, memory_order_relaxed);
+			while(head - atomic_load_explicit(&g_streamTail, memory_order_acquire) >= I2C_RIP_STREAM_QUEUE_SIZE){
+				if(atomic_load(&g_streamStop)){
+					stopped = 1;
+					break;
+				}
+				sched_yield();
+			}
+			if(stopped){
+				break;
+			}
+
+			int slot = head & (I2C_RIP_STREAM_QUEUE_SIZE - 1);
+			if(g_i2cRipPayload.length > g_streamPayloadSize[slot]){
+				__u8* payload = (__u8 *)realloc(g_streamPayload[slot], g_i2cRipPayload.length);
+				if(payload == NULL){
+					logErrors("Error: Memory allocation failed\n");
+					g_streamOk = 0;
+					break;
+				}
+				g_streamPayload[slot] = payload;
+				g_streamPayloadSize[slot] = g_i2cRipPayload.length;
+			}
+			if(g_i2cRipPayload.length > 0){
+				memcpy(g_streamPayload[slot], g_i2cRipPayload.data, g_i2cRipPayload.length);
+			}
+			g_i2cRipCmdList[slot] = i2cRipData;
+			g_cmdToLineNumber[slot] = lines;
+			g_streamNumCmds++;
+			atomic_store_explicit(&g_streamHead, head + 1, memory_order_release);
+		}
+		pos = eol + 1;
+	}
+
+	g_streamParseNs = i2cRipStatsNow() - start;
+	t_logCapture = NULL;
+	atomic_store(&g_streamDone, 1);
+	return NULL;
+}
+
+// Runs a text script while a parser thread is still reading it, so the first
+// transfer goes out right after the first line is parsed
+// The command list is a ring of I2C_RIP_STREAM_QUEUE_SIZE slots: memory does not
+// grow with the script, and a slot is handed back to the parser once no queued
+// transfer refers to it. A line that fails to parse stops the script there
+// From the first LOOP on the script is parsed in full, see streamParserMain
+static int executeStream(void){
+	pthread_t parser;
+	struct i2c_rip_run* run;
+	unsigned int executed = 0;
+	int ok = 1;
+
+	g_i2cRipCmdList = (struct i2c_rip_cmd *)malloc(sizeof(struct i2c_rip_cmd) * I2C_RIP_STREAM_QUEUE_SIZE);
+	g_cmdToLineNumber = (int *)malloc(sizeof(int) * I2C_RIP_STREAM_QUEUE_SIZE);
+	if(g_i2cRipCmdList == NULL || g_cmdToLineNumber == NULL){
+		logErrors("Error: Memory allocation failed\n");
+		return 0;
+	}
+	g_i2cRipCmdListSize = I2C_RIP_STREAM_QUEUE_SIZE;
+	g_i2cRipCmdListLength = I2C_RIP_STREAM_QUEUE_SIZE;
+	g_cmdToLineNumberSize = I2C_RIP_STREAM_QUEUE_SIZE;
+
+	// Queued transfers may point into a slot until they went out
+	i2c_rip_ctx_set_script(g_ctx, g_i2cRipCmdList, g_cmdToLineNumber, I2C_RIP_STREAM_QUEUE_SIZE, NULL);
+	run = i2c_rip_run_new(g_ctx);
+	if(run == NULL){
+		logErrors("Error: Memory allocation failed\n");
+		return 0;
+	}
+	i2c_rip_run_set_hold(run, 1);
+	atomic_store(&g_streamHead, 0);
+	atomic_store(&g_streamTail, 0);
+	atomic_store(&g_streamDone, 0);
+	atomic_store(&g_streamStop, 0);
+	if(pthread_create(&parser, NULL, streamParserMain, NULL) != 0){
+		logErrors("Error: Unable to start parser thread\n");
+		i2c_rip_run_free(run);
+		return 0;
+	}
+
+	for(;;){
+		unsigned int head = atomic_load_explicit(&g_streamHead, memory_order_acquire);
+
+		if(executed == head){
+			// Queued transfers go out rather than wait for the parser
+			if(i2c_rip_run_flush(run) < 0){
+				ok = 0;
+				break;
+			}
+			atomic_store_explicit(&g_streamTail, executed, memory_order_release);
+			if(atomic_load(&g_streamDone) && executed == atomic_load_explicit(&g_streamHead, memory_order_acquire)){
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+
+		int slot = executed & (I2C_RIP_STREAM_QUEUE_SIZE - 1);
+		i2c_rip_run_set_payload(run, g_streamPayload[slot]);
+		if(i2c_rip_run_cmds(run, slot, slot + 1, I2C_RIP_ALL_STREAMS) < 0){
+			ok = 0;
+			break;
+		}
+		executed++;
+		if(i2c_rip_run_pending(run) == 0){
+			atomic_store_explicit(&g_streamTail, executed, memory_order_release);
+		}
+	}
+
+	// Whatever is still queued comes before any failed command
+	if(i2c_rip_run_flush(run) < 0){
+		ok = 0;
+	}
+
+	// The ring is empty and the parser done, the rest runs like a whole script
+	if(ok && g_streamOk && g_streamRest.m_length > 0){
+		i2c_rip_ctx_set_script(g_ctx, g_streamRest.m_cmds, g_streamRest.m_lines, g_streamRest.m_length,
+			g_streamRest.m_payload.data);
+		i2c_rip_run_set_payload(run, g_streamRest.m_payload.data);
+		i2c_rip_run_set_hold(run, 0);
+		ok = i2c_rip_run_cmds(run, 0, g_streamRest.m_length, I2C_RIP_ALL_STREAMS) == 0;
+	}
+	i2c_rip_run_free(run);
+	i2c_rip_ctx_release(g_ctx);
+
+	atomic_store(&g_streamStop, 1);
+	pthread_join(parser, NULL);
+	streamRestFree(&g_streamRest);
+	for(int j = 0; j < g_streamLog.m_numEntries; j++){
+		logWrite(g_streamLog.m_entries[j].m_dest, &g_streamLog.m_text[g_streamLog.m_entries[j].m_offset],
+			g_streamLog.m_entries[j].m_length);
+	}
+	free(g_streamLog.m_entries);
+	free(g_streamLog.m_text);
+	for(int j = 0; j < I2C_RIP_STREAM_QUEUE_SIZE; j++){
+		free(g_streamPayload[j]);
+		g_streamPayload[j] = NULL;
+	}
+	munmap(g_streamMap, g_streamSize);
+	g_streamMap = NULL;
+
+	logMsg("Number of commands: %d (streamed)\n", g_streamNumCmds);
+	return ok && g_streamOk;
+}
+
+// Picks the kernel or simulated transport and marks every bus closed
+static int backendInit(const char* simModel){
 	if(g_simulate){
+		if(simModel != NULL && !i2cRipSimLoadConfig(simModel)){
+			return 0;
+		}
+		i2c_rip_ctx_set_transport(g_ctx, &g_simTransport, NULL);
+		logMsg("Simulating I2cDevice\n");
+	}
+	return 1;
+}
+
+// Forgets the loaded script, a daemon loads one for every request
+// Compiled images stay with whoever owns them
+static void scriptUnload(void){
+	if(g_imageMap == NULL){
+		free(g_i2cRipCmdList);
+		free(g_cmdToLineNumber);
+	}
+	g_imageMap = NULL;
+	g_imageMapSize = 0;
+	g_i2cRipCmdList = NULL;
+	g_cmdToLineNumber = NULL;
+	g_i2cRipCmdListLength = 0;
+	g_i2cRipCmdListSize = 0;
+	g_cmdToLineNumberSize = 0;
+	g_i2cRipPayload.length = 0;
+}
+
+// Loads a script sent to the daemon
+// Text is parsed once, requests with the same text later run its compiled copy
+static int daemonLoad(char* script, size_t size){
+	if(size >= sizeof(i2cRipImageHeader_t) && memcmp(script, I2C_RIP_IMAGE_MAGIC, 8) == 0){
+		if(!imageLoad(script, size)){
+			logErrors("Error: Compiled script is corrupt or from another i2crip version\n");
+			return 0;
+		}
+		return 1;
+	}
+
+	__u64 hash = hashScript(script, size);
+	i2cRipDaemonCached_t* slot = &g_daemonCache[0];
+	for(int i = 0; i < I2C_RIP_DAEMON_CACHE_SIZE; i++){
+		i2cRipDaemonCached_t* cached = &g_daemonCache[i];
+		if(cached->m_image != NULL && cached->m_hash == hash &&
+				((const i2cRipImageHeader_t *)cached->m_image)->m_sourceLength == size){
+			cached->m_lastUse = ++g_daemonUses;
+			return imageLoad(cached->m_image, cached->m_size);
+		}
+		if(cached->m_lastUse < slot->m_lastUse){
+			slot = cached;
+		}
+	}
+
+	if(!scriptParse(script, size) ||
+			(g_optimize && !optimizeCmds()) ||
+			(g_mergeWrites && !mergeSequentialWrites())){
 		return 0;
 	}
-	return set_slave_addr(file, address, force);
+
+	// The least recently used copy makes room, a script that cannot be kept still runs
+	char* image = NULL;
+	size_t imageSize = 0;
+	FILE* file = open_memstream(&image, &imageSize);
+	if(file != NULL){
+		int ok = imageWriteFile(file, hash, size, g_i2cRipCmdList, g_cmdToLineNumber, g_i2cRipCmdListLength, &g_i2cRipPayload);
+		ok &= fclose(file) == 0;
+		if(ok){
+			free(slot->m_image);
+			slot->m_image = image;
+			slot->m_size = imageSize;
+			slot->m_hash = hash;
+			slot->m_lastUse = ++g_daemonUses;
+		}
+		else{
+			free(image);
+		}
+	}
+	return 1;
+}
+
+// Reads from a client of the daemon, sets timedOut when it stalled
+static int daemonRead(int client, void* data, size_t size, int* timedOut){
+	errno = 0;
+	if(i2cRipdReadFull(client, data, size) < 0){
+		*timedOut = (errno == EAGAIN || errno == EWOULDBLOCK);
+		return 0;
+	}
+	return 1;
+}
+
+// Runs one script for a client of the daemon and sends back its log output
+// A client that stalls is dropped without a reply
+// Settings a script can change and shadow registers start over with every
+// request, open busses carry over
+static void daemonRequest(int client, __u32 baseFlags, i2cRipLogCapture_t* capture, i2cRipdReply_t* reply){
+	i2cRipdRequest_t request;
+	__u32 status = 1;
+	char* script = NULL;
+	int timedOut = 0;
+
+	capture->m_numEntries = 0;
+	capture->m_textLength = 0;
+	reply->m_length = 0;
+	t_logCapture = capture;
+
+	if(!daemonRead(client, &request, sizeof(request), &timedOut) || request.m_magic != I2C_RIPD_MAGIC ||
+			request.m_version != I2C_RIPD_VERSION || request.m_length == 0 || request.m_length > I2C_RIPD_MAX_SCRIPT){
+		logErrors("Error: Invalid request\n");
+	}
+	else if((script = (char *)malloc(request.m_length)) == NULL){
+		logErrors("Error: Memory allocation failed\n");
+	}
+	else if(!daemonRead(client, script, request.m_length, &timedOut)){
+		logErrors("Error: Script of %u bytes cut short\n", request.m_length);
+	}
+	else{
+		__u32 flags = baseFlags | request.m_flags;
+
+		unsigned int ripFlags = g_ripFlags & (I2C_RIP_SHADOW | I2C_RIP_RECONCILE);
+
+		if(flags & I2C_RIPD_FLAG_BATCH){
+			ripFlags |= I2C_RIP_BATCH;
+		}
+		if(flags & I2C_RIPD_FLAG_DEBUG){
+			ripFlags |= I2C_RIP_DEBUG;
+		}
+		if(flags & I2C_RIPD_FLAG_QUIET){
+			ripFlags |= I2C_RIP_QUIET;
+		}
+		i2c_rip_ctx_set_flags(g_ctx, ripFlags);
+		i2c_rip_ctx_reset(g_ctx);
+
+		if(daemonLoad(script, request.m_length)){
+			i2c_rip_ctx_set_script(g_ctx, g_i2cRipCmdList, g_cmdToLineNumber, g_i2cRipCmdListLength, g_i2cRipPayload.data);
+			status = i2c_rip_ctx_run(g_ctx) < 0;
+		}
+		i2c_rip_ctx_release(g_ctx);
+		i2c_rip_ctx_set_script(g_ctx, NULL, NULL, 0, NULL);
+		scriptUnload();
+	}
+	t_logCapture = NULL;
+	free(script);
+
+	if(timedOut){
+		logErrors("Error: Dropped a client silent for %d seconds\n", I2C_RIPD_TIMEOUT_S);
+		return;
+	}
+
+	// Log file output stays with the daemon, terminal output goes to the client
+	FILE* logFile = i2c_rip_ctx_log_file(g_ctx);
+	for(int j = 0; j < capture->m_numEntries; j++){
+		const i2cRipLogEntry_t* entry = &capture->m_entries[j];
+		const char* text = &capture->m_text[entry->m_offset];
+
+		if((entry->m_dest & I2C_RIP_LOG_FILE) && logFile != NULL){
+			fwrite(text, 1, entry->m_length, logFile);
+		}
+		if(entry->m_dest & I2C_RIP_LOG_STDOUT){
+			i2cRipdReplyAppend(reply, I2C_RIPD_FRAME_STDOUT, text, entry->m_length);
+		}
+		if(entry->m_dest & I2C_RIP_LOG_STDERR){
+			i2cRipdReplyAppend(reply, I2C_RIPD_FRAME_STDERR, text, entry->m_length);
+		}
+	}
+	if(logFile != NULL){
+		fflush(logFile);
+	}
+
+	char exiting[64];
+	int length = snprintf(exiting, sizeof(exiting), "Exiting: I2cRip %s\n", (status) ? "FAILED" : "was SUCCESSFUL");
+	i2cRipdReplyAppend(reply, I2C_RIPD_FRAME_STDERR, exiting, length);
+	if(i2cRipdReplyAppend(reply, I2C_RIPD_FRAME_EXIT, &status, sizeof(status)) == 0){
+		i2cRipdWriteFull(client, reply->m_data, reply->m_length);
+	}
+}
+
+static void daemonSignal(int sig){
+	(void)sig;
+	g_daemonStop = 1;
+}
+
+// Serves scripts on a local socket until SIGINT or SIGTERM, one at a time
+// Busses stay open and parsed scripts stay compiled between requests,
+// so a request costs little more than its bus time
+static int daemonRun(const char* path){
+	i2cRipLogCapture_t capture;
+	i2cRipdReply_t reply;
+	struct sigaction action;
+	__u32 baseFlags = 0;
+
+	memset(&capture, 0, sizeof(capture));
+	memset(&reply, 0, sizeof(reply));
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = daemonSignal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	baseFlags |= (g_ripFlags & I2C_RIP_BATCH) ? I2C_RIPD_FLAG_BATCH : 0;
+	baseFlags |= (g_ripFlags & I2C_RIP_DEBUG) ? I2C_RIPD_FLAG_DEBUG : 0;
+	baseFlags |= (g_ripFlags & I2C_RIP_QUIET) ? I2C_RIPD_FLAG_QUIET : 0;
+
+	int listenFd = i2cRipdListen(path);
+	if(listenFd < 0){
+		logErrors("Error: Unable to listen on %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	logMsg("Listening on %s\n", path);
+	fflush(stdout);
+
+	while(!g_daemonStop){
+		int client = accept(listenFd, NULL, NULL);
+		if(client < 0){
+			if(errno == EINTR || errno == ECONNABORTED){
+				continue;
+			}
+			logErrors("Error: Accepting a client failed: %s\n", strerror(errno));
+			break;
+		}
+		// Scripts run with the daemon's privileges, the socket mode is not relied on alone
+		uid_t uid;
+		if(i2cRipdPeerUid(client, &uid) < 0 || (uid != 0 && uid != geteuid())){
+			logErrors("Error: Refused a client of another user\n");
+			close(client);
+			continue;
+		}
+		if(i2cRipdSetTimeout(client, I2C_RIPD_TIMEOUT_S) < 0){
+			logErrors("Error: Unable to set a timeout on a client: %s\n", strerror(errno));
+			close(client);
+			continue;
+		}
+		daemonRequest(client, baseFlags, &capture, &reply);
+		close(client);
+	}
+
+	close(listenFd);
+	unlink(path);
+	for(int i = 0; i < I2C_RIP_DAEMON_CACHE_SIZE; i++){
+		free(g_daemonCache[i].m_image);
+		g_daemonCache[i].m_image = NULL;
+	}
+	free(capture.m_entries);
+	free(capture.m_text);
+	free(reply.m_data);
+	return 1;
+}
+
+// Most read records the command list can produce, block reads take one per chunk
+// and chunks are no smaller than the smallest SET-BURST of the script; reads in a
+// LOOP count once per iteration
+static __u64 resultsCapacity(void){
+	int minBurst = MAX_READ_WRITE_SIZE;
+	__u64 capacity = 0;
+	__u64 repeat = 1;
+
+	for(int i = 0; i < g_i2cRipCmdListLength; i++){
+		if(g_i2cRipCmdList[i].op == I2C_RIP_SET_BURST && g_i2cRipCmdList[i].data.single < minBurst){
+			minBurst = (g_i2cRipCmdList[i].data.single < 1) ? 1 : g_i2cRipCmdList[i].data.single;
+		}
+	}
+
+	for(int i = 0; i < g_i2cRipCmdListLength; i++){
+		const struct i2c_rip_cmd* cmd = &g_i2cRipCmdList[i];
+
+		if(cmd->op == I2C_RIP_LOOP){
+			repeat = (cmd->data.loop.count > 0) ? cmd->data.loop.count : 1;
+		}
+		else if(cmd->op == I2C_RIP_END_LOOP){
+			repeat = 1;
+		}
+		else if(cmd->op == I2C_RIP_8_READ_BLOCK || cmd->op == I2C_RIP_16_READ_BLOCK){
+			int chunk = MAX_READ_WRITE_SIZE - 1 - ((cmd->op == I2C_RIP_8_READ_BLOCK) ? 1 : 2);
+			if(minBurst < chunk){
+				chunk = minBurst;
+			}
+			capacity += repeat * ((cmd->data.block.length + chunk - 1) / chunk);
+		}
+		else if(i2c_rip_op_is_read(cmd->op)){
+			capacity += repeat;
+		}
+	}
+	return capacity;
+}
+
+// Closes the results file, reporting how many records it holds
+static void resultsFinish(void){
+	__u64 dropped;
+	__u64 written;
+
+	if(!IS_RESULTS_ENABLED){
+		return;
+	}
+	written = i2cRipResultsClose(g_results, &dropped);
+	g_results = NULL;
+	printToTerm("Wrote %llu results to %s\n", (unsigned long long)written, g_resultsFile);
+	if(dropped > 0){
+		logErrors("Error: %llu results did not fit in %s\n", (unsigned long long)dropped, g_resultsFile);
+	}
+}
+
+// Prints the statistics of the run, and writes them as JSON if asked to
+static void statsReport(__u64 wallNs, __u64 parseNs){
+	i2cRipStatsRun_t run;
+
+	cmdNames();
+	run.m_wallNs = wallNs;
+	run.m_parseNs = parseNs;
+	run.m_numCmds = g_streaming ? g_streamNumCmds : g_i2cRipCmdListLength;
+	run.m_cmdNames = g_cmdNames;
+	run.m_numCmdNames = I2C_RIP_NUM_CMDS;
+
+	logAsyncStop();
+	fflush(stdout);
+	i2cRipStatsPrint(g_stats, &run, stderr);
+	if(g_statsJson != NULL && !i2cRipStatsWriteJson(g_stats, &run, g_statsJson)){
+		logErrors("Error: Unable to write stats to %s\n", g_statsJson);
+	}
 }
 
 // Entry point to function
 int main(int argc, char *argv[]){
 	int yes = 0;
-	char filename[20];
-	char logFileName[20] = "i2cRip.log";
 	char *inputFile = NULL;
+	char *outputFile = NULL;
+	char *simModel = NULL;
+	char *end;
+	int compile = 0;
 	int version = 0;
 	int opt;	
+	__u64 parseStart = 0;
+	__u64 parseNs = 0;
+	__u64 runStart = 0;
+	static const struct option longOptions[] = {
+		{"stats", optional_argument, NULL, I2C_RIP_OPT_STATS},
+		{"shadow", no_argument, NULL, I2C_RIP_OPT_SHADOW},
+		{"reconcile", no_argument, NULL, I2C_RIP_OPT_RECONCILE},
+		{"validate-first", no_argument, NULL, I2C_RIP_OPT_VALIDATE_FIRST},
+		{"daemon", optional_argument, NULL, I2C_RIP_OPT_DAEMON},
+		{"priority", required_argument, NULL, I2C_RIP_OPT_PRIORITY},
+		{"results", required_argument, NULL, I2C_RIP_OPT_RESULTS},
+		{NULL, 0, NULL, 0}
+	};
+
+	g_ctx = i2c_rip_ctx_new();
+	if(g_ctx == NULL){
+		printToTerm("Error: Memory allocation failed\n");
+		EXIT(0);
+	}
+	// Parse errors go through the logger as well, reads and stats are hooked once set up
+	ripOpsInit();
+	g_busPriority = lookup_i2c_priority();
 
 	/* handle (optional) flags first */
-	while ((opt = getopt(argc, argv, "ysqdv:h")) != -1) {
+	while ((opt = getopt_long(argc, argv, "ysS:bmOcnpo:qudv:h", longOptions, NULL)) != -1) {
 		switch (opt) {
+			case I2C_RIP_OPT_STATS:
+				if(g_stats == NULL){
+					g_stats = i2cRipStatsCreate();
+				}
+				if(g_stats == NULL){
+					logErrors("Error: Memory allocation failed\n");
+					EXIT(0);
+				}
+				g_statsJson = optarg;
+				break;
+			case I2C_RIP_OPT_SHADOW: g_ripFlags |= I2C_RIP_SHADOW; break;
+			case I2C_RIP_OPT_RECONCILE: g_ripFlags |= I2C_RIP_RECONCILE | I2C_RIP_SHADOW; break;
+			case I2C_RIP_OPT_VALIDATE_FIRST: g_validateFirst = 1; break;
+			case I2C_RIP_OPT_DAEMON: g_daemon = 1; g_daemonPath = optarg; break;
+			case I2C_RIP_OPT_PRIORITY:
+				g_busPriority = (int)strtol(optarg, &end, 0);
+				if(*end || g_busPriority < 0 || g_busPriority > I2C_BUS_PRIORITY_MAX){
+					logErrors("Error: Priority must be from 0 to %d\n", I2C_BUS_PRIORITY_MAX);
+					EXIT(0);
+				}
+				break;
+			case I2C_RIP_OPT_RESULTS: g_resultsFile = optarg; break;
 			case 'y': yes = 1; break;
 			case 's': g_simulate = 1; break;
-			case 'q': g_quietMode = 1; break;
-			case 'd': g_debug = 1; break;
+			case 'S': g_simulate = 1; simModel = optarg; break;
+			case 'b': g_ripFlags |= I2C_RIP_BATCH; break;
+			case 'm': g_mergeWrites = 1; break;
+			case 'O': g_optimize = 1; break;
+			case 'c': compile = 1; break;
+			case 'n': g_useCache = 0; break;
+			case 'p': g_parallel = 1; break;
+			case 'o': outputFile = optarg; break;
+			case 'q': g_ripFlags |= I2C_RIP_QUIET; i2c_rip_ctx_set_flags(g_ctx, g_ripFlags); break;
+			case 'u': g_logAsyncEnabled = 0; break;
+			case 'd': g_ripFlags |= I2C_RIP_DEBUG; break;
 			case 'v': version = 1; break;
 			case 'h':
 				bigHelp();
@@ -693,11 +2112,33 @@ int main(int argc, char *argv[]){
 		}
 	}
 
+	i2c_rip_ctx_set_flags(g_ctx, g_ripFlags);
+	i2c_rip_ctx_set_priority(g_ctx, g_busPriority);
+
 	if (version) {
 		printToTerm("i2c-Rip Version: v%s\n", VERSION_I2CRIP);
 		EXIT(0);
 	}
 
+	if (g_daemon){
+		if (argc != optind){
+			logErrors("Error: The daemon takes no script\n");
+			help();
+			EXIT(0);
+		}
+		if(g_resultsFile != NULL || g_stats != NULL || g_parallel || compile){
+			logErrors("Error: --results, --stats, -p and -c do not apply to the daemon\n");
+			EXIT(0);
+		}
+		if(!backendInit(simModel)){
+			EXIT(0);
+		}
+		ripOpsInit();
+		daemonRun(i2cRipdSocketPath(g_daemonPath));
+		scriptUnload();
+		EXIT(0);
+	}
+
 	if (argc == optind + 1){
 		inputFile = argv[optind];
 		if (access(argv[optind], F_OK) == 0) {
@@ -714,331 +2155,96 @@ int main(int argc, char *argv[]){
 		EXIT(0);
 	}
 
-	if(!inputFileParser(inputFile)){
-		printToTerm("Failed parsing input file %s\n", inputFile);
+	if(compile && outputFile == NULL){
+		logErrors("Error: Compiling needs an output file (-o)\n");
+		help();
 		EXIT(0);
 	}
 
-	if(g_simulate){
-		logMsg("Simulating I2cDevice\n");
+	t_stats = g_stats;
+	if(IS_STATS_ENABLED){
+		parseStart = i2cRipStatsNow();
 	}
-	
-	if (!yes && !confirm()){
+
+	// Passes over the whole command list need it parsed up front
+	g_streaming = !g_validateFirst && !compile && !g_optimize && !g_mergeWrites && !g_parallel && !(g_ripFlags & I2C_RIP_RECONCILE) &&
+		g_resultsFile == NULL;
+	if(!scriptLoad(inputFile)){
+		printToTerm("Failed parsing input file %s\n", inputFile);
 		EXIT(0);
 	}
 
-	for(int i = 0; i < I2C_MAX_BUSSES; i++){
-		g_i2cBusFiles[i].m_isConnected = 0;
-		g_i2cBusFiles[i].m_slaveAddress = I2C_INVALID_SLAVE_ADDRESS;
+	if(g_optimize && !optimizeCmds()){
+		printToTerm("Failed optimizing %s\n", inputFile);
+		EXIT(0);
 	}
 
-	int error = 0;
-	int address;
-	int i2cBus;
-	int activeBus = I2C_NO_BUS_SELECTED;
-
-	int dRegSize = 0;
-	int dataSize = 0;
-	__u8 dRegData[MAX_DREG_SIZE];
-	__u8 readWriteData[MAX_READ_WRITE_SIZE];
-	__u8 varData[MAX_READ_WRITE_SIZE];
+	if(g_mergeWrites && !mergeSequentialWrites()){
+		printToTerm("Failed merging writes in %s\n", inputFile);
+		EXIT(0);
+	}
 
-	for(int i = 0; i < g_i2cRipCmdListLength; i++){
-		i2cRipCmds_t cmd = g_i2cRipCmdList[i].m_cmd;
-    	i2cRipCmdData_t* data = &g_i2cRipCmdList[i].m_data;
-		char lineNumStr[15] = "";
+	if(IS_STATS_ENABLED){
+		parseNs = i2cRipStatsNow() - parseStart;
+	}
 
-		if(i < g_cmdToLineNumberSize){
-			snprintf(lineNumStr, 15, "Line %d:", g_cmdToLineNumber[i]);
+	if(compile){
+		if(!imageWrite(outputFile, 0666, g_sourceHash, g_sourceLength, g_i2cRipCmdList, g_cmdToLineNumber,
+				g_i2cRipCmdListLength, &g_i2cRipPayload)){
+			printToTerm("Failed writing compiled script %s\n", outputFile);
+			EXIT(0);
 		}
+		printToTerm("Compiled %d commands to %s\n", g_i2cRipCmdListLength, outputFile);
+		EXIT(0);
+	}
 
-		switch(cmd){
-			case I2C_RIP_SET_BUS:
-				i2cBus = data->m_single;
-				if ((i2cBus < 0) || (i2cBus >= I2C_MAX_BUSSES)){
-					// failed
-					logErrors("%sError: Invalid Bus selection: %d\n", lineNumStr, i2cBus);
-					error = 1;
-					break;
-				}
-
-				// If bus open
-				if (g_i2cBusFiles[i2cBus].m_isConnected == 0){
-					// Open i2c port
-					g_i2cBusFiles[i2cBus].m_file = open_i2c_dev_If(i2cBus, filename, sizeof(filename));
-					if (g_i2cBusFiles[i2cBus].m_file < 0){
-						logErrors("%sError: Unable to open bus %d\n", lineNumStr, i2cBus);
-						error = 1;
-						break;	
-					}
-					if(check_funcs(g_i2cBusFiles[i2cBus].m_file)){
-						logErrors("%sError: Unable to find RDWD Function %d\n", lineNumStr, i2cBus);
-						error = 1;
-						break;	
-					}
-					g_i2cBusFiles[i2cBus].m_isConnected = 1;
-				}
-				activeBus = i2cBus;
-				g_i2cBusFiles[i2cBus].m_slaveAddress = I2C_INVALID_SLAVE_ADDRESS;
-				logMsg("%sChanged I2cBus to bus %d\n", lineNumStr, activeBus);
-				break;
-
-			case I2C_RIP_SET_ID:
-				address = data->m_single;
-				if ((activeBus < 0) || (activeBus >= I2C_MAX_BUSSES)){
-					logErrors("%sError: Invalid Active Bus: Out of range %d\n", lineNumStr, activeBus);
-					error = 1;
-					break;
-				}
-				if(!g_i2cBusFiles[activeBus].m_isConnected){
-					logErrors("%sError: Invalid Active Bus: Not Connected %d\n", lineNumStr, activeBus);
-					error = 1;
-					break;
-				}
-				if(set_slave_addr_If(g_i2cBusFiles[activeBus].m_file, address)){
-					logErrors("%sError: Unable to set slave address 0x%x to bus %d\n", lineNumStr, address, activeBus);
-					g_i2cBusFiles[activeBus].m_slaveAddress = I2C_INVALID_SLAVE_ADDRESS;
-					error = 1;
-					break;
-				}
-				g_i2cBusFiles[activeBus].m_slaveAddress = address;
-				logMsg("%sChanged Slave addess %#x on bus %d\n", lineNumStr, g_i2cBusFiles[activeBus].m_slaveAddress, activeBus);
-				break;
-
-			case I2C_RIP_DELAY:
-				if(data->m_single <= 0){
-					logErrors("%sError: Invalid Delay time%d.\n");
-					g_supressErrors = 1;
-					break;
-				}
-				logMsg("%sDelay of %dms\n", lineNumStr, (int)data->m_single);
-				usleep((int)data->m_single * 1000);
-				break;
-
-			case I2C_RIP_SUPRESS_ERRORS:
-				if(data->m_single){
-					g_supressErrors = 1;
-					break;
-				}
-				g_supressErrors = 0;
-				logMsg("%sSupress Errors: %s\n", lineNumStr, (g_supressErrors) ? "Enabled" : "Disabled");
-				break;
-
-
-			case I2C_RIP_LOG_TO_FILE:
-				g_logToFile = 0;
-				if(data->m_single){
-					if(g_logFileOpen == 0){
-						g_logFile = fopen(logFileName, "w");
-						if (g_logFile == NULL) {
-							logErrors("%sError: LogFile: %s could not be opened\n", lineNumStr, logFileName);
-							break;
-						}	
-					}
-					g_logToFile = 1;
-					break;
-				}
-				logMsg("%sLogging to file %s: %s\n",lineNumStr, logFileName, (g_logToFile) ? "Enabled" : "Disabled");
-				break;
-
-			case I2C_RIP_LOG_TO_TERM:
-				g_logToTerm = 0;
-				if(data->m_single){
-					g_logToTerm = 1;
-					break;
-				}
-				logMsg("%sLogging to Term: %s\n", lineNumStr, (g_logToTerm) ? "Enabled" : "Disabled");
-				break;
-
-			case I2C_RIP_8_WRITE_BYTE:
-			case I2C_RIP_8_READ_BYTE:
-			case I2C_RIP_8_VERIFY_BYTE:
-			case I2C_RIP_8_WRITE_WORD:
-			case I2C_RIP_8_READ_WORD:
-			case I2C_RIP_8_VERIFY_WORD:
-			case I2C_RIP_16_WRITE_BYTE:
-			case I2C_RIP_16_READ_BYTE:
-			case I2C_RIP_16_VERIFY_BYTE:
-			case I2C_RIP_16_WRITE_WORD:
-			case I2C_RIP_16_READ_WORD:
-			case I2C_RIP_16_VERIFY_WORD:
-				dRegSize = 0;
-				dataSize = 0;
-
-				if ((activeBus < 0) || (activeBus >= I2C_MAX_BUSSES)){
-					logErrors("%sError: Invalid Active Bus: Out of range 0x%x\n",  lineNumStr, activeBus);
-					error = 1;
-					break;
-				}
-				if(!g_i2cBusFiles[activeBus].m_isConnected){
-					logErrors("%sError: Invalid Active Bus: Not Connected 0x%x\n", lineNumStr, activeBus);
-					error = 1;
-					break;
-				}
-				if(g_i2cBusFiles[activeBus].m_slaveAddress == I2C_INVALID_SLAVE_ADDRESS){
-					logErrors("%sError: Invalid slave address 0x%x\n", lineNumStr, g_i2cBusFiles[activeBus].m_slaveAddress);
-					error = 1;
-					break;
-				}
-
-				switch(cmd){
-					case I2C_RIP_8_VERIFY_BYTE:
-					case I2C_RIP_8_WRITE_BYTE:
-					case I2C_RIP_8_READ_BYTE:
-						dRegSize = 1;
-						dataSize = 1;
-						dRegData[0] = (__u16)data->m_8_8.m_addr;
-						readWriteData[0] = (__u8)data->m_8_8.m_data;
-						break;
-
-
-					case I2C_RIP_8_WRITE_WORD:
-					case I2C_RIP_8_READ_WORD:
-					case I2C_RIP_8_VERIFY_WORD:
-						dRegSize = 1;
-						dataSize = 2;
-						dRegData[0] = (__u16)data->m_8_16.m_addr;
-						readWriteData[0] = (__u8)((data->m_8_16.m_data >> 8) & 0xFF);
-						readWriteData[1] = (__u8)(data->m_8_16.m_data & 0xFF);
-						break;
-
-					case I2C_RIP_16_WRITE_BYTE:
-					case I2C_RIP_16_READ_BYTE:
-					case I2C_RIP_16_VERIFY_BYTE:
-						dRegSize = 2;
-						dataSize = 1;
-						dRegData[0] = (__u8)((data->m_16_8.m_addr >> 8) & 0xFF);
-						dRegData[1] = (__u8)(data->m_16_8.m_addr & 0xFF);
-						readWriteData[0] = (__u8)data->m_16_8.m_data;
-						break;
-
-					case I2C_RIP_16_WRITE_WORD:
-					case I2C_RIP_16_READ_WORD:
-					case I2C_RIP_16_VERIFY_WORD:
-						dRegSize = 2;
-						dataSize = 2;
-						dRegData[0] = (__u8)((data->m_16_16.m_addr >> 8) & 0xFF);
-						dRegData[1] = (__u8)(data->m_16_16.m_addr & 0xFF);
-						readWriteData[0] = (__u8)((data->m_16_16.m_data >> 8) & 0xFF);
-						readWriteData[1] = (__u8)(data->m_16_16.m_data & 0xFF);
-						break;
-
-					default:
-						logErrors("%sError: Invalid Write/Read/Verify command\n", lineNumStr);
-						error = 1;
-						break;
-				}
-
-				if( dataSize >=  MAX_READ_WRITE_SIZE ){
-					logErrors("%sError: Write/Read/Verify size too large %d\n", lineNumStr, dataSize);
-					error = 1;
-					break;
-				}
+	if(!backendInit(simModel)){
+		EXIT(0);
+	}
 
-				switch(cmd){
-					case I2C_RIP_8_WRITE_BYTE:
-					case I2C_RIP_8_WRITE_WORD:
-					case I2C_RIP_16_WRITE_BYTE:
-					case I2C_RIP_16_WRITE_WORD:
-						if(!i2cWrite(g_i2cBusFiles[activeBus].m_file, g_i2cBusFiles[activeBus].m_slaveAddress, dRegData, dRegSize, readWriteData, dataSize)){
-							logErrors("%sError: Failed to Write. Bus: %d, Address: 0x%x\n", lineNumStr, activeBus, g_i2cBusFiles[activeBus].m_slaveAddress);
-							error = 1;
-							break;
-						}
-						if(IS_LOG_ENABLED){
-							logMsg("%sWriting %d Byte(s).\n\tREG:", lineNumStr, dataSize);
-							for (int j = 0; j < dRegSize; j++){
-								logMsg("0x%02x,", dRegData[j]);
-							}
-							logMsg("\tData:");
-							for (int j = 0; j < dataSize; j++){
-								logMsg("0x%02x,", readWriteData[j]);
-							}
-							logMsg("\n");
-						}
-						break;
+	if (!yes && !confirm()){
+		EXIT(0);
+	}
 
-					case I2C_RIP_8_READ_BYTE:
-					case I2C_RIP_8_READ_WORD:
-					case I2C_RIP_16_READ_BYTE:
-					case I2C_RIP_16_READ_WORD:
-						if(!i2cRead(g_i2cBusFiles[activeBus].m_file, g_i2cBusFiles[activeBus].m_slaveAddress, dRegData, dRegSize, readWriteData, dataSize)){
-							logErrors("%sError: Failed to Read. Bus: %d, Address: 0x%x\n", lineNumStr, activeBus, g_i2cBusFiles[activeBus].m_slaveAddress);
-							error = 1;
-							break;
-						}
-						if(IS_LOG_ENABLED){
-							logMsg("%sReading %d Byte(s).\n\tREG:", lineNumStr, dataSize);
-							for (int j = 0; j < dRegSize; j++){
-								logMsg("0x%02x,", dRegData[j]);
-							}
-							logMsg("\tData:");
-							for (int j = 0; j < dataSize; j++){
-								logMsg("0x%02x,", readWriteData[j]);
-							}
-							logMsg("\n");
-						}
-						break;
+	if(g_resultsFile != NULL){
+		g_results = i2cRipResultsOpen(g_resultsFile, resultsCapacity());
+		if(g_results == NULL){
+			logErrors("Error: Unable to create results file %s: %s\n", g_resultsFile, strerror(errno));
+			EXIT(0);
+		}
+	}
+	ripOpsInit();
 
-					case I2C_RIP_8_VERIFY_BYTE:
-					case I2C_RIP_8_VERIFY_WORD:
-					case I2C_RIP_16_VERIFY_BYTE:
-					case I2C_RIP_16_VERIFY_WORD:
-						memcpy(varData, readWriteData, dataSize); 
-						if(!i2cRead(g_i2cBusFiles[activeBus].m_file, g_i2cBusFiles[activeBus].m_slaveAddress, dRegData, dRegSize, readWriteData, dataSize)){
-							logErrors("%sError: Failed to Verify. Bus: %d, Address: 0x%x\n", lineNumStr, activeBus, g_i2cBusFiles[activeBus].m_slaveAddress);
-							error = 1;
-							break;
-						}
-						
-						if(memcmp(readWriteData, varData, dataSize) != 0){
-							error = 1;
-						}
-
-						if(IS_LOG_ENABLED){
-							logMsg("%sVerifying %d Byte(s).\n\tREG:", lineNumStr, dataSize);
-							for (int j = 0; j < dRegSize; j++){
-								logMsg("0x%02x,", dRegData[j]);
-							}
-							logMsg("\tData:");
-							for (int j = 0; j < dataSize; j++){
-								logMsg("0x%02x,", readWriteData[j]);
-							}
-							logMsg("\n");
-							if(error){
-								logMsg("Verifying FAILED\n");
-								logMsg("\tExpected Data:");
-								for (int j = 0; j < dataSize; j++){
-									logMsg("0x%02x,", varData[j]);
-								}
-								logMsg("\n");
-							}
-							else{
-								logMsg("Verifying PASSED\n");
-							}
-							
-						}
-						break;
+	int error;
+	if(g_logAsyncEnabled){
+		logAsyncStart();
+	}
+	if(IS_STATS_ENABLED){
+		runStart = i2cRipStatsNow();
+	}
 
-					default:
-						logErrors("%sError: Invalid Write/Read/Verify command\n", lineNumStr);
-						error = 1;
-						break;
-				}
-				break;				
+	if(!g_streaming){
+		i2c_rip_ctx_set_script(g_ctx, g_i2cRipCmdList, g_cmdToLineNumber, g_i2cRipCmdListLength, g_i2cRipPayload.data);
+	}
+	if(g_parallel){
+		error = !executeParallel();
+	}
+	else if(g_streaming){
+		error = !executeStream();
+		parseNs = g_streamParseNs;
+	}
+	else{
+		error = i2c_rip_ctx_run(g_ctx) < 0;
+	}
 
-			default:
-				logErrors("%sError: Invalid Write/Read/Verify command\n", lineNumStr);
-				error = 1;
-				break;
-		}
+	if(IS_STATS_ENABLED){
+		statsReport(i2cRipStatsNow() - runStart, parseNs);
+	}
 
-		if(error){
-			if(!g_supressErrors){
-				break;
-			}
-		}
-		error = 0;
+	logAsyncStop();
+	resultsFinish();
+	if(g_streaming && !g_streamOk){
+		printToTerm("Failed parsing input file %s\n", inputFile);
 	}
 	printToTerm("Exiting: I2cRip %s\n", (error) ? "FAILED" : "was SUCCESSFUL");
 
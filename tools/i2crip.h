@@ -29,107 +29,125 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <i2c/smbus.h>
+#include <i2c/rip.h>
 #include "i2cbusses.h"
 #include "util.h"
+#include "i2cripstats.h"
 #include "../version.h"
 
-#define MAX_READ_WRITE_SIZE 64
-#define MAX_DREG_SIZE 2
-
-#define I2C_RIP_MAX_ARGUMENTS 50
-#define I2C_RIP_LOOKUP_TABLE_SIZE 18
+#define MAX_READ_WRITE_SIZE I2C_RIP_XFER_MAX
 
 #define I2C_NO_BUS_SELECTED -1
 #define I2C_INVALID_SLAVE_ADDRESS 0xFF
 #define I2C_MAX_BUSSES 64
+#define I2C_MAX_SLAVES 0x80
+
+#define I2C_RIP_IMAGE_MAGIC "I2CRIPC\0"
+#define I2C_RIP_IMAGE_VERSION 2
+
+#define I2C_RIP_LOG_NUM_DESTS 3
+
+#define I2C_RIP_LOG_RING_SIZE 4096
+#define I2C_RIP_LOG_TEXT_MAX 128
+#define I2C_RIP_LOG_BUFF_SIZE 65536
+
+// Long options without a short form
+#define I2C_RIP_OPT_STATS 0x100
+#define I2C_RIP_OPT_SHADOW 0x101
+#define I2C_RIP_OPT_RECONCILE 0x102
+#define I2C_RIP_OPT_VALIDATE_FIRST 0x103
+#define I2C_RIP_OPT_DAEMON 0x104
+#define I2C_RIP_OPT_PRIORITY 0x105
+#define I2C_RIP_OPT_RESULTS 0x106
+
+// Compiled scripts an i2crip --daemon keeps
+#define I2C_RIP_DAEMON_CACHE_SIZE 32
+
+// Commands parsed ahead of execution when a script is streamed, a power of two
+#define I2C_RIP_STREAM_QUEUE_SIZE 256
 
 #define EXIT(N) i2cRipExit(N)
 
-typedef struct i2cBusConnection {
-	int m_file;
-	int m_isConnected;
-	__u8 m_slaveAddress;
-}i2cBusConnection_t;
-
-typedef enum i2cRipCmds {
-	I2C_RIP_INVALID = -1,
-	I2C_RIP_SET_BUS = 0,
-	I2C_RIP_SET_ID,
-	I2C_RIP_DELAY,
-	I2C_RIP_SUPRESS_ERRORS,
-	I2C_RIP_LOG_TO_FILE,
-	I2C_RIP_LOG_TO_TERM,
-	I2C_RIP_8_WRITE_BYTE,
-	I2C_RIP_16_WRITE_BYTE,
-	I2C_RIP_8_WRITE_WORD,
-	I2C_RIP_16_WRITE_WORD,
-	I2C_RIP_8_READ_BYTE,
-	I2C_RIP_16_READ_BYTE,
-	I2C_RIP_8_READ_WORD,
-	I2C_RIP_16_READ_WORD,
-	I2C_RIP_8_VERIFY_BYTE,
-	I2C_RIP_16_VERIFY_BYTE,
-	I2C_RIP_8_VERIFY_WORD,
-	I2C_RIP_16_VERIFY_WORD,
-} i2cRipCmds_t;
-
-typedef struct ripCmd8_8{
-    __u8 m_addr;
-    __u8 m_data;
-}ripCmd8_8_t;
-
-typedef struct ripCmd8_16{
-    __u8 m_addr;
-    __u16 m_data;
-}ripCmd8_16_t;
-
-typedef struct ripCmd16_8{
-    __u16 m_addr;
-    __u8 m_data;
-}ripCmd16_8_t;
-
-typedef struct ripCmd16_16{
-    __u16 m_addr;
-    __u16 m_data;
-}ripCmd16_16_t;
-
-typedef union i2cRipCmdData{
-    ripCmd8_8_t m_8_8;
-    ripCmd8_16_t m_8_16;
-    ripCmd16_8_t m_16_8;
-    ripCmd16_16_t m_16_16;
-    int m_single;
-} i2cRipCmdData_t;
-
-typedef struct i2cRipCmdsLookUp{
-	i2cRipCmds_t m_cmd;
-	int m_numArgs;
-	char m_string[20];
-} i2cRipCmdsLookUp_t ;
-
-i2cRipCmdsLookUp_t g_cmdLookUpTable[I2C_RIP_LOOKUP_TABLE_SIZE] = {
-	{I2C_RIP_SET_BUS, 1, "SET-BUS"},
-	{I2C_RIP_SET_ID, 1, "SET-ID"},
-	{I2C_RIP_DELAY, 1, "DELAY"},
-	{I2C_RIP_SUPRESS_ERRORS, 1, "SUPRESS-ERRORS"},
-	{I2C_RIP_LOG_TO_FILE, 1, "LOG-FILE"},
-	{I2C_RIP_LOG_TO_TERM, 1, "LOG-TERM"},
-	{I2C_RIP_8_WRITE_BYTE, 2, "WB-8"},
-	{I2C_RIP_16_WRITE_BYTE, 2, "WB-16"},
-	{I2C_RIP_8_WRITE_WORD, 2, "WW-8"},
-	{I2C_RIP_16_WRITE_WORD, 2, "WW-16"},
-	{I2C_RIP_8_READ_BYTE, 1, "RB-8"},
-	{I2C_RIP_16_READ_BYTE, 1, "RB-16"},
-	{I2C_RIP_8_READ_WORD, 1, "RW-8"},	
-	{I2C_RIP_16_READ_WORD, 1, "RW-16"},	
-	{I2C_RIP_8_VERIFY_BYTE, 2, "VB-8"},
-	{I2C_RIP_16_VERIFY_BYTE, 2, "VB-16"},
-	{I2C_RIP_8_VERIFY_WORD, 2, "VW-8"},	
-	{I2C_RIP_16_VERIFY_WORD, 2, "VW-16"}
-};
-
-typedef struct i2cRipCmdStruct {
-	i2cRipCmds_t m_cmd;
-    i2cRipCmdData_t m_data;
-	__u8 m_isValid;
-} i2cRipCmdStruct_t;
+// VOLATILE range of one device, seen by the -O compile pass
+typedef struct ripCmdVolatile {
+	int m_bus;
+	int m_address;
+	struct i2c_rip_range m_range;
+} ripCmdVolatile_t;
+
+// Compiled script file layout:
+// header, m_numCmds commands, m_numCmds line numbers, payload
+typedef struct i2cRipImageHeader {
+	char m_magic[8];
+	__u32 m_version;
+	__u32 m_numCmdTypes;
+	__u32 m_cmdSize;
+	__u32 m_numCmds;
+	__u32 m_payloadLength;
+	__u32 m_sourceLength;
+	__u64 m_sourceHash;
+} i2cRipImageHeader_t;
+
+// Compiled script kept by the daemon, keyed by the hash of its text
+typedef struct i2cRipDaemonCached {
+	__u64 m_hash;
+	__u64 m_lastUse;
+	char* m_image;
+	size_t m_size;
+} i2cRipDaemonCached_t;
+
+// Commands of a streamed script from its first LOOP on, parsed in full
+// Payload offsets are into m_payload, not into the ring slots
+typedef struct i2cRipStreamRest {
+	struct i2c_rip_cmd* m_cmds;
+	int* m_lines;
+	int m_length;
+	int m_size;
+	struct i2c_rip_arena m_payload;
+} i2cRipStreamRest_t;
+
+// One piece of log output captured on a worker thread
+typedef struct i2cRipLogEntry {
+	int m_cmdIndex;
+	int m_seq;
+	int m_offset;
+	int m_length;
+	__u8 m_dest;
+} i2cRipLogEntry_t;
+
+// Log output of a worker thread, replayed in script order
+typedef struct i2cRipLogCapture {
+	i2cRipLogEntry_t* m_entries;
+	int m_numEntries;
+	int m_entriesSize;
+	char* m_text;
+	int m_textLength;
+	int m_textSize;
+} i2cRipLogCapture_t;
+
+typedef struct i2cRipLogRef {
+	const i2cRipLogEntry_t* m_entry;
+	const char* m_text;
+} i2cRipLogRef_t;
+
+// Worker thread running one bus stream between two barriers
+typedef struct i2cRipWorker {
+	pthread_t m_thread;
+	int m_stream;
+	int m_first;
+	int m_last;
+	int m_ok;
+	i2cRipLogCapture_t m_log;
+	i2cRipStats_t* m_stats;
+} i2cRipWorker_t;
+
+// Fixed size entry of the logger ring, either text or a transfer
+typedef struct i2cRipLogRecord {
+	__u8 m_isTransfer;
+	__u8 m_dest;
+	__u16 m_length;
+	union {
+		char m_text[I2C_RIP_LOG_TEXT_MAX];
+		struct i2c_rip_xfer m_transfer;
+	} m_u;
+} i2cRipLogRecord_t;
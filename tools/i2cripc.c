@@ -0,0 +1,140 @@
+/*
+    i2cripc.c - Runs i2crip scripts on a running i2crip --daemon
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "i2cripd.h"
+#include "../version.h"
+
+static void help(void){
+	fprintf(stderr,
+		"Usage: i2cripc [-b] [-d] [-q] [-u SOCKET] FILELOCATION\n"
+		"  Runs a script, text or compiled, on a running i2crip --daemon.\n"
+		"    -b (Batch consecutive transfers into one I2C_RDWR call)\n"
+		"    -d (Debug, log line numbers)\n"
+		"    -q (Quiet)\n"
+		"    -u SOCKET (Daemon socket, default $" I2C_RIPD_SOCKET_ENV " or " I2C_RIPD_SOCKET ")\n"
+		"    -v (Version)\n"
+		"  Exits with 0 if the script was successful, 1 if it failed, 2 if it did not run\n");
+}
+
+// Copies reply frames to stdout and stderr until the result
+// Returns the exit status of the script, -1 if the reply ended early
+static int relayReply(int fd){
+	char text[4096];
+
+	for(;;){
+		i2cRipdFrame_t frame;
+		__u32 left;
+
+		if(i2cRipdReadFull(fd, &frame, sizeof(frame)) < 0){
+			return -1;
+		}
+		if(frame.m_type == I2C_RIPD_FRAME_EXIT){
+			__u32 status;
+			if(frame.m_length != sizeof(status) || i2cRipdReadFull(fd, &status, sizeof(status)) < 0){
+				return -1;
+			}
+			return (int)status;
+		}
+
+		for(left = frame.m_length; left > 0; ){
+			__u32 chunk = (left > sizeof(text)) ? (__u32)sizeof(text) : left;
+			if(i2cRipdReadFull(fd, text, chunk) < 0){
+				return -1;
+			}
+			fwrite(text, 1, chunk, (frame.m_type == I2C_RIPD_FRAME_STDERR) ? stderr : stdout);
+			left -= chunk;
+		}
+	}
+}
+
+int main(int argc, char *argv[]){
+	i2cRipdRequest_t request;
+	const char *socketPath = NULL;
+	struct stat st;
+	__u32 flags = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "bdqu:vh")) != -1){
+		switch(opt){
+			case 'b': flags |= I2C_RIPD_FLAG_BATCH; break;
+			case 'd': flags |= I2C_RIPD_FLAG_DEBUG; break;
+			case 'q': flags |= I2C_RIPD_FLAG_QUIET; break;
+			case 'u': socketPath = optarg; break;
+			case 'v':
+				fprintf(stderr, "i2c-Rip Version: v%s\n", VERSION_I2CRIP);
+				return 0;
+			default:
+				help();
+				return 2;
+		}
+	}
+	if(argc != optind + 1){
+		help();
+		return 2;
+	}
+
+	int file = open(argv[optind], O_RDONLY);
+	if(file < 0 || fstat(file, &st) < 0){
+		fprintf(stderr, "File: %s could not be opened\n", argv[optind]);
+		return 2;
+	}
+	if(st.st_size == 0 || st.st_size > I2C_RIPD_MAX_SCRIPT){
+		fprintf(stderr, "Error: %s is empty or too large\n", argv[optind]);
+		return 2;
+	}
+	void *script = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if(script == MAP_FAILED){
+		fprintf(stderr, "File: %s could not be opened\n", argv[optind]);
+		return 2;
+	}
+
+	socketPath = i2cRipdSocketPath(socketPath);
+	int fd = i2cRipdConnect(socketPath);
+	if(fd < 0){
+		fprintf(stderr, "Error: Unable to connect to i2crip daemon at %s: %s\n", socketPath, strerror(errno));
+		return 2;
+	}
+
+	request.m_magic = I2C_RIPD_MAGIC;
+	request.m_version = I2C_RIPD_VERSION;
+	request.m_flags = flags;
+	request.m_length = (__u32)st.st_size;
+	if(i2cRipdWriteFull(fd, &request, sizeof(request)) < 0 || i2cRipdWriteFull(fd, script, st.st_size) < 0){
+		fprintf(stderr, "Error: Sending script to i2crip daemon failed: %s\n", strerror(errno));
+		return 2;
+	}
+	munmap(script, st.st_size);
+
+	int status = relayReply(fd);
+	close(fd);
+	if(status < 0){
+		fprintf(stderr, "Error: i2crip daemon closed the connection\n");
+		return 2;
+	}
+	return (status == 0) ? 0 : 1;
+}
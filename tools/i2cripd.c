@@ -0,0 +1,236 @@
+/*
+    i2cripd.c - Script server protocol for i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+    i2crip --daemon listens on a local stream socket and runs one script per
+    connection. The client sends an i2cRipdRequest_t and the script, the
+    daemon answers with the log output of the run as frames and closes the
+    connection after the exit frame.
+*/
+
+#define _GNU_SOURCE 1 /* for struct ucred */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "i2cripd.h"
+
+// Socket path: the one given, else $I2CRIPD_SOCKET, else the default
+const char *i2cRipdSocketPath(const char *path){
+	const char *env;
+
+	if(path != NULL){
+		return path;
+	}
+	env = getenv(I2C_RIPD_SOCKET_ENV);
+	if(env != NULL && env[0] != '\0'){
+		return env;
+	}
+	return I2C_RIPD_SOCKET;
+}
+
+static int ripdAddress(const char *path, struct sockaddr_un *addr){
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+// The socket file is created 0600 whatever the umask, connecting takes write access
+static int ripdBind(int fd, const struct sockaddr_un *addr){
+	mode_t mask = umask(0177);
+	int ret = bind(fd, (const struct sockaddr *)addr, sizeof(*addr));
+
+	umask(mask);
+	return ret;
+}
+
+// Listening socket at path, only its owner and root can connect
+// A socket file left behind by a daemon that died is replaced, a live one is not
+int i2cRipdListen(const char *path){
+	struct sockaddr_un addr;
+	int fd;
+
+	if(ripdAddress(path, &addr) < 0){
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		return -1;
+	}
+
+	if(ripdBind(fd, &addr) < 0){
+		int probe;
+
+		if(errno != EADDRINUSE){
+			close(fd);
+			return -1;
+		}
+		probe = i2cRipdConnect(path);
+		if(probe >= 0){
+			close(probe);
+			close(fd);
+			errno = EADDRINUSE;
+			return -1;
+		}
+		unlink(path);
+		if(ripdBind(fd, &addr) < 0){
+			close(fd);
+			return -1;
+		}
+	}
+
+	if(listen(fd, 16) < 0){
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	return fd;
+}
+
+int i2cRipdConnect(const char *path){
+	struct sockaddr_un addr;
+	int fd;
+
+	if(ripdAddress(path, &addr) < 0){
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+// User id of the process at the other end of a connected socket
+int i2cRipdPeerUid(int fd, uid_t *uid){
+	struct ucred cred;
+	socklen_t length = sizeof(cred);
+
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) < 0){
+		return -1;
+	}
+	*uid = cred.uid;
+	return 0;
+}
+
+// Reads and writes on fd that make no progress for seconds fail with EAGAIN
+int i2cRipdSetTimeout(int fd, int seconds){
+	struct timeval tv;
+
+	tv.tv_sec = seconds;
+	tv.tv_usec = 0;
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0){
+		return -1;
+	}
+	return 0;
+}
+
+// Returns 0 once size bytes are read, -1 on an error or end of stream
+int i2cRipdReadFull(int fd, void *data, size_t size){
+	char *pos = (char *)data;
+
+	while(size > 0){
+		ssize_t n = read(fd, pos, size);
+		if(n < 0 && errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			return -1;
+		}
+		pos += n;
+		size -= n;
+	}
+	return 0;
+}
+
+// Returns 0 once size bytes are written, a peer that went away is not a signal
+int i2cRipdWriteFull(int fd, const void *data, size_t size){
+	const char *pos = (const char *)data;
+
+	while(size > 0){
+		ssize_t n = send(fd, pos, size, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			return -1;
+		}
+		pos += n;
+		size -= n;
+	}
+	return 0;
+}
+
+// Adds a frame to a reply, consecutive text of the same type shares a frame
+int i2cRipdReplyAppend(i2cRipdReply_t *reply, __u32 type, const void *data, __u32 length){
+	i2cRipdFrame_t frame;
+	size_t needed = reply->m_length + sizeof(frame) + length;
+
+	if(needed > reply->m_size){
+		size_t size = (reply->m_size > 0) ? reply->m_size : 4096;
+		char *grown;
+
+		while(size < needed){
+			size *= 2;
+		}
+		grown = (char *)realloc(reply->m_data, size);
+		if(grown == NULL){
+			return -1;
+		}
+		reply->m_data = grown;
+		reply->m_size = size;
+	}
+
+	if(type != I2C_RIPD_FRAME_EXIT && reply->m_length > 0){
+		memcpy(&frame, reply->m_data + reply->m_lastFrame, sizeof(frame));
+		if(frame.m_type == type){
+			memcpy(reply->m_data + reply->m_length, data, length);
+			reply->m_length += length;
+			frame.m_length += length;
+			memcpy(reply->m_data + reply->m_lastFrame, &frame, sizeof(frame));
+			return 0;
+		}
+	}
+
+	frame.m_type = type;
+	frame.m_length = length;
+	reply->m_lastFrame = reply->m_length;
+	memcpy(reply->m_data + reply->m_length, &frame, sizeof(frame));
+	memcpy(reply->m_data + reply->m_length + sizeof(frame), data, length);
+	reply->m_length = needed;
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+    i2cripd.h - Script server protocol for i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef _I2CRIPD_H
+#define _I2CRIPD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+#define I2C_RIPD_SOCKET "/run/i2cripd.sock"
+#define I2C_RIPD_SOCKET_ENV "I2CRIPD_SOCKET"
+#define I2C_RIPD_MAGIC 0x44504952
+#define I2C_RIPD_VERSION 1
+#define I2C_RIPD_MAX_SCRIPT (64 * 1024 * 1024)
+// Seconds a client may stall while sending a request or taking the reply
+#define I2C_RIPD_TIMEOUT_S 10
+
+// Request flags, the same as the i2crip options
+#define I2C_RIPD_FLAG_BATCH 0x01
+#define I2C_RIPD_FLAG_DEBUG 0x02
+#define I2C_RIPD_FLAG_QUIET 0x04
+
+// Reply frames, log text for stdout or stderr, then the result
+#define I2C_RIPD_FRAME_STDOUT 1
+#define I2C_RIPD_FRAME_STDERR 2
+#define I2C_RIPD_FRAME_EXIT 3
+
+// A request is this header followed by m_length bytes of script text or image
+typedef struct i2cRipdRequest {
+	__u32 m_magic;
+	__u32 m_version;
+	__u32 m_flags;
+	__u32 m_length;
+} i2cRipdRequest_t;
+
+// A reply is a sequence of frames, each followed by m_length bytes
+// The exit frame carries a __u32 status, 0 when the script succeeded
+typedef struct i2cRipdFrame {
+	__u32 m_type;
+	__u32 m_length;
+} i2cRipdFrame_t;
+
+// A reply built up in memory and sent with one write
+// Last frame is the offset of the frame text is appended to
+typedef struct i2cRipdReply {
+	char* m_data;
+	size_t m_length;
+	size_t m_size;
+	size_t m_lastFrame;
+} i2cRipdReply_t;
+
+const char *i2cRipdSocketPath(const char *path);
+int i2cRipdListen(const char *path);
+int i2cRipdConnect(const char *path);
+int i2cRipdPeerUid(int fd, uid_t *uid);
+int i2cRipdSetTimeout(int fd, int seconds);
+int i2cRipdReadFull(int fd, void *data, size_t size);
+int i2cRipdWriteFull(int fd, const void *data, size_t size);
+int i2cRipdReplyAppend(i2cRipdReply_t *reply, __u32 type, const void *data, __u32 length);
+
+#endif
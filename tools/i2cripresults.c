@@ -0,0 +1,120 @@
+/*
+    i2cripresults.c - Binary read results of i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+    The results file is sized for every record the script can produce
+    before it runs and mapped shared, so a read costs one atomic increment
+    and a copy into the page cache. Space that is never used stays a hole
+    and is cut off when the file is closed.
+*/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "i2cripresults.h"
+
+static __u64 clockNs(clockid_t clock){
+	struct timespec now;
+
+	clock_gettime(clock, &now);
+	return (__u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Creates filename with room for capacity records
+// Returns NULL with errno set on failure
+i2cRipResults_t *i2cRipResultsOpen(const char *filename, __u64 capacity){
+	i2cRipResults_t *results = (i2cRipResults_t *)calloc(1, sizeof(i2cRipResults_t));
+	i2cRipResultsHeader_t *header;
+
+	if(results == NULL){
+		return NULL;
+	}
+	// A file of just the header still maps
+	results->m_capacity = capacity;
+	results->m_mapSize = sizeof(i2cRipResultsHeader_t) + capacity * sizeof(i2cRipResult_t);
+	atomic_init(&results->m_next, 0);
+
+	results->m_file = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(results->m_file < 0){
+		free(results);
+		return NULL;
+	}
+	if(ftruncate(results->m_file, (off_t)results->m_mapSize) < 0){
+		close(results->m_file);
+		free(results);
+		return NULL;
+	}
+	results->m_map = (char *)mmap(NULL, results->m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, results->m_file, 0);
+	if(results->m_map == MAP_FAILED){
+		close(results->m_file);
+		free(results);
+		return NULL;
+	}
+
+	header = (i2cRipResultsHeader_t *)results->m_map;
+	memcpy(header->m_magic, I2C_RIP_RESULTS_MAGIC, sizeof(header->m_magic));
+	header->m_version = I2C_RIP_RESULTS_VERSION;
+	header->m_headerSize = sizeof(i2cRipResultsHeader_t);
+	header->m_recordSize = sizeof(i2cRipResult_t);
+	header->m_dataMax = I2C_RIP_RESULTS_DATA_MAX;
+	header->m_capacity = capacity;
+	header->m_startRealtimeNs = clockNs(CLOCK_REALTIME);
+	header->m_startMonotonicNs = clockNs(CLOCK_MONOTONIC);
+	return results;
+}
+
+// Next free record with its timestamp set, NULL once the file is full
+i2cRipResult_t *i2cRipResultsClaim(i2cRipResults_t *results){
+	__u64 index = atomic_fetch_add_explicit(&results->m_next, 1, memory_order_relaxed);
+	i2cRipResult_t *result;
+
+	if(index >= results->m_capacity){
+		return NULL;
+	}
+	result = (i2cRipResult_t *)(results->m_map + sizeof(i2cRipResultsHeader_t)) + index;
+	result->m_timestampNs = clockNs(CLOCK_MONOTONIC);
+	return result;
+}
+
+// Writes the record count, trims the file to it and frees results
+// Returns the number of records, dropped is set to those that did not fit
+__u64 i2cRipResultsClose(i2cRipResults_t *results, __u64 *dropped){
+	__u64 claimed;
+	__u64 used;
+
+	if(results == NULL){
+		*dropped = 0;
+		return 0;
+	}
+	claimed = atomic_load(&results->m_next);
+	used = (claimed > results->m_capacity) ? results->m_capacity : claimed;
+	*dropped = claimed - used;
+
+	((i2cRipResultsHeader_t *)results->m_map)->m_numRecords = used;
+	munmap(results->m_map, results->m_mapSize);
+	if(ftruncate(results->m_file, (off_t)(sizeof(i2cRipResultsHeader_t) + used * sizeof(i2cRipResult_t))) < 0){
+		// The count in the header still tells where records end
+	}
+	close(results->m_file);
+	free(results);
+	return used;
+}
@@ -0,0 +1,73 @@
+/*
+    i2cripresults.h - Binary read results of i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef _I2CRIPRESULTS_H
+#define _I2CRIPRESULTS_H
+
+#include <stdatomic.h>
+#include <linux/types.h>
+
+#define I2C_RIP_RESULTS_MAGIC "I2CRIPR\0"
+#define I2C_RIP_RESULTS_VERSION 1
+#define I2C_RIP_RESULTS_DATA_MAX 64
+
+// File layout: header, then m_numRecords records of m_recordSize bytes
+// Record N is at m_headerSize + N * m_recordSize, all fields host endian
+// Timestamps are CLOCK_MONOTONIC, the header holds both clocks at the start
+typedef struct i2cRipResultsHeader {
+	char m_magic[8];
+	__u32 m_version;
+	__u32 m_headerSize;
+	__u32 m_recordSize;
+	__u32 m_dataMax;
+	__u64 m_capacity;
+	__u64 m_numRecords;
+	__u64 m_startRealtimeNs;
+	__u64 m_startMonotonicNs;
+	__u64 m_reserved;
+} i2cRipResultsHeader_t;
+
+// Data of one read transfer, a block read has one record per chunk
+typedef struct i2cRipResult {
+	__u64 m_timestampNs;
+	__u32 m_cmdIndex;
+	__u32 m_line;
+	__u16 m_bus;
+	__u16 m_reg;
+	__u8 m_address;
+	__u8 m_cmd;
+	__u8 m_length;
+	__u8 m_reserved;
+	__u8 m_data[I2C_RIP_RESULTS_DATA_MAX];
+} i2cRipResult_t;
+
+// Open results file, records are claimed by any thread
+typedef struct i2cRipResults {
+	int m_file;
+	char *m_map;
+	size_t m_mapSize;
+	__u64 m_capacity;
+	atomic_ullong m_next;
+} i2cRipResults_t;
+
+i2cRipResults_t *i2cRipResultsOpen(const char *filename, __u64 capacity);
+i2cRipResult_t *i2cRipResultsClaim(i2cRipResults_t *results);
+__u64 i2cRipResultsClose(i2cRipResults_t *results, __u64 *dropped);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+    i2cripsim.c - Simulated I2C devices for i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+    Every bus holds up to 128 devices, each a 64K register map. Devices are
+    created on first access with the register width of the first read, or
+    8 bit. A model file can declare devices, preload registers and set the
+    time each transfer takes:
+
+        DEVICE <bus> <address> <8|16>
+        REG <bus> <address> <register> <value>
+        LATENCY <us per I2C_RDWR call> [us per byte]
+
+    Once any device is declared, undeclared addresses NACK.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "i2cripsim.h"
+
+static i2cRipSimDevice_t *g_simDevices[I2C_RIP_SIM_MAX_BUSSES][I2C_RIP_SIM_MAX_SLAVES];
+static int g_simStrict = 0;
+static long g_simLatencyUs = 0;
+static long g_simByteLatencyUs = 0;
+
+// Finds a device, creating it unless the model lists its devices
+static i2cRipSimDevice_t *simDevice(int bus, int address, int create){
+	if(bus < 0 || bus >= I2C_RIP_SIM_MAX_BUSSES || address < 0 || address >= I2C_RIP_SIM_MAX_SLAVES){
+		return NULL;
+	}
+
+	if(g_simDevices[bus][address] == NULL && create){
+		g_simDevices[bus][address] = (i2cRipSimDevice_t *)calloc(1, sizeof(i2cRipSimDevice_t));
+	}
+	return g_simDevices[bus][address];
+}
+
+// Parses a number the way i2crip scripts do, 0x for hex
+static int simNumber(const char *str, long *num){
+	char *endptr;
+
+	if(str == NULL){
+		return 0;
+	}
+	*num = strtol(str, &endptr, 0);
+	return *endptr == '\0';
+}
+
+// Loads a device model file
+int i2cRipSimLoadConfig(const char *filename){
+	char line[256];
+	int lineNumber = 0;
+	FILE *file = fopen(filename, "r");
+
+	if(file == NULL){
+		fprintf(stderr, "Error: Simulator model %s could not be opened\n", filename);
+		return 0;
+	}
+
+	while(fgets(line, sizeof(line), file) != NULL){
+		char *args[5];
+		int numArgs = 0;
+		long num[4];
+
+		lineNumber++;
+		char *comment = strstr(line, "//");
+		if(comment != NULL){
+			*comment = '\0';
+		}
+
+		for(char *tok = strtok(line, " \t\r\n"); tok != NULL && numArgs < 5; tok = strtok(NULL, " \t\r\n")){
+			args[numArgs++] = tok;
+		}
+		if(numArgs == 0){
+			continue;
+		}
+
+		for(int i = 1; i < numArgs; i++){
+			if(!simNumber(args[i], &num[i - 1])){
+				numArgs = -1;
+				break;
+			}
+		}
+
+		if(numArgs == 4 && strcmp(args[0], "DEVICE") == 0 && (num[2] == 8 || num[2] == 16)){
+			i2cRipSimDevice_t *dev = simDevice(num[0], num[1], 1);
+			if(dev != NULL){
+				dev->m_regWidth = num[2] / 8;
+				g_simStrict = 1;
+				continue;
+			}
+		}
+		else if(numArgs == 5 && strcmp(args[0], "REG") == 0 && num[2] >= 0 && num[2] < I2C_RIP_SIM_REG_SPACE){
+			i2cRipSimDevice_t *dev = simDevice(num[0], num[1], 1);
+			if(dev != NULL){
+				dev->m_regs[num[2]] = (unsigned char)num[3];
+				continue;
+			}
+		}
+		else if((numArgs == 2 || numArgs == 3) && strcmp(args[0], "LATENCY") == 0){
+			g_simLatencyUs = num[0];
+			g_simByteLatencyUs = (numArgs == 3) ? num[1] : 0;
+			continue;
+		}
+
+		fprintf(stderr, "Error: Simulator model %s line %d invalid\n", filename, lineNumber);
+		fclose(file);
+		return 0;
+	}
+
+	fclose(file);
+	return 1;
+}
+
+// Simulated busses are their own file handles
+int i2cRipSimOpen(int i2cbus){
+	if(i2cbus < 0 || i2cbus >= I2C_RIP_SIM_MAX_BUSSES){
+		return -1;
+	}
+	return i2cbus;
+}
+
+void i2cRipSimClose(int file){
+	(void)file;
+}
+
+// Runs the messages of one I2C_RDWR call against the register maps
+// A write sets the register pointer, further bytes are stored with
+// auto-increment; reads return data from the pointer onwards
+int i2cRipSimRdwr(int file, struct i2c_rdwr_ioctl_data *rdwr){
+	long bytes = 0;
+
+	for(unsigned int i = 0; i < rdwr->nmsgs; i++){
+		struct i2c_msg *msg = &rdwr->msgs[i];
+		i2cRipSimDevice_t *dev = simDevice(file, msg->addr, !g_simStrict);
+
+		if(dev == NULL){
+			errno = ENXIO;
+			return -1;
+		}
+		if(msg->flags & I2C_M_RECV_LEN){
+			errno = EOPNOTSUPP;
+			return -1;
+		}
+
+		if(msg->flags & I2C_M_RD){
+			for(int j = 0; j < msg->len; j++){
+				msg->buf[j] = dev->m_regs[dev->m_pointer];
+				dev->m_pointer = (dev->m_pointer + 1) % I2C_RIP_SIM_REG_SPACE;
+			}
+		}
+		else{
+			int width = dev->m_regWidth;
+			struct i2c_msg *next = (i + 1 < rdwr->nmsgs) ? &rdwr->msgs[i + 1] : NULL;
+
+			// A pointer write ahead of a read tells the register width
+			if(width == I2C_RIP_SIM_WIDTH_AUTO){
+				if(next != NULL && (next->flags & I2C_M_RD) && next->addr == msg->addr && (msg->len == 1 || msg->len == 2)){
+					dev->m_regWidth = msg->len;
+				}
+				width = (dev->m_regWidth != I2C_RIP_SIM_WIDTH_AUTO) ? dev->m_regWidth : 1;
+			}
+
+			if(msg->len >= width){
+				dev->m_pointer = (width == 2) ? ((msg->buf[0] << 8) | msg->buf[1]) : msg->buf[0];
+				for(int j = width; j < msg->len; j++){
+					dev->m_regs[dev->m_pointer] = msg->buf[j];
+					dev->m_pointer = (dev->m_pointer + 1) % I2C_RIP_SIM_REG_SPACE;
+				}
+			}
+		}
+		bytes += msg->len;
+	}
+
+	long us = g_simLatencyUs + g_simByteLatencyUs * bytes;
+	if(us > 0){
+		struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+		while(clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+	}
+
+	return rdwr->nmsgs;
+}
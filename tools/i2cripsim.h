@@ -0,0 +1,43 @@
+/*
+    i2cripsim.h - Simulated I2C devices for i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef _I2CRIPSIM_H
+#define _I2CRIPSIM_H
+
+#include <linux/i2c-dev.h>
+
+#define I2C_RIP_SIM_MAX_BUSSES 64
+#define I2C_RIP_SIM_MAX_SLAVES 0x80
+#define I2C_RIP_SIM_REG_SPACE 0x10000
+
+#define I2C_RIP_SIM_WIDTH_AUTO 0
+
+// One simulated device, a flat register map with an auto-incrementing pointer
+typedef struct i2cRipSimDevice {
+	int m_regWidth;
+	unsigned int m_pointer;
+	unsigned char m_regs[I2C_RIP_SIM_REG_SPACE];
+} i2cRipSimDevice_t;
+
+int i2cRipSimLoadConfig(const char *filename);
+int i2cRipSimOpen(int i2cbus);
+int i2cRipSimRdwr(int file, struct i2c_rdwr_ioctl_data *rdwr);
+void i2cRipSimClose(int file);
+
+#endif
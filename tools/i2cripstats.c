@@ -0,0 +1,316 @@
+/*
+    i2cripstats.c - Run statistics for i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+    Latencies go into log-linear histograms in the style of HdrHistogram:
+    recording is a couple of shifts and an increment, and percentiles are
+    read back with a few percent of error. There is one histogram per
+    command type and one per bus/slave, the latter allocated on first use.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "i2cripstats.h"
+
+#define HIST_SUB_COUNT (1 << I2C_RIP_HIST_SUB_BITS)
+#define HIST_HALF_COUNT (1 << (I2C_RIP_HIST_SUB_BITS - 1))
+
+// Monotonic time in nanoseconds
+__u64 i2cRipStatsNow(void){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (__u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+i2cRipStats_t *i2cRipStatsCreate(void){
+	return (i2cRipStats_t *)calloc(1, sizeof(i2cRipStats_t));
+}
+
+void i2cRipStatsFree(i2cRipStats_t *stats){
+	if(stats == NULL){
+		return;
+	}
+	for(int bus = 0; bus < I2C_RIP_STATS_MAX_BUSSES; bus++){
+		for(int address = 0; address < I2C_RIP_STATS_MAX_SLAVES; address++){
+			free(stats->m_devices[bus][address]);
+		}
+	}
+	free(stats);
+}
+
+// Bucket holding a value
+static int histIndex(__u64 ns){
+	int shift;
+
+	if(ns < HIST_SUB_COUNT){
+		return (int)ns;
+	}
+	shift = (63 - __builtin_clzll(ns)) - (I2C_RIP_HIST_SUB_BITS - 1);
+	if(shift > I2C_RIP_HIST_MAX_SHIFT){
+		return I2C_RIP_HIST_BUCKETS - 1;
+	}
+	return HIST_SUB_COUNT + (shift - 1) * HIST_HALF_COUNT + (int)((ns >> shift) - HIST_HALF_COUNT);
+}
+
+// Highest value that lands in a bucket
+static __u64 histValue(int index){
+	int shift;
+	__u64 sub;
+
+	if(index < HIST_SUB_COUNT){
+		return index;
+	}
+	index -= HIST_SUB_COUNT;
+	shift = index / HIST_HALF_COUNT + 1;
+	sub = index % HIST_HALF_COUNT + HIST_HALF_COUNT;
+	return ((sub + 1) << shift) - 1;
+}
+
+void i2cRipHistRecord(i2cRipHist_t *hist, __u64 ns){
+	if(hist->m_count == 0 || ns < hist->m_min){
+		hist->m_min = ns;
+	}
+	if(ns > hist->m_max){
+		hist->m_max = ns;
+	}
+	hist->m_count++;
+	hist->m_sum += ns;
+	hist->m_buckets[histIndex(ns)]++;
+}
+
+static void histMerge(i2cRipHist_t *to, const i2cRipHist_t *from){
+	if(from->m_count == 0){
+		return;
+	}
+	if(to->m_count == 0 || from->m_min < to->m_min){
+		to->m_min = from->m_min;
+	}
+	if(from->m_max > to->m_max){
+		to->m_max = from->m_max;
+	}
+	to->m_count += from->m_count;
+	to->m_sum += from->m_sum;
+	for(int i = 0; i < I2C_RIP_HIST_BUCKETS; i++){
+		to->m_buckets[i] += from->m_buckets[i];
+	}
+}
+
+// Value at or below which percent of the recorded values fall
+__u64 i2cRipHistPercentile(const i2cRipHist_t *hist, double percent){
+	__u64 target;
+	__u64 seen = 0;
+
+	if(hist->m_count == 0){
+		return 0;
+	}
+	target = (__u64)(percent / 100.0 * hist->m_count + 0.999999);
+	if(target < 1){
+		target = 1;
+	}
+
+	for(int i = 0; i < I2C_RIP_HIST_BUCKETS; i++){
+		seen += hist->m_buckets[i];
+		if(seen >= target){
+			__u64 value = histValue(i);
+			return (value > hist->m_max) ? hist->m_max : value;
+		}
+	}
+	return hist->m_max;
+}
+
+// Folds a worker's statistics into the run's
+void i2cRipStatsMerge(i2cRipStats_t *to, const i2cRipStats_t *from){
+	for(int i = 0; i < I2C_RIP_STATS_MAX_CMDS; i++){
+		histMerge(&to->m_cmds[i], &from->m_cmds[i]);
+	}
+	for(int bus = 0; bus < I2C_RIP_STATS_MAX_BUSSES; bus++){
+		for(int address = 0; address < I2C_RIP_STATS_MAX_SLAVES; address++){
+			if(from->m_devices[bus][address] == NULL){
+				continue;
+			}
+			if(to->m_devices[bus][address] == NULL){
+				to->m_devices[bus][address] = (i2cRipHist_t *)calloc(1, sizeof(i2cRipHist_t));
+				if(to->m_devices[bus][address] == NULL){
+					continue;
+				}
+			}
+			histMerge(to->m_devices[bus][address], from->m_devices[bus][address]);
+		}
+	}
+	to->m_busNs += from->m_busNs;
+	to->m_sleepNs += from->m_sleepNs;
+	to->m_openNs += from->m_openNs;
+	to->m_funcsNs += from->m_funcsNs;
+	to->m_rdwrCalls += from->m_rdwrCalls;
+	to->m_transfers += from->m_transfers;
+	to->m_bytes += from->m_bytes;
+	to->m_elided += from->m_elided;
+	histMerge(&to->m_lockWait, &from->m_lockWait);
+	to->m_yields += from->m_yields;
+}
+
+void i2cRipStatsCmd(i2cRipStats_t *stats, int cmd, __u64 ns){
+	if(cmd >= 0 && cmd < I2C_RIP_STATS_MAX_CMDS){
+		i2cRipHistRecord(&stats->m_cmds[cmd], ns);
+	}
+}
+
+// Records a transfer that went out, per command type and per device
+void i2cRipStatsTransfer(i2cRipStats_t *stats, int cmd, int bus, int address, __u64 ns, int bytes){
+	i2cRipStatsCmd(stats, cmd, ns);
+	stats->m_transfers++;
+	stats->m_bytes += bytes;
+
+	if(bus < 0 || bus >= I2C_RIP_STATS_MAX_BUSSES || address < 0 || address >= I2C_RIP_STATS_MAX_SLAVES){
+		return;
+	}
+	if(stats->m_devices[bus][address] == NULL){
+		stats->m_devices[bus][address] = (i2cRipHist_t *)calloc(1, sizeof(i2cRipHist_t));
+		if(stats->m_devices[bus][address] == NULL){
+			return;
+		}
+	}
+	i2cRipHistRecord(stats->m_devices[bus][address], ns);
+}
+
+static double msOf(__u64 ns){
+	return ns / 1000000.0;
+}
+
+static double usOf(__u64 ns){
+	return ns / 1000.0;
+}
+
+static double perSecond(__u64 count, __u64 ns){
+	return (ns > 0) ? count * 1000000000.0 / ns : 0.0;
+}
+
+static const char *cmdName(const i2cRipStatsRun_t *run, int cmd){
+	if(cmd < run->m_numCmdNames && run->m_cmdNames[cmd] != NULL){
+		return run->m_cmdNames[cmd];
+	}
+	return "?";
+}
+
+static void printHist(FILE *out, const char *label, const i2cRipHist_t *hist){
+	fprintf(out, "  %-14s %8llu %10.1f %10.1f %10.1f %12.3f\n", label,
+		(unsigned long long)hist->m_count,
+		usOf(i2cRipHistPercentile(hist, 50.0)),
+		usOf(i2cRipHistPercentile(hist, 99.0)),
+		usOf(hist->m_max), msOf(hist->m_sum));
+}
+
+// Prints the summary table
+void i2cRipStatsPrint(const i2cRipStats_t *stats, const i2cRipStatsRun_t *run, FILE *out){
+	fprintf(out, "Stats: %d commands in %.3f ms, parse %.3f ms\n",
+		run->m_numCmds, msOf(run->m_wallNs), msOf(run->m_parseNs));
+	fprintf(out, "  Bus time %.3f ms in %llu I2C_RDWR calls, %llu bytes on the wire\n",
+		msOf(stats->m_busNs), (unsigned long long)stats->m_rdwrCalls, (unsigned long long)stats->m_bytes);
+	fprintf(out, "  Sleep time %.3f ms, bus open %.3f ms, check funcs %.3f ms\n",
+		msOf(stats->m_sleepNs), msOf(stats->m_openNs), msOf(stats->m_funcsNs));
+	fprintf(out, "  %llu transfers, %.1f/s on the bus, %.1f/s overall\n",
+		(unsigned long long)stats->m_transfers,
+		perSecond(stats->m_transfers, stats->m_busNs), perSecond(stats->m_transfers, run->m_wallNs));
+	if(stats->m_elided > 0){
+		fprintf(out, "  %llu writes elided, register values already set\n", (unsigned long long)stats->m_elided);
+	}
+	if(stats->m_lockWait.m_count > 0){
+		fprintf(out, "  Bus locked %llu times, waited %.3f ms, p99 %.1f us, max %.1f us, gave way %llu times\n",
+			(unsigned long long)stats->m_lockWait.m_count, msOf(stats->m_lockWait.m_sum),
+			usOf(i2cRipHistPercentile(&stats->m_lockWait, 99.0)), usOf(stats->m_lockWait.m_max),
+			(unsigned long long)stats->m_yields);
+	}
+
+	fprintf(out, "  %-14s %8s %10s %10s %10s %12s\n", "Command", "Count", "p50 us", "p99 us", "max us", "total ms");
+	for(int cmd = 0; cmd < I2C_RIP_STATS_MAX_CMDS; cmd++){
+		if(stats->m_cmds[cmd].m_count > 0){
+			printHist(out, cmdName(run, cmd), &stats->m_cmds[cmd]);
+		}
+	}
+
+	fprintf(out, "  %-14s %8s %10s %10s %10s %12s\n", "Bus/Slave", "Count", "p50 us", "p99 us", "max us", "total ms");
+	for(int bus = 0; bus < I2C_RIP_STATS_MAX_BUSSES; bus++){
+		for(int address = 0; address < I2C_RIP_STATS_MAX_SLAVES; address++){
+			if(stats->m_devices[bus][address] != NULL){
+				char label[16];
+				snprintf(label, sizeof(label), "%d/0x%02x", bus, address);
+				printHist(out, label, stats->m_devices[bus][address]);
+			}
+		}
+	}
+}
+
+static void jsonHist(FILE *out, const i2cRipHist_t *hist){
+	fprintf(out, "\"count\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"total_ns\": %llu}",
+		(unsigned long long)hist->m_count,
+		(unsigned long long)i2cRipHistPercentile(hist, 50.0),
+		(unsigned long long)i2cRipHistPercentile(hist, 99.0),
+		(unsigned long long)hist->m_max, (unsigned long long)hist->m_sum);
+}
+
+// Writes the same figures as the summary as JSON, times in nanoseconds
+int i2cRipStatsWriteJson(const i2cRipStats_t *stats, const i2cRipStatsRun_t *run, const char *filename){
+	FILE *out = fopen(filename, "w");
+	const char *sep = "";
+
+	if(out == NULL){
+		return 0;
+	}
+
+	fprintf(out, "{\n  \"commands\": %d,\n  \"run_ns\": %llu,\n  \"parse_ns\": %llu,\n",
+		run->m_numCmds, (unsigned long long)run->m_wallNs, (unsigned long long)run->m_parseNs);
+	fprintf(out, "  \"bus_ns\": %llu,\n  \"sleep_ns\": %llu,\n  \"open_ns\": %llu,\n  \"check_funcs_ns\": %llu,\n",
+		(unsigned long long)stats->m_busNs, (unsigned long long)stats->m_sleepNs,
+		(unsigned long long)stats->m_openNs, (unsigned long long)stats->m_funcsNs);
+	fprintf(out, "  \"rdwr_calls\": %llu,\n  \"transfers\": %llu,\n  \"bytes\": %llu,\n  \"elided\": %llu,\n",
+		(unsigned long long)stats->m_rdwrCalls, (unsigned long long)stats->m_transfers,
+		(unsigned long long)stats->m_bytes, (unsigned long long)stats->m_elided);
+	fprintf(out, "  \"transfers_per_s_bus\": %.1f,\n  \"transfers_per_s\": %.1f,\n",
+		perSecond(stats->m_transfers, stats->m_busNs), perSecond(stats->m_transfers, run->m_wallNs));
+
+	fprintf(out, "  \"lock_wait\": {");
+	jsonHist(out, &stats->m_lockWait);
+	fprintf(out, ",\n  \"yields\": %llu,\n", (unsigned long long)stats->m_yields);
+
+	fprintf(out, "  \"by_command\": [");
+	for(int cmd = 0; cmd < I2C_RIP_STATS_MAX_CMDS; cmd++){
+		if(stats->m_cmds[cmd].m_count > 0){
+			fprintf(out, "%s\n    {\"command\": \"%s\", ", sep, cmdName(run, cmd));
+			jsonHist(out, &stats->m_cmds[cmd]);
+			sep = ",";
+		}
+	}
+	fprintf(out, "\n  ],\n  \"by_device\": [");
+	sep = "";
+	for(int bus = 0; bus < I2C_RIP_STATS_MAX_BUSSES; bus++){
+		for(int address = 0; address < I2C_RIP_STATS_MAX_SLAVES; address++){
+			if(stats->m_devices[bus][address] != NULL){
+				fprintf(out, "%s\n    {\"bus\": %d, \"address\": %d, ", sep, bus, address);
+				jsonHist(out, stats->m_devices[bus][address]);
+				sep = ",";
+			}
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	return fclose(out) == 0;
+}
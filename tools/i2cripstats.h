@@ -0,0 +1,82 @@
+/*
+    i2cripstats.h - Run statistics for i2crip
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef _I2CRIPSTATS_H
+#define _I2CRIPSTATS_H
+
+#include <stdio.h>
+#include <linux/types.h>
+
+#define I2C_RIP_STATS_MAX_BUSSES 64
+#define I2C_RIP_STATS_MAX_SLAVES 0x80
+#define I2C_RIP_STATS_MAX_CMDS 64
+
+// Values below 2^SUB_BITS are exact, above that each power of two
+// is split into 2^(SUB_BITS - 1) buckets, about 3% resolution
+#define I2C_RIP_HIST_SUB_BITS 6
+#define I2C_RIP_HIST_MAX_SHIFT 42
+#define I2C_RIP_HIST_BUCKETS ((1 << I2C_RIP_HIST_SUB_BITS) + \
+	I2C_RIP_HIST_MAX_SHIFT * (1 << (I2C_RIP_HIST_SUB_BITS - 1)))
+
+// Log-linear latency histogram in nanoseconds
+typedef struct i2cRipHist {
+	__u64 m_count;
+	__u64 m_min;
+	__u64 m_max;
+	__u64 m_sum;
+	__u64 m_buckets[I2C_RIP_HIST_BUCKETS];
+} i2cRipHist_t;
+
+// Statistics of a run, or of one worker thread of it
+typedef struct i2cRipStats {
+	i2cRipHist_t m_cmds[I2C_RIP_STATS_MAX_CMDS];
+	i2cRipHist_t *m_devices[I2C_RIP_STATS_MAX_BUSSES][I2C_RIP_STATS_MAX_SLAVES];
+	__u64 m_busNs;
+	__u64 m_sleepNs;
+	__u64 m_openNs;
+	__u64 m_funcsNs;
+	__u64 m_rdwrCalls;
+	__u64 m_transfers;
+	__u64 m_bytes;
+	__u64 m_elided;
+	i2cRipHist_t m_lockWait;
+	__u64 m_yields;
+} i2cRipStats_t;
+
+// Totals of a run that are not per command
+typedef struct i2cRipStatsRun {
+	__u64 m_wallNs;
+	__u64 m_parseNs;
+	int m_numCmds;
+	const char *const *m_cmdNames;
+	int m_numCmdNames;
+} i2cRipStatsRun_t;
+
+__u64 i2cRipStatsNow(void);
+i2cRipStats_t *i2cRipStatsCreate(void);
+void i2cRipStatsFree(i2cRipStats_t *stats);
+void i2cRipStatsMerge(i2cRipStats_t *to, const i2cRipStats_t *from);
+void i2cRipHistRecord(i2cRipHist_t *hist, __u64 ns);
+__u64 i2cRipHistPercentile(const i2cRipHist_t *hist, double percent);
+void i2cRipStatsCmd(i2cRipStats_t *stats, int cmd, __u64 ns);
+void i2cRipStatsTransfer(i2cRipStats_t *stats, int cmd, int bus, int address, __u64 ns, int bytes);
+void i2cRipStatsPrint(const i2cRipStats_t *stats, const i2cRipStatsRun_t *run, FILE *out);
+int i2cRipStatsWriteJson(const i2cRipStats_t *stats, const i2cRipStatsRun_t *run, const char *filename);
+
+#endif
@@ -319,6 +319,9 @@ int main(int argc, char *argv[])
 			     value, vmask, block, len, pec))
 		exit(0);
 
+	if (lock_i2c_dev(file, i2cbus) < 0)
+		exit(1);
+
 	if (vmask) {
 		int oldvalue;
 
@@ -0,0 +1,296 @@
+/*
+    i2ctop.c - Show which processes and devices keep I2C busses busy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+    Reads the transfer counters libi2c keeps in shared memory for the
+    files of processes run with I2C_STATS set (see i2c/stats.h) and
+    shows their rates over each interval.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <i2c/stats.h>
+#include "i2cbusses.h"
+#include "../version.h"
+
+#define MAX_BUSSES	64
+
+struct bus_view {
+	int bus;
+	const struct i2c_stats_page *page;
+	struct i2c_stats_page prev;
+};
+
+static void help(void)
+{
+	fprintf(stderr,
+		"Usage: i2ctop [-d SECONDS] [-n COUNT] [I2CBUS...]\n"
+		"  I2CBUS is an integer or an I2C bus name\n"
+		"  Without I2CBUS, all busses with counters are shown\n"
+		"  Processes are counted when run with I2C_STATS set\n");
+}
+
+static const struct i2c_stats_page *map_page(const char *filename)
+{
+	struct i2c_stats_page *page;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	if (page->magic != I2C_STATS_MAGIC ||
+	    page->version != I2C_STATS_VERSION ||
+	    page->size != sizeof(*page)) {
+		munmap(page, sizeof(*page));
+		return NULL;
+	}
+	return page;
+}
+
+static int add_bus(struct bus_view *views, int nviews, int bus)
+{
+	char filename[64];
+
+	if (nviews == MAX_BUSSES)
+		return nviews;
+
+	snprintf(filename, sizeof(filename), "%s/i2c-stats-%d", I2C_STATS_DIR,
+		 bus);
+	views[nviews].page = map_page(filename);
+	if (!views[nviews].page) {
+		fprintf(stderr, "Error: No transfer counters for bus %d in "
+			"%s\n", bus, I2C_STATS_DIR);
+		return nviews;
+	}
+	views[nviews].bus = bus;
+	memcpy(&views[nviews].prev, views[nviews].page,
+	       sizeof(views[nviews].prev));
+	return nviews + 1;
+}
+
+static int scan_busses(struct bus_view *views)
+{
+	struct dirent *de;
+	int nviews = 0, bus;
+	char *end;
+	DIR *dir;
+
+	dir = opendir(I2C_STATS_DIR);
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "i2c-stats-", 10))
+			continue;
+		bus = strtol(de->d_name + 10, &end, 10);
+		if (*end || end == de->d_name + 10)
+			continue;
+		nviews = add_bus(views, nviews, bus);
+	}
+	closedir(dir);
+	return nviews;
+}
+
+static const char *errno_name(int err)
+{
+	static char buf[16];
+
+	switch (err) {
+	case EIO:		return "EIO";
+	case ENXIO:		return "ENXIO";
+	case EAGAIN:		return "EAGAIN";
+	case EBUSY:		return "EBUSY";
+	case ENODEV:		return "ENODEV";
+	case EINVAL:		return "EINVAL";
+	case EPROTO:		return "EPROTO";
+	case EBADMSG:		return "EBADMSG";
+	case EOPNOTSUPP:	return "EOPNOTSUPP";
+	case ETIMEDOUT:		return "ETIMEDOUT";
+	case EREMOTEIO:		return "EREMOTEIO";
+	case I2C_STATS_ERRNOS - 1:
+		return "other";
+	}
+	snprintf(buf, sizeof(buf), "%d", err);
+	return buf;
+}
+
+static __u64 delta(__u64 now, __u64 then)
+{
+	/* A slot taken over by a new process starts from 0 */
+	return now >= then ? now - then : now;
+}
+
+static void print_counters(const char *label,
+			   const struct i2c_stats_counters *now,
+			   const struct i2c_stats_counters *then,
+			   double seconds)
+{
+	printf("%-22s %9.0f %9.0f %7.0f %6.1f%%", label,
+	       delta(now->ops, then->ops) / seconds,
+	       delta(now->bytes, then->bytes) / seconds,
+	       delta(now->errors, then->errors) / seconds,
+	       delta(now->busy_ns, then->busy_ns) / seconds / 1e7);
+}
+
+static void show_bus(struct bus_view *view, double seconds)
+{
+	struct i2c_stats_page now;
+	const struct i2c_stats_slot *slot, *old;
+	char label[32];
+	__u64 count;
+	int i, j;
+
+	memcpy(&now, view->page, sizeof(now));
+
+	printf("Bus %d\n", view->bus);
+	printf("%-22s %9s %9s %7s %7s\n", "  PID COMMAND", "OPS/s",
+	       "BYTES/s", "ERR/s", "BUSY");
+	for (i = 0; i < I2C_STATS_SLOTS; i++) {
+		slot = &now.slot[i];
+		old = &view->prev.slot[i];
+		if (!slot->pid)
+			continue;
+		if (old->pid != slot->pid)
+			old = NULL;
+		/* Processes that are gone only show while they still count */
+		if (kill(slot->pid, 0) < 0 && errno == ESRCH &&
+		    old && old->total.ops == slot->total.ops)
+			continue;
+
+		snprintf(label, sizeof(label), "%5d %.15s", slot->pid,
+			 slot->comm);
+		if (old) {
+			print_counters(label, &slot->total, &old->total,
+				       seconds);
+		} else {
+			struct i2c_stats_counters zero = { 0 };
+
+			print_counters(label, &slot->total, &zero, seconds);
+		}
+		for (j = 1; j < I2C_STATS_ERRNOS; j++) {
+			count = old ? delta(slot->errnos[j], old->errnos[j]) :
+				slot->errnos[j];
+			if (count)
+				printf(" %s:%llu", errno_name(j),
+				       (unsigned long long)count);
+		}
+		printf("\n");
+	}
+
+	printf("%-22s %9s %9s %7s %7s\n", "  ADDRESS", "OPS/s", "BYTES/s",
+	       "ERR/s", "BUSY");
+	for (i = 0; i < I2C_STATS_ADDRS; i++) {
+		if (now.addr[i].ops == view->prev.addr[i].ops)
+			continue;
+		snprintf(label, sizeof(label), "  0x%02x", i);
+		print_counters(label, &now.addr[i], &view->prev.addr[i],
+			       seconds);
+		printf("\n");
+	}
+	printf("\n");
+
+	memcpy(&view->prev, &now, sizeof(view->prev));
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct bus_view views[MAX_BUSSES];
+	int opt, nviews = 0, count = -1, clear, i, bus;
+	double interval = 1.0, then, now;
+	char *end;
+
+	while ((opt = getopt(argc, argv, "d:n:hV")) != -1) {
+		switch (opt) {
+		case 'd':
+			interval = strtod(optarg, &end);
+			if (*end || interval <= 0) {
+				fprintf(stderr, "Error: Invalid delay\n");
+				help();
+				exit(1);
+			}
+			break;
+		case 'n':
+			count = strtol(optarg, &end, 0);
+			if (*end || count <= 0) {
+				fprintf(stderr, "Error: Invalid count\n");
+				help();
+				exit(1);
+			}
+			break;
+		case 'V':
+			fprintf(stderr, "i2ctop version %s\n", VERSION);
+			exit(0);
+		case 'h':
+		case '?':
+			help();
+			exit(opt == '?');
+		}
+	}
+
+	if (optind == argc) {
+		nviews = scan_busses(views);
+	} else {
+		for (i = optind; i < argc; i++) {
+			bus = lookup_i2c_bus(argv[i]);
+			if (bus < 0)
+				exit(1);
+			nviews = add_bus(views, nviews, bus);
+		}
+	}
+	if (!nviews) {
+		fprintf(stderr, "Error: No transfer counters found, run the "
+			"I2C programs with I2C_STATS=1\n");
+		exit(1);
+	}
+
+	clear = isatty(STDOUT_FILENO) && count != 1;
+	then = now_seconds();
+	while (count == -1 || count--) {
+		usleep(interval * 1e6);
+		now = now_seconds();
+		if (clear)
+			printf("\033[H\033[2J");
+		for (i = 0; i < nviews; i++)
+			show_bus(&views[i], now - then);
+		fflush(stdout);
+		then = now;
+	}
+
+	exit(0);
+}
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
+#include <i2c/smbus.h>
 #include "i2cbusses.h"
 #include "util.h"
 #include "../version.h"
@@ -319,13 +320,12 @@ int main(int argc, char *argv[])
 	}
 
 	if (yes || confirm(filename, msgs, nmsgs)) {
-		struct i2c_rdwr_ioctl_data rdwr;
+		if (lock_i2c_dev(file, i2cbus) < 0)
+			goto err_out;
 
-		rdwr.msgs = msgs;
-		rdwr.nmsgs = nmsgs;
-		nmsgs_sent = ioctl(file, I2C_RDWR, &rdwr);
+		nmsgs_sent = i2c_rdwr_access(file, msgs, nmsgs);
 		if (nmsgs_sent < 0) {
-			fprintf(stderr, "Error: Sending messages failed: %s\n", strerror(errno));
+			fprintf(stderr, "Error: Sending messages failed: %s\n", strerror(-nmsgs_sent));
 			goto err_out;
 		} else if (nmsgs_sent < nmsgs) {
 			fprintf(stderr, "Warning: only %d/%d messages were sent\n", nmsgs_sent, nmsgs);